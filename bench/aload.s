@@ -0,0 +1,50 @@
+; sums a 1000-element heap array with four async loads in flight at a time
+; input: number of rounds
+start main 0:
+.entry:
+  r1 = call read
+  r2 = malloc 8000
+  r3 = mul 0 0 64
+  br .fill
+.fill:
+  r4 = icmp uge r3 1000 64
+  br r4 .rounds .fill_body
+.fill_body:
+  r5 = mul r3 8 64
+  r6 = add r2 r5 64
+  store 8 r3 r6
+  r3 = incr r3 64
+  br .fill
+.rounds:
+  r7 = mul 0 0 64
+  r8 = mul 0 0 64
+  br .round
+.round:
+  r9 = icmp uge r7 r1 64
+  br r9 .exit .sum_init
+.sum_init:
+  r10 = add r2 0 64
+  r11 = add r2 8000 64
+  br .sum
+.sum:
+  r12 = icmp uge r10 r11 64
+  br r12 .next .sum_body
+.sum_body:
+  r18 = add r10 8 64
+  r19 = add r10 16 64
+  r20 = add r10 24 64
+  r13 = aload 8 r10
+  r14 = aload 8 r18
+  r15 = aload 8 r19
+  r16 = aload 8 r20
+  r17 = sum r13 r14 r15 r16 r8 0 0 0 64
+  r8 = add r17 0 64
+  r10 = add r10 32 64
+  br .sum
+.next:
+  r7 = incr r7 64
+  br .round
+.exit:
+  free r2
+  ret r8
+end main
@@ -0,0 +1,329 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "bytecode.h"
+#include "state.h"
+#include "memory.h"
+#include "io.h"
+#include "error.h"
+
+using namespace std;
+
+
+#ifndef SF_BENCH_DIR
+#define SF_BENCH_DIR "bench"
+#endif
+
+/** an Output that drops everything written to it */
+class NullOutput: public Output {
+protected:
+  void write_out(const char*, size_t) override {}
+};
+
+/** a measurement; ops are executed instructions for programs */
+struct BenchResult {
+  bool ok;
+  double wall;
+  uint64_t ops;
+  const char* unit;
+  string error;
+};
+
+/** a program of the corpus, run with its problem size as the input */
+struct Workload {
+  const char* name;
+  const char* file;
+  uint64_t size;
+  uint64_t quick_size;
+};
+
+static const Workload WORKLOADS[] = {
+  {"recursion", "fib.s", 29, 20},
+  {"linked_list", "linked_list.s", 3000, 100},
+  {"stack_array", "stack_array.s", 1000, 30},
+  {"heap_array", "heap_array.s", 1000, 30},
+  {"malloc_free", "malloc_free.s", 200000, 5000},
+  {"switch", "switch.s", 3000000, 100000},
+  {"aload", "aload.s", 3000, 100},
+  {"io", "io.s", 1000000, 30000},
+  {"bop", "bop.s", 500000, 20000}
+};
+
+struct BenchOptions {
+  string bench_dir = SF_BENCH_DIR;
+  bool jsonl = false;
+  bool quick = false;
+  bool tree = true;
+  bool bytecode = true;
+  bool jit = true;
+  vector<string> filters;
+};
+
+static double seconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static string make_input(const Workload& workload, uint64_t size) {
+  stringstream ss;
+  ss << size << "\n";
+  // io.s reads the numbers to sum after the count
+  if (string(workload.file) == "io.s") {
+    for (uint64_t i = 0; i < size; i++)
+      ss << i * 7919 % 100003 << "\n";
+  }
+  return ss.str();
+}
+
+static BenchResult run_program(const BenchOptions& options, const Workload& workload, bool use_bytecode,
+                               bool use_jit) {
+  string filename = options.bench_dir + "/" + workload.file;
+  unique_ptr<Program> program(parse(filename));
+  if (program == nullptr)
+    return BenchResult{false, 0, 0, "insts", "cannot find " + filename};
+
+  string input_data = make_input(workload, options.quick ? workload.quick_size : workload.size);
+  MemoryInput input(input_data);
+  NullOutput output;
+  State state;
+  state.set_program(program.get());
+  state.set_io(input, output);
+  ExecOptions exec_options;
+  exec_options.jit = use_jit;
+  state.set_options(exec_options);
+
+  try {
+    auto start = chrono::steady_clock::now();
+    if (use_bytecode) {
+      Bytecode bytecode(program.get());
+      state.exec_bytecode(bytecode);
+    }
+    else
+      state.exec_program();
+    return BenchResult{true, seconds_since(start), state.get_inst_count(), "insts", ""};
+  }
+  catch (const ExecutionError& e) {
+    return BenchResult{false, 0, state.get_inst_count(), "insts", e.what()};
+  }
+}
+
+/** parse(): a generated program of about 100 lines per function */
+static BenchResult bench_parse(const BenchOptions& options) {
+  int nfunctions = options.quick ? 100 : 2000;
+  stringstream ss;
+  uint64_t lines = 0;
+  for (int i = 0; i < nfunctions; i++) {
+    ss << "start f" << i << " 2:\n.entry:\n  r1 = add arg1 arg2 64\n  br .loop\n.loop:\n";
+    for (int j = 0; j < 16; j++) {
+      ss << "  r2 = mul r1 " << j << " 64\n";
+      ss << "  r3 = icmp ult r2 1000 32\n";
+      ss << "  r4 = select r3 r2 r1\n";
+      ss << "  r5 = load 8 sp\n";
+      ss << "  store 8 r4 sp\n";
+      lines += 5;
+    }
+    ss << "  r6 = sum r1 r2 r3 r4 r5 1 2 3 64\n";
+    ss << "  switch r6 1 .a 2 .b .c\n.a:\n  br .loop\n.b:\n  ret r6\n.c:\n  ret 0\nend f" << i << "\n\n";
+    lines += 18;
+  }
+  ss << "start main 0:\n.entry:\n  ret 0\nend main\n";
+  string source = ss.str();
+
+  auto start = chrono::steady_clock::now();
+  unique_ptr<Program> program(parse_source(source, "generated.s"));
+  double wall = seconds_since(start);
+  if (program == nullptr)
+    return BenchResult{false, 0, 0, "lines", "cannot parse the generated program"};
+  return BenchResult{true, wall, lines, "lines", ""};
+}
+
+/** Memory::exec_malloc and exec_free over a fragmented heap */
+static BenchResult bench_malloc_free(const BenchOptions& options) {
+  uint64_t rounds = options.quick ? 20000 : 2000000;
+  Memory memory;
+  vector<uint64_t> blocks;
+  uint64_t addr;
+  for (int i = 0; i < 2000; i++) {
+    memory.exec_malloc(8 * (i % 37 + 1), addr);
+    blocks.push_back(addr);
+  }
+  for (size_t i = 0; i < blocks.size(); i += 2)
+    memory.exec_free(blocks[i]);
+
+  auto start = chrono::steady_clock::now();
+  for (uint64_t i = 0; i < rounds; i++) {
+    memory.exec_malloc(8 * (i % 53 + 1), addr);
+    memory.exec_free(addr);
+  }
+  return BenchResult{true, seconds_since(start), 2 * rounds, "ops", ""};
+}
+
+/** Memory::exec_load and exec_store on heap blocks, which check that the address is allocated */
+static BenchResult bench_heap_access(const BenchOptions& options) {
+  uint64_t rounds = options.quick ? 100000 : 20000000;
+  Memory memory;
+  vector<uint64_t> blocks;
+  uint64_t addr;
+  for (int i = 0; i < 1024; i++) {
+    memory.exec_malloc(64, addr);
+    blocks.push_back(addr);
+  }
+
+  auto start = chrono::steady_clock::now();
+  uint64_t val = 0;
+  uint64_t seed = 1;
+  for (uint64_t i = 0; i < rounds; i++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint64_t p = blocks[(seed >> 33) % blocks.size()] + (seed >> 20) % 8 * 8;
+    if (i % 2 == 0)
+      memory.exec_load(false, MSize8, p, val);
+    else
+      memory.exec_store(MSize8, p, val + i);
+  }
+  return BenchResult{true, seconds_since(start), rounds, "ops", ""};
+}
+
+static void report(const BenchOptions& options, const string& name, const string& engine, const BenchResult& result,
+                   long peak_rss_kb) {
+  char wall[32], rate[32];
+  snprintf(wall, sizeof(wall), "%.4f", result.wall);
+  snprintf(rate, sizeof(rate), "%.0f", result.wall > 0 ? result.ops / result.wall : 0.0);
+
+  if (options.jsonl) {
+    cout << "{\"benchmark\":\"" << name << "\",\"engine\":\"" << engine << "\",\"ok\":"
+         << (result.ok ? "true" : "false") << ",\"wall_s\":" << wall << ",\"ops\":" << result.ops
+         << ",\"unit\":\"" << result.unit << "\",\"ops_per_s\":" << rate << ",\"peak_rss_kb\":" << peak_rss_kb
+         << "}" << endl;
+    return;
+  }
+
+  cout << name << "\t" << engine << "\t";
+  if (result.ok)
+    cout << wall << "\t" << result.ops << " " << result.unit << "\t" << rate << "\t" << peak_rss_kb << endl;
+  else
+    cout << "failed: " << result.error.substr(0, result.error.find('\n')) << endl;
+}
+
+// exit statuses of a child that reported its result
+#define BENCH_EXIT_OK 0
+#define BENCH_EXIT_FAILED 3
+
+/** runs bench in a child process, so that its peak RSS and any crash are its own */
+template <typename F>
+static bool run_isolated(const BenchOptions& options, const string& name, const string& engine, F bench) {
+  cout.flush();
+  pid_t pid = fork();
+  if (pid < 0) {
+    report(options, name, engine, BenchResult{false, 0, 0, "ops", "cannot fork"}, 0);
+    return false;
+  }
+
+  if (pid == 0) {
+    BenchResult result = bench();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    report(options, name, engine, result, usage.ru_maxrss);
+    cout.flush();
+    _exit(result.ok ? BENCH_EXIT_OK : BENCH_EXIT_FAILED);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status)) {
+    report(options, name, engine, BenchResult{false, 0, 0, "ops", "terminated abnormally"}, 0);
+    return false;
+  }
+  // e.g. a syntax error, which exits without reporting
+  if (WEXITSTATUS(status) != BENCH_EXIT_OK && WEXITSTATUS(status) != BENCH_EXIT_FAILED) {
+    report(options, name, engine, BenchResult{false, 0, 0, "ops", "exited with an error"}, 0);
+    return false;
+  }
+  return WEXITSTATUS(status) == BENCH_EXIT_OK;
+}
+
+static bool selected(const BenchOptions& options, const string& name) {
+  if (options.filters.empty())
+    return true;
+  for (auto& filter: options.filters)
+    if (filter == name)
+      return true;
+  return false;
+}
+
+static void print_usage() {
+  cout << "USAGE: sf-bench [options] [benchmark]..." << endl;
+  cout << "Runs the programs in the benchmark directory and microbenchmarks of the interpreter," << endl;
+  cout << "all of them unless benchmarks are named." << endl;
+  cout << "Options:" << endl;
+  cout << "  --bench-dir=DIR     read the programs from DIR (default " << SF_BENCH_DIR << ")" << endl;
+  cout << "  --engine=tree       run the programs with the statement engine only" << endl;
+  cout << "  --engine=bytecode   run the programs with the bytecode engine only" << endl;
+  cout << "  --engine=jit        run the programs with the bytecode engine and its JIT only" << endl;
+  cout << "  --format=jsonl      print one JSON object per benchmark" << endl;
+  cout << "  --quick             use small problem sizes, e.g. to check that everything runs" << endl;
+  cout << "Benchmarks:" << endl;
+  cout << " ";
+  for (auto& workload: WORKLOADS)
+    cout << " " << workload.name;
+  cout << " parse malloc_free_micro heap_access" << endl;
+}
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg.rfind("--bench-dir=", 0) == 0)
+      options.bench_dir = arg.substr(12);
+    else if (arg == "--engine=tree")
+      options.bytecode = options.jit = false;
+    else if (arg == "--engine=bytecode")
+      options.tree = options.jit = false;
+    else if (arg == "--engine=jit")
+      options.tree = options.bytecode = false;
+    else if (arg == "--format=jsonl")
+      options.jsonl = true;
+    else if (arg == "--format=text")
+      options.jsonl = false;
+    else if (arg == "--quick")
+      options.quick = true;
+    else if (arg.rfind("--", 0) == 0) {
+      print_usage();
+      return 1;
+    }
+    else
+      options.filters.push_back(arg);
+  }
+
+  if (!options.jsonl)
+    cout << "Benchmark\tEngine\tWall (s)\tOps\tOps/s\tPeak RSS (KB)" << endl;
+
+  bool ok = true;
+  for (auto& workload: WORKLOADS) {
+    if (!selected(options, workload.name))
+      continue;
+    if (options.tree)
+      ok &= run_isolated(options, workload.name, "tree", [&]() { return run_program(options, workload, false, false); });
+    if (options.bytecode)
+      ok &= run_isolated(options, workload.name, "bytecode", [&]() { return run_program(options, workload, true, false); });
+    if (options.jit && Jit::is_supported())
+      ok &= run_isolated(options, workload.name, "jit", [&]() { return run_program(options, workload, true, true); });
+  }
+
+  if (selected(options, "parse"))
+    ok &= run_isolated(options, "parse", "-", [&]() { return bench_parse(options); });
+  if (selected(options, "malloc_free_micro"))
+    ok &= run_isolated(options, "malloc_free_micro", "-", [&]() { return bench_malloc_free(options); });
+  if (selected(options, "heap_access"))
+    ok &= run_isolated(options, "heap_access", "-", [&]() { return bench_heap_access(options); });
+
+  return ok ? 0 : 1;
+}
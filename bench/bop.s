@@ -0,0 +1,42 @@
+; runs every binary and unary operation at mixed bit widths in a loop
+; input: number of iterations
+start main 0:
+.entry:
+  r1 = call read
+  r2 = mul 0 0 64
+  r3 = add 12345 0 64
+  br .loop
+.loop:
+  r4 = add r3 r2 64
+  r5 = sub r4 7 32
+  r6 = mul r5 r4 16
+  r7 = udiv r6 3 64
+  r8 = sdiv r7 5 32
+  r9 = urem r8 11 16
+  r10 = srem r9 13 8
+  r11 = shl r10 r2 64
+  r12 = lshr r11 3 32
+  r13 = ashr r12 2 16
+  r14 = and r13 r4 64
+  r15 = or r14 r5 32
+  r16 = xor r15 r6 8
+  r17 = icmp eq r16 r7 64
+  r18 = icmp ne r16 r8 32
+  r19 = icmp ugt r9 r10 16
+  r20 = icmp uge r11 r12 8
+  r21 = icmp sgt r13 r14 64
+  r22 = icmp sge r15 r16 32
+  r23 = icmp slt r13 r9 16
+  r24 = icmp sle r10 r11 8
+  r25 = icmp ule r12 r14 1
+  r26 = sum r17 r18 r19 r20 r21 r22 r23 r24 64
+  r27 = decr r25 8
+  r28 = incr r27 16
+  r3 = add r3 r26 64
+  r3 = xor r3 r28 32
+  r2 = incr r2 64
+  r29 = icmp ult r2 r1 64
+  br r29 .loop .exit
+.exit:
+  ret r3
+end main
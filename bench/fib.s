@@ -0,0 +1,23 @@
+; naive recursive fibonacci, dominated by calls and returns
+; input: n
+start fib 1:
+.entry:
+  r1 = icmp ult arg1 2 64
+  br r1 .base .rec
+.base:
+  ret arg1
+.rec:
+  r2 = sub arg1 1 64
+  r3 = call fib r2
+  r4 = sub arg1 2 64
+  r5 = call fib r4
+  r6 = add r3 r5 64
+  ret r6
+end fib
+
+start main 0:
+.entry:
+  r1 = call read
+  r2 = call fib r1
+  ret r2
+end main
@@ -0,0 +1,39 @@
+#!/bin/bash
+# emits a generated SWPP assembly program with N functions of about 50 lines each
+# usage: bench/gen_large.sh N > large.s
+
+N=${1:-1000}
+
+for ((i = 0; i < N; i++)); do
+  echo "start f$i 2:"
+  echo ".entry:"
+  echo "  r1 = add arg1 arg2 64"
+  echo "  br .loop"
+  echo ".loop:"
+  for ((j = 0; j < 8; j++)); do
+    echo "  r2 = mul r1 $j 64"
+    echo "  r3 = icmp ult r2 1000 32"
+    echo "  r4 = select r3 r2 r1"
+    echo "  r5 = load 8 sp"
+    echo "  store 8 r4 sp"
+  done
+  echo "  r6 = sum r1 r2 r3 r4 r5 1 2 3 64"
+  echo "  switch r6 0 .exit 1 .loop .exit"
+  echo ".exit:"
+  if ((i > 0)); then
+    echo "  r7 = call f$((i - 1)) r6 arg2"
+    echo "  ret r7"
+  else
+    echo "  ret r6"
+  fi
+  echo "end f$i"
+  echo
+done
+
+echo "start main 0:"
+echo ".entry:"
+echo "  sp = sub sp 8 64"
+echo "  r1 = call read"
+echo "  call write r1"
+echo "  ret 0"
+echo "end main"
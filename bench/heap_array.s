@@ -0,0 +1,52 @@
+; repeatedly fills and sums a 1000-element array on the heap
+; input: number of rounds
+start main 0:
+.entry:
+  r1 = call read
+  r13 = malloc 8000
+  r9 = mul 0 0 64
+  r2 = mul 0 0 64
+  br .round
+.round:
+  r3 = icmp uge r2 r1 64
+  br r3 .exit .fill_init
+.fill_init:
+  r4 = mul 0 0 64
+  br .fill
+.fill:
+  r5 = icmp uge r4 1000 64
+  br r5 .sum_init .fill_body
+.fill_body:
+  r6 = mul r4 8 64
+  r7 = add r13 r6 64
+  store 8 r4 r7
+  store 4 r4 r7
+  store 2 r4 r7
+  store 1 r4 r7
+  r4 = incr r4 64
+  br .fill
+.sum_init:
+  r4 = mul 0 0 64
+  br .sum
+.sum:
+  r5 = icmp uge r4 1000 64
+  br r5 .next .sum_body
+.sum_body:
+  r6 = mul r4 8 64
+  r7 = add r13 r6 64
+  r8 = load 8 r7
+  r10 = load 4 r7
+  r11 = load 2 r7
+  r12 = load 1 r7
+  r9 = add r9 r8 64
+  r9 = add r9 r12 64
+  r4 = incr r4 64
+  br .sum
+.next:
+  r2 = incr r2 64
+  br .round
+.exit:
+  call write r9
+  free r13
+  ret 0
+end main
@@ -0,0 +1,20 @@
+; reads a count and that many numbers, writing a running sum after each
+; input: n, then n numbers
+start main 0:
+.entry:
+  r1 = call read
+  r2 = mul 0 0 64
+  r3 = mul 0 0 64
+  br .loop
+.loop:
+  r4 = icmp uge r2 r1 64
+  br r4 .exit .body
+.body:
+  r5 = call read
+  r3 = add r3 r5 64
+  call write r3
+  r2 = incr r2 64
+  br .loop
+.exit:
+  ret r3
+end main
@@ -0,0 +1,53 @@
+; builds a 1000-node linked list on the heap and walks it repeatedly
+; input: number of walks
+start main 0:
+.entry:
+  r1 = call read
+  r2 = mul 0 0 64
+  r3 = mul 0 0 64
+  br .build
+.build:
+  r4 = icmp uge r3 1000 64
+  br r4 .walks .node
+.node:
+  r5 = malloc 16
+  store 8 r3 r5
+  r14 = add r5 8 64
+  store 8 r2 r14
+  r2 = add r5 0 64
+  r3 = incr r3 64
+  br .build
+.walks:
+  r6 = mul 0 0 64
+  r7 = mul 0 0 64
+  br .round
+.round:
+  r8 = icmp uge r6 r1 64
+  br r8 .free .walk_init
+.walk_init:
+  r9 = add r2 0 64
+  br .walk
+.walk:
+  r10 = icmp eq r9 0 64
+  br r10 .next .step
+.step:
+  r11 = load 8 r9
+  r7 = add r7 r11 64
+  r15 = add r9 8 64
+  r9 = load 8 r15
+  br .walk
+.next:
+  r6 = incr r6 64
+  br .round
+.free:
+  r12 = icmp eq r2 0 64
+  br r12 .exit .free_node
+.free_node:
+  r16 = add r2 8 64
+  r13 = load 8 r16
+  free r2
+  r2 = add r13 0 64
+  br .free
+.exit:
+  ret r7
+end main
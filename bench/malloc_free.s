@@ -0,0 +1,67 @@
+; fragments the heap, then runs many malloc/free pairs over it
+; input: number of malloc/free rounds
+start main 0:
+.entry:
+  r1 = call read
+  sp = sub sp 16000 64
+  r2 = mul 0 0 64
+  br .alloc
+.alloc:
+  r3 = icmp uge r2 2000 64
+  br r3 .free_init .alloc_body
+.alloc_body:
+  r4 = mul r2 7 64
+  r4 = urem r4 13 64
+  r4 = incr r4 64
+  r4 = mul r4 8 64
+  r5 = malloc r4
+  r6 = mul r2 8 64
+  r6 = add sp r6 64
+  store 8 r5 r6
+  r2 = incr r2 64
+  br .alloc
+.free_init:
+  r2 = mul 0 0 64
+  br .free
+.free:
+  r3 = icmp uge r2 2000 64
+  br r3 .round_init .free_body
+.free_body:
+  r6 = mul r2 8 64
+  r6 = add sp r6 64
+  r5 = load 8 r6
+  free r5
+  r2 = add r2 2 64
+  br .free
+.round_init:
+  r2 = mul 0 0 64
+  r9 = mul 0 0 64
+  br .round
+.round:
+  r3 = icmp uge r2 r1 64
+  br r3 .exit .round_body
+.round_body:
+  r4 = urem r2 17 64
+  r4 = incr r4 64
+  r4 = mul r4 8 64
+  r5 = malloc r4
+  r7 = malloc 200
+  r8 = malloc r4
+  r9 = add r9 r5 64
+  r9 = xor r9 r7 64
+  r9 = add r9 r8 64
+  free r7
+  free r5
+  r10 = urem r2 3 64
+  switch r10 0 .keep .drop
+.keep:
+  r2 = incr r2 64
+  br .round
+.drop:
+  free r8
+  r2 = incr r2 64
+  br .round
+.exit:
+  call write r9
+  ret r9
+end main
@@ -0,0 +1,46 @@
+; dispatches on a dense and on a sparse switch in a loop, like a lowered state machine
+; input: number of iterations
+start main 0:
+.entry:
+  r1 = call read
+  r2 = mul 0 0 64
+  r3 = mul 0 0 64
+  br .loop
+.loop:
+  r4 = urem r2 9 64
+  switch r4 0 .a 1 .b 2 .c 3 .a 5 .b 6 .c .d
+.a:
+  r3 = add r3 1 64
+  br .sparse
+.b:
+  r3 = add r3 2 64
+  br .sparse
+.c:
+  r3 = add r3 3 64
+  br .sparse
+.d:
+  r3 = add r3 4 64
+  br .sparse
+.sparse:
+  r5 = urem r2 5 64
+  r6 = mul r5 1000 64
+  switch r6 0 .e 1000 .f 3000 .g 123456789 .e .h
+.e:
+  r3 = mul r3 3 64
+  br .latch
+.f:
+  r3 = add r3 5 64
+  br .latch
+.g:
+  r3 = sub r3 1 64
+  br .latch
+.h:
+  r3 = xor r3 7 64
+  br .latch
+.latch:
+  r2 = incr r2 64
+  r7 = icmp ult r2 r1 64
+  br r7 .loop .exit
+.exit:
+  ret r3
+end main
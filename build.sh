@@ -1,9 +1,9 @@
 #!/bin/bash
 
-rm -f sf-interpreter
+rm -f sf-interpreter sf-samples
 mkdir -p build
 cd build
 cmake ../
 make -j
-cp sf-interpreter ../
+cp sf-interpreter sf-samples ../
 cd ..
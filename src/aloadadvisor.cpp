@@ -0,0 +1,242 @@
+#include <algorithm>
+
+#include "aloadadvisor.h"
+#include "opcode.h"
+
+
+static uint64_t reg_bit(const Value& val) {
+  return val.is_reg() ? (uint64_t)1 << val.get_reg() : 0;
+}
+
+static uint64_t reg_bits(const vector<Value>& vals) {
+  uint64_t bits = 0;
+  for (auto& val: vals)
+    bits |= reg_bit(val);
+  return bits;
+}
+
+/** the registers that stmt reads, as the engines read them */
+static uint64_t read_regs(const Stmt* stmt) {
+  switch (stmt->get_opcode()) {
+    case Ret: return reg_bit(dynamic_cast<const StmtRet*>(stmt)->get_val());
+    case BrCond: return reg_bit(dynamic_cast<const StmtBrCond*>(stmt)->get_cond());
+    case Switch: return reg_bit(dynamic_cast<const StmtSwitch*>(stmt)->get_cond());
+    case Malloc: return reg_bit(dynamic_cast<const StmtMalloc*>(stmt)->get_val());
+    case Free: return reg_bit(dynamic_cast<const StmtFree*>(stmt)->get_ptr());
+    case Load: return reg_bit(dynamic_cast<const StmtLoad*>(stmt)->get_ptr());
+    case Store: {
+      auto s = dynamic_cast<const StmtStore*>(stmt);
+      return reg_bit(s->get_val()) | reg_bit(s->get_ptr());
+    }
+    case Bop: {
+      auto s = dynamic_cast<const StmtBop*>(stmt);
+      return reg_bit(s->get_val1()) | reg_bit(s->get_val2());
+    }
+    case Sum: return reg_bits(dynamic_cast<const StmtSum*>(stmt)->get_values());
+    case Uop: return reg_bit(dynamic_cast<const StmtUop*>(stmt)->get_val());
+    case Select: {
+      auto s = dynamic_cast<const StmtSelect*>(stmt);
+      return reg_bit(s->get_cond()) | reg_bit(s->get_val_true()) | reg_bit(s->get_val_false());
+    }
+    case Call: return reg_bits(dynamic_cast<const StmtCall*>(stmt)->get_args());
+    case Assert: {
+      auto s = dynamic_cast<const StmtAssert*>(stmt);
+      return reg_bit(s->get_op1()) | reg_bit(s->get_op2());
+    }
+    case Write: return reg_bit(dynamic_cast<const StmtWrite*>(stmt)->get_val());
+    default: return 0;
+  }
+}
+
+AloadAdvisor::AloadAdvisor(): lines(), sites(), clock(0), watched(0), pending(), frames(), saved() {}
+
+void AloadAdvisor::reset(const Program* program) {
+  int max_line = 0;
+  for (auto& f: program->get_function_map())
+    for (auto& bb: f.second->get_bb_map())
+      for (Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next())
+        max_line = max(max_line, stmt->get_line());
+
+  lines.assign(max_line + 1, AdvisorLine{0, RegNone, 0});
+  for (auto& f: program->get_function_map()) {
+    for (auto& bb: f.second->get_bb_map()) {
+      for (Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next()) {
+        AdvisorLine& line = lines[stmt->get_line()];
+        line.reads = read_regs(stmt);
+        line.lhs = stmt->get_lhs();
+        if (stmt->get_opcode() == Load)
+          line.load = dynamic_cast<const StmtLoad*>(stmt)->get_is_async() ? 2 : 1;
+      }
+    }
+  }
+
+  sites.assign(max_line + 1, LoadSite{0, 0, 0, 0, 0, 0});
+  clock = 0;
+  watched = 0;
+  frames.clear();
+  saved.clear();
+}
+
+void AloadAdvisor::use(Reg reg, double cost_acc) {
+  const PendingLoad& p = pending[reg];
+  LoadSite& site = sites[p.line];
+  if (lines[p.line].load == 2) {
+    if (p.ready > cost_acc) {
+      site.stalls++;
+      site.total_wait += p.ready - cost_acc;
+    }
+    return;
+  }
+
+  // an aload issued in its place finishes ALOAD after the issue and its value
+  // arrives WAIT after that, so it saves the rest of the load cost unless its
+  // first read comes sooner
+  double wait = p.cost > Cost::STACK ? Cost::WAIT_HEAP : Cost::WAIT_STACK;
+  double gap = cost_acc - p.ready;
+  site.total_gap += gap;
+  site.total_saving += p.cost - Cost::ALOAD - max(0.0, wait - gap);
+}
+
+void AloadAdvisor::drop(Reg reg) {
+  const PendingLoad& p = pending[reg];
+  LoadSite& site = sites[p.line];
+  site.unused++;
+  if (lines[p.line].load == 1)
+    site.total_saving += p.cost - Cost::ALOAD;
+  watched &= ~((uint64_t)1 << reg);
+}
+
+void AloadAdvisor::drop_all() {
+  while (watched != 0)
+    drop((Reg)__builtin_ctzll(watched));
+}
+
+void AloadAdvisor::record(int line, Opcode opcode, double inst_cost, double wait_cost, const RegFile& regfile) {
+  double cost_acc = clock;
+  clock += inst_cost + wait_cost;
+  const AdvisorLine& info = lines[line];
+
+  // operands are read before the result is written, e.g. r1 = load 8 r1
+  for (uint64_t used = info.reads & watched; used != 0; used &= used - 1)
+    use((Reg)__builtin_ctzll(used), cost_acc);
+  watched &= ~info.reads;
+
+  if (opcode == Call) {
+    frames.push_back(AdvisorFrame{clock, info.lhs, watched, saved.size()});
+    for (uint64_t w = watched; w != 0; w &= w - 1) {
+      Reg reg = (Reg)__builtin_ctzll(w);
+      saved.emplace_back(reg, pending[reg]);
+    }
+    watched = 0;
+    // the callee starts its own clock, as frame_cost does
+    clock = 0;
+    return;
+  }
+
+  if (opcode == Ret) {
+    drop_all();
+    if (frames.empty())
+      return;
+    const AdvisorFrame& frame = frames.back();
+    clock = frame.cost_acc + clock;
+    watched = frame.watched;
+    for (size_t i = frame.saved_begin; i < saved.size(); i++)
+      pending[saved[i].first] = saved[i].second;
+    saved.resize(frame.saved_begin);
+    Reg lhs = frame.lhs;
+    frames.pop_back();
+    if (lhs != RegNone && ((watched >> lhs) & 1))
+      drop(lhs);
+    return;
+  }
+
+  if (info.lhs == RegNone)
+    return;
+  if ((watched >> info.lhs) & 1)
+    drop(info.lhs);
+  if (info.load == 0)
+    return;
+
+  double ready = info.load == 2 ? regfile.peek_reg(info.lhs).second : clock;
+  pending[info.lhs] = PendingLoad{line, ready, inst_cost};
+  watched |= (uint64_t)1 << info.lhs;
+  sites[line].count++;
+}
+
+void AloadAdvisor::write_report(Output& out, const Program* program) const {
+  struct Entry {
+    const string* fname;
+    int line;
+    const LoadSite* site;
+  };
+
+  vector<Entry> loads, aloads;
+  double saving = 0;
+  for (auto& f: program->get_function_map()) {
+    for (auto& bb: f.second->get_bb_map()) {
+      for (const Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next()) {
+        int line = stmt->get_line();
+        const LoadSite& site = sites[line];
+        if (lines[line].load == 0 || site.count == 0)
+          continue;
+        if (lines[line].load == 1) {
+          loads.push_back(Entry{&f.second->get_fname(), line, &site});
+          saving += max(0.0, site.total_saving);
+        }
+        else
+          aloads.push_back(Entry{&f.second->get_fname(), line, &site});
+      }
+    }
+  }
+
+  sort(loads.begin(), loads.end(), [](const Entry& a, const Entry& b) {
+    if (a.site->total_saving != b.site->total_saving)
+      return a.site->total_saving > b.site->total_saving;
+    return a.line < b.line;
+  });
+  sort(aloads.begin(), aloads.end(), [](const Entry& a, const Entry& b) {
+    if (a.site->total_wait != b.site->total_wait)
+      return a.site->total_wait > b.site->total_wait;
+    return a.line < b.line;
+  });
+
+  out.write_str("Estimated saving of aload where it pays: ");
+  out.write_fixed(saving);
+  out.write_str("\n\nLoads\n");
+  out.write_str("Function\tLine\tCount\tUnread\tAverage gap\tEstimated saving\n");
+  for (auto& e: loads) {
+    out.write_str(*e.fname);
+    out.write_str("\t");
+    out.write_u64(e.line);
+    out.write_str("\t");
+    out.write_u64(e.site->count);
+    out.write_str("\t");
+    out.write_u64(e.site->unused);
+    out.write_str("\t");
+    uint64_t used = e.site->count - e.site->unused;
+    if (used > 0)
+      out.write_fixed(e.site->total_gap / used);
+    else
+      out.write_str("-");
+    out.write_str("\t");
+    out.write_fixed(e.site->total_saving);
+    out.write_str("\n");
+  }
+
+  out.write_str("\nAloads\n");
+  out.write_str("Function\tLine\tCount\tUnread\tStalls\tWaiting cost\tAlways stalls\n");
+  for (auto& e: aloads) {
+    out.write_str(*e.fname);
+    out.write_str("\t");
+    out.write_u64(e.line);
+    out.write_str("\t");
+    out.write_u64(e.site->count);
+    out.write_str("\t");
+    out.write_u64(e.site->unused);
+    out.write_str("\t");
+    out.write_u64(e.site->stalls);
+    out.write_str("\t");
+    out.write_fixed(e.site->total_wait);
+    out.write_str(e.site->stalls == e.site->count ? "\tyes\n" : "\tno\n");
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef SWPP_ASM_INTERPRETER_ALOADADVISOR_H
+#define SWPP_ASM_INTERPRETER_ALOADADVISOR_H
+
+#include <cinttypes>
+#include <vector>
+
+#include "program.h"
+#include "regfile.h"
+#include "io.h"
+
+using namespace std;
+
+
+/** executions of the load on a single line */
+struct LoadSite {
+  uint64_t count;
+  // executions whose value was overwritten or went out of scope before any read
+  uint64_t unused;
+  // load: the cost between the load and the first read of its value, over the used executions
+  double total_gap;
+  // load: the cost that aload would have saved, estimated from the gaps
+  double total_saving;
+  // aload: the executions whose first read waited, and how much it waited
+  uint64_t stalls;
+  double total_wait;
+};
+
+/** what the statement of a single line reads and writes */
+struct AdvisorLine {
+  // one bit per register operand
+  uint64_t reads;
+  // RegNone for none; calls write it on return
+  Reg lhs;
+  // 0 for no load, 1 for load, 2 for aload
+  uint8_t load;
+};
+
+/** a loaded value that has not been read yet */
+struct PendingLoad {
+  int line;
+  // load: when it finished; aload: when its value arrives
+  double ready;
+  // the instruction cost of the load
+  double cost;
+};
+
+struct AdvisorFrame {
+  double cost_acc;
+  Reg lhs;
+  uint64_t watched;
+  // the pending loads of the caller start here in saved
+  size_t saved_begin;
+};
+
+/**
+ * per-line advice on aload: for every load, the cost that runs between it and
+ * the first read of its value, which aload could hide, and for every aload, the
+ * waiting cost that its first read is charged; recorded from the same costs as
+ * the cost log, so the clock here is the clock of the execution
+ */
+class AloadAdvisor {
+private:
+  vector<AdvisorLine> lines;
+  vector<LoadSite> sites;
+  // the cost of the current call so far, as frame_cost in the engines
+  double clock;
+  // one bit per register holding a PendingLoad in pending
+  uint64_t watched;
+  PendingLoad pending[RegNone + 1];
+  vector<AdvisorFrame> frames;
+  vector<pair<Reg, PendingLoad>> saved;
+
+  void use(Reg reg, double cost_acc);
+  void drop(Reg reg);
+  void drop_all();
+
+public:
+  AloadAdvisor();
+
+  /** clears the advice and reads the operands of every line of program */
+  void reset(const Program* program);
+
+  /**
+   * the statement on line that was just charged, in execution order; regfile
+   * holds its result
+   */
+  void record(int line, Opcode opcode, double inst_cost, double wait_cost, const RegFile& regfile);
+
+  /** loads sorted by their estimated saving, then aloads sorted by their waiting cost */
+  void write_report(Output& out, const Program* program) const;
+};
+
+#endif //SWPP_ASM_INTERPRETER_ALOADADVISOR_H
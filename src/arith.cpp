@@ -0,0 +1,157 @@
+#include "arith.h"
+#include "error.h"
+
+
+template <Size S>
+constexpr int BITS = S == Size1 ? 1 : S == Size8 ? 8 : S == Size16 ? 16 : S == Size32 ? 32 : 64;
+
+template <Size S>
+constexpr uint64_t MASK = BITS<S> == 64 ? ~(uint64_t)0 : ((uint64_t)1 << BITS<S>) - 1;
+
+constexpr bool is_signed_kind(BopKind bop_kind) {
+  return bop_kind == Ashr || bop_kind == Sdiv || bop_kind == Srem ||
+         bop_kind == Sgt || bop_kind == Sge || bop_kind == Slt || bop_kind == Sle;
+}
+
+constexpr bool is_shift_kind(BopKind bop_kind) {
+  return bop_kind == Shl || bop_kind == Lshr || bop_kind == Ashr;
+}
+
+/** get_op1: the operand extended to 64 bits by the signedness of the operation */
+template <BopKind K, Size S>
+inline uint64_t extend(uint64_t val) {
+  if constexpr (BITS<S> == 64)
+    return val;
+  else if constexpr (is_signed_kind(K))
+    return (uint64_t)((int64_t)(val << (64 - BITS<S>)) >> (64 - BITS<S>));
+  else
+    return val & MASK<S>;
+}
+
+template <BopKind K, Size S>
+uint64_t bop(uint64_t op1, uint64_t op2) {
+  op1 = extend<K, S>(op1);
+  if constexpr (is_shift_kind(K))
+    op2 = op2 % BITS<S>;
+  else
+    op2 = extend<K, S>(op2);
+
+  uint64_t result;
+  if constexpr (K == Udiv || K == Sdiv || K == Urem || K == Srem) {
+    if (op2 == 0)
+      invoke_runtime_error("division by zero");
+  }
+
+  if constexpr (K == Udiv)
+    result = op1 / op2;
+  else if constexpr (K == Sdiv)
+    result = (int64_t)op1 / (int64_t)op2;
+  else if constexpr (K == Urem)
+    result = op1 % op2;
+  else if constexpr (K == Srem)
+    result = (int64_t)op1 % (int64_t)op2;
+  else if constexpr (K == Mul)
+    result = op1 * op2;
+  else if constexpr (K == Shl)
+    result = op1 << op2;
+  else if constexpr (K == Lshr)
+    result = op1 >> op2;
+  else if constexpr (K == Ashr)
+    result = (int64_t)op1 >> op2;
+  else if constexpr (K == And)
+    result = op1 & op2;
+  else if constexpr (K == Or)
+    result = op1 | op2;
+  else if constexpr (K == Xor)
+    result = op1 ^ op2;
+  else if constexpr (K == Add)
+    result = op1 + op2;
+  else if constexpr (K == Sub)
+    result = op1 - op2;
+  else if constexpr (K == Eq)
+    result = op1 == op2;
+  else if constexpr (K == Ne)
+    result = op1 != op2;
+  else if constexpr (K == Ugt)
+    result = op1 > op2;
+  else if constexpr (K == Uge)
+    result = op1 >= op2;
+  else if constexpr (K == Ult)
+    result = op1 < op2;
+  else if constexpr (K == Ule)
+    result = op1 <= op2;
+  else if constexpr (K == Sgt)
+    result = (int64_t)op1 > (int64_t)op2;
+  else if constexpr (K == Sge)
+    result = (int64_t)op1 >= (int64_t)op2;
+  else if constexpr (K == Slt)
+    result = (int64_t)op1 < (int64_t)op2;
+  else
+    result = (int64_t)op1 <= (int64_t)op2;
+
+  return result & MASK<S>;
+}
+
+template <UopKind K, Size S>
+uint64_t uop(uint64_t op) {
+  if constexpr (K == Incr)
+    return (op + 1) & MASK<S>;
+  else
+    return (op - 1) & MASK<S>;
+}
+
+template <BopKind K>
+BopFn select_bop_size(Size size) {
+  switch (size) {
+    case Size1: return bop<K, Size1>;
+    case Size8: return bop<K, Size8>;
+    case Size16: return bop<K, Size16>;
+    case Size32: return bop<K, Size32>;
+    default: return bop<K, Size64>;
+  }
+}
+
+template <UopKind K>
+UopFn select_uop_size(Size size) {
+  switch (size) {
+    case Size1: return uop<K, Size1>;
+    case Size8: return uop<K, Size8>;
+    case Size16: return uop<K, Size16>;
+    case Size32: return uop<K, Size32>;
+    default: return uop<K, Size64>;
+  }
+}
+
+BopFn select_bop(BopKind bop_kind, Size size) {
+  switch (bop_kind) {
+    case Udiv: return select_bop_size<Udiv>(size);
+    case Sdiv: return select_bop_size<Sdiv>(size);
+    case Urem: return select_bop_size<Urem>(size);
+    case Srem: return select_bop_size<Srem>(size);
+    case Mul: return select_bop_size<Mul>(size);
+    case Shl: return select_bop_size<Shl>(size);
+    case Lshr: return select_bop_size<Lshr>(size);
+    case Ashr: return select_bop_size<Ashr>(size);
+    case And: return select_bop_size<And>(size);
+    case Or: return select_bop_size<Or>(size);
+    case Xor: return select_bop_size<Xor>(size);
+    case Add: return select_bop_size<Add>(size);
+    case Sub: return select_bop_size<Sub>(size);
+    case Eq: return select_bop_size<Eq>(size);
+    case Ne: return select_bop_size<Ne>(size);
+    case Ugt: return select_bop_size<Ugt>(size);
+    case Uge: return select_bop_size<Uge>(size);
+    case Ult: return select_bop_size<Ult>(size);
+    case Ule: return select_bop_size<Ule>(size);
+    case Sgt: return select_bop_size<Sgt>(size);
+    case Sge: return select_bop_size<Sge>(size);
+    case Slt: return select_bop_size<Slt>(size);
+    default: return select_bop_size<Sle>(size);
+  }
+}
+
+UopFn select_uop(UopKind uop_kind, Size size) {
+  if (uop_kind == Incr)
+    return select_uop_size<Incr>(size);
+  return select_uop_size<Decr>(size);
+}
@@ -0,0 +1,23 @@
+#ifndef SWPP_ASM_INTERPRETER_ARITH_H
+#define SWPP_ASM_INTERPRETER_ARITH_H
+
+#include <cinttypes>
+
+#include "opcode.h"
+#include "size.h"
+
+using namespace std;
+
+
+/** computes a binary or unary operation of a fixed kind and size, like compute_bop */
+typedef uint64_t (*BopFn)(uint64_t op1, uint64_t op2);
+typedef uint64_t (*UopFn)(uint64_t op);
+
+/**
+ * handlers instantiated for every kind and size, so that the width masks and
+ * sign extensions are constants; picked once when a statement is created
+ */
+BopFn select_bop(BopKind bop_kind, Size size);
+UopFn select_uop(UopKind uop_kind, Size size);
+
+#endif //SWPP_ASM_INTERPRETER_ARITH_H
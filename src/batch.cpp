@@ -0,0 +1,253 @@
+#include <map>
+#include <memory>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "error.h"
+#include "io.h"
+#include "mappedfile.h"
+
+
+Batch::Batch(const Program* _program, const Bytecode* _bytecode, const ExecOptions& _options):
+program(_program), bytecode(_bytecode), options(_options), inputs(), results(), next_input(0) {}
+
+void Batch::add_input(const string& input) { inputs.push_back(input); }
+
+const vector<BatchResult>& Batch::get_results() const { return results; }
+
+/** fails result if the output of input or its logs could not be written fully */
+static void check_writes(BatchResult& result, FdOutput& out, const string& input, const string& log_error) {
+  string error = out.check(input + ".stdout");
+  if (error.empty())
+    error = log_error;
+  if (error.empty())
+    return;
+  result.ok = false;
+  result.budget_exceeded = false;
+  result.error = "Error: " + error + (result.error.empty() ? "" : "\n" + result.error);
+}
+
+BatchResult Batch::run_one(const string& input, State& state) const {
+  BatchResult result{input, false, false, 0, ""};
+
+  MappedFile input_file(input);
+  if (!input_file.is_open()) {
+    result.error = "Error: cannot find " + input;
+    return result;
+  }
+  MemoryInput in(input_file.contents());
+  FdOutput out(input + ".stdout");
+
+  state.reset();
+  state.set_io(in, out);
+
+  string log_error;
+  try {
+    result.ret = exec(state);
+    log_error = state.write_logs(result.ret, input + ".");
+    result.ok = true;
+  } catch (BudgetExceeded& e) {
+    out.write_str(e.what());
+    out.write_str("\n");
+    log_error = state.write_logs(0, input + ".");
+    result.budget_exceeded = true;
+    result.error = e.what();
+  } catch (ExecutionError& e) {
+    out.write_str(e.what());
+    out.write_str("\n");
+    result.error = e.what();
+  }
+  check_writes(result, out, input, log_error);
+
+  return result;
+}
+
+uint64_t Batch::exec(State& state) const {
+  return bytecode != nullptr ? state.exec_bytecode(*bytecode) : state.exec_program();
+}
+
+void Batch::run_worker() {
+  // a State is large, so it is reused rather than built for every input
+  auto state = make_unique<State>();
+  state->set_program(program);
+  state->set_options(options);
+  while (true) {
+    size_t idx = next_input++;
+    if (idx >= inputs.size())
+      break;
+    results[idx] = run_one(inputs[idx], *state);
+  }
+}
+
+void Batch::run(unsigned jobs) {
+  results.assign(inputs.size(), BatchResult{"", false, false, 0, ""});
+  next_input = 0;
+
+  if (jobs == 0)
+    jobs = 1;
+  if (jobs > inputs.size())
+    jobs = inputs.size();
+
+  vector<thread> workers;
+  for (unsigned i = 0; i < jobs; i++)
+    workers.emplace_back(&Batch::run_worker, this);
+  for (auto& worker: workers)
+    worker.join();
+}
+
+/** unwinds the snapshot execution in the parent once every input has run */
+struct SnapshotDone {};
+
+// the longest error message a child reports
+#define SNAPSHOT_MAX_ERROR 4096
+
+/** sends result to the parent as "<status> <ret> <error>", status 1 if ok, 2 if a budget stopped it, else 0 */
+static void write_result(int fd, const BatchResult& result) {
+  string status = result.ok ? "1 " : result.budget_exceeded ? "2 " : "0 ";
+  string msg = status + to_string(result.ret) + " " + result.error.substr(0, SNAPSHOT_MAX_ERROR);
+  for (size_t done = 0; done < msg.length();) {
+    ssize_t n = write(fd, msg.data() + done, msg.length() - done);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+}
+
+static bool read_result(int fd, BatchResult& result) {
+  string msg;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    msg.append(buf, n);
+
+  size_t space = msg.find(' ', 2);
+  if (msg.length() < 2 || space == string::npos)
+    return false;
+  result.ok = msg[0] == '1';
+  result.budget_exceeded = msg[0] == '2';
+  result.ret = stoull(msg.substr(2, space - 2));
+  result.error = msg.substr(space + 1);
+  return true;
+}
+
+ssize_t Batch::fork_inputs(unsigned jobs, int& result_fd) {
+  // pid of each running child, to its input and the read end of its result pipe
+  map<pid_t, pair<size_t, int>> children;
+  size_t next = 0;
+
+  while (next < inputs.size() || !children.empty()) {
+    while (next < inputs.size() && children.size() < jobs) {
+      int fds[2];
+      pid_t pid = -1;
+      if (pipe(fds) == 0) {
+        pid = fork();
+        if (pid < 0) {
+          close(fds[0]);
+          close(fds[1]);
+        }
+      }
+      if (pid < 0) {
+        results[next] = BatchResult{inputs[next], false, false, 0, "Error: cannot fork"};
+        next++;
+        continue;
+      }
+      if (pid == 0) {
+        for (auto& child: children)
+          close(child.second.second);
+        close(fds[0]);
+        result_fd = fds[1];
+        return next;
+      }
+      close(fds[1]);
+      children[pid] = make_pair(next, fds[0]);
+      next++;
+    }
+    if (children.empty())
+      break;
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0)
+      break;
+    auto it = children.find(pid);
+    if (it == children.end())
+      continue;
+    BatchResult& result = results[it->second.first];
+    result = BatchResult{inputs[it->second.first], false, false, 0, ""};
+    if (!read_result(it->second.second, result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      result = BatchResult{inputs[it->second.first], false, false, 0, "Error: terminated abnormally"};
+    close(it->second.second);
+    children.erase(it);
+  }
+  return -1;
+}
+
+void Batch::run_from_snapshot(unsigned jobs) {
+  results.assign(inputs.size(), BatchResult{"", false, false, 0, ""});
+  if (jobs == 0)
+    jobs = 1;
+
+  // the prefix must not depend on the input, and its output is replayed into every .stdout
+  State state;
+  state.set_program(program);
+  state.set_options(options);
+  MemoryInput no_input("");
+  StringOutput prefix;
+  state.set_io(no_input, prefix);
+
+  ssize_t idx = -1;
+  int result_fd = -1;
+  unique_ptr<MappedFile> input_file;
+  unique_ptr<MemoryInput> in;
+  unique_ptr<FdOutput> out;
+  state.set_first_read_hook([&]() {
+    idx = fork_inputs(jobs, result_fd);
+    if (idx < 0)
+      throw SnapshotDone();
+
+    input_file = make_unique<MappedFile>(inputs[idx]);
+    if (!input_file->is_open()) {
+      write_result(result_fd, BatchResult{inputs[idx], false, false, 0, "Error: cannot find " + inputs[idx]});
+      _exit(0);
+    }
+    in = make_unique<MemoryInput>(input_file->contents());
+    out = make_unique<FdOutput>(inputs[idx] + ".stdout");
+    prefix.flush();
+    out->write_str(prefix.get_str());
+    state.set_io(*in, *out);
+  });
+
+  BatchResult result{"", false, false, 0, ""};
+  string log_error;
+  try {
+    result.ret = exec(state);
+    result.ok = true;
+  } catch (SnapshotDone&) {
+    return;
+  } catch (ExecutionError& e) {
+    result.error = e.what();
+    if (idx >= 0) {
+      out->write_str(e.what());
+      out->write_str("\n");
+      result.budget_exceeded = dynamic_cast<BudgetExceeded*>(&e) != nullptr;
+      if (result.budget_exceeded)
+        log_error = state.write_logs(0, inputs[idx] + ".");
+    }
+  }
+
+  // the program ended without reading, so every input is run as usual
+  if (idx < 0) {
+    run(jobs);
+    return;
+  }
+
+  result.input = inputs[idx];
+  if (result.ok)
+    log_error = state.write_logs(result.ret, inputs[idx] + ".");
+  check_writes(result, *out, inputs[idx], log_error);
+  write_result(result_fd, result);
+  _exit(0);
+}
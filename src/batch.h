@@ -0,0 +1,62 @@
+#ifndef SWPP_ASM_INTERPRETER_BATCH_H
+#define SWPP_ASM_INTERPRETER_BATCH_H
+
+#include <atomic>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "program.h"
+#include "bytecode.h"
+#include "state.h"
+
+using namespace std;
+
+
+/** outcome of a single execution of a batch */
+struct BatchResult {
+  string input;
+  bool ok;
+  // stopped by --max-insts or --max-cost
+  bool budget_exceeded;
+  uint64_t ret;
+  string error;
+};
+
+/**
+ * runs one parsed program against many input files on a pool of worker
+ * threads, each reusing one State reset between its executions; the results of <input> are
+ * written to <input>.stdout and <input>.sf-interpreter*.log
+ */
+class Batch {
+private:
+  const Program* program;
+  const Bytecode* bytecode;
+  ExecOptions options;
+  vector<string> inputs;
+  vector<BatchResult> results;
+  atomic<size_t> next_input;
+
+  void run_worker();
+  BatchResult run_one(const string& input, State& state) const;
+  uint64_t exec(State& state) const;
+  /** forks up to jobs processes at a time, one per input; returns the input index in a child, or -1 */
+  ssize_t fork_inputs(unsigned jobs, int& result_fd);
+
+public:
+  /** bytecode may be nullptr to run the statement engine */
+  Batch(const Program* _program, const Bytecode* _bytecode, const ExecOptions& _options);
+
+  void add_input(const string& input);
+  void run(unsigned jobs);
+  /**
+   * as run, but executes the program once up to its first read and forks a
+   * process per input from there, so the input-independent prefix runs once;
+   * the results are as run's, which it falls back to if the program never reads
+   */
+  void run_from_snapshot(unsigned jobs);
+  /** in the order the inputs were added */
+  const vector<BatchResult>& get_results() const;
+};
+
+#endif //SWPP_ASM_INTERPRETER_BATCH_H
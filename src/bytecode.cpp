@@ -0,0 +1,276 @@
+#include "bytecode.h"
+
+
+Operand lower_value(const Value& val) {
+  Operand op;
+  op.is_reg = val.is_reg();
+  op.reg = val.get_reg();
+  op.imm = val.get_literal();
+  return op;
+}
+
+static bool is_valid_read(const Operand& op, int nargs) {
+  return !op.is_reg || (op.reg != RegNone && !((int)A1 + nargs <= op.reg && op.reg <= A16));
+}
+
+static bool ends_segment(uint8_t opcode) {
+  return opcode == Ret || opcode == BrUncond || opcode == BrCond || opcode == Switch || opcode == Call;
+}
+
+Bytecode::Bytecode(const Program* program):
+code(), operands(), switches(), functions(), segments(), op_counts(), main_function(0) {
+  map<Function*, uint32_t> function_idx;
+  map<const Stmt*, uint32_t> stmt_idx;
+
+  // assign an index to every function and every statement
+  uint32_t pc = 0;
+  for (auto& it: program->get_function_map()) {
+    function_idx.insert(pair<Function*, uint32_t>(it.second, functions.size()));
+    if (it.first == "main")
+      main_function = functions.size();
+    functions.push_back(BcFunction{&it.second->get_fname(), it.second->get_nargs(), 0, pc, 0});
+
+    for (auto& bb: it.second->get_bb_map())
+      for (const Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next())
+        stmt_idx.insert(pair<const Stmt*, uint32_t>(stmt, pc++));
+    functions.back().end = pc;
+  }
+
+  // emit statements in the same order, with resolved targets
+  code.reserve(pc);
+  for (auto& it: program->get_function_map()) {
+    BcFunction& function = functions[function_idx.at(it.second)];
+    function.entry = stmt_idx.at(it.second->get_first_bb());
+    // main is first entered without arguments, whatever it declares
+    int nargs = it.first == "main" ? 0 : function.nargs;
+
+    for (auto& bb: it.second->get_bb_map()) {
+      for (const Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next()) {
+        lower_stmt(stmt, function_idx);
+        Insn& insn = code.back();
+        if (!has_valid_registers(insn, nargs))
+          insn.opcode = Checked;
+
+        switch (stmt->get_opcode()) {
+          case BrUncond:
+            insn.target1 = stmt_idx.at(dynamic_cast<const StmtBrUncond*>(stmt)->get_bb());
+            break;
+          case BrCond: {
+            auto br = dynamic_cast<const StmtBrCond*>(stmt);
+            insn.target1 = stmt_idx.at(br->get_true_bb());
+            insn.target2 = stmt_idx.at(br->get_false_bb());
+            break;
+          }
+          case Switch: {
+            auto sw = dynamic_cast<const StmtSwitch*>(stmt);
+            map<uint64_t, uint32_t> cases;
+            for (auto& c: sw->get_targets())
+              cases.emplace(c.first, stmt_idx.at(c.second));
+            insn.target1 = switches.size();
+            switches.emplace_back(cases, stmt_idx.at(sw->get_default()));
+            break;
+          }
+          default:
+            break;
+        }
+      }
+    }
+  }
+
+  split_segments();
+  fuse();
+}
+
+void Bytecode::split_segments() {
+  // blocks are contiguous and end with a terminator, so a segment starts after each terminator and call
+  for (size_t begin = 0, end; begin < code.size(); begin = end) {
+    end = begin + 1;
+    while (end < code.size() && !ends_segment(code[end - 1].opcode))
+      end++;
+
+    BcSegment segment{(uint32_t)(end - begin), (uint32_t)op_counts.size(), 0};
+    for (size_t i = begin; i < end; i++) {
+      Opcode opcode = code[i].stmt->get_opcode();
+      size_t j = segment.first_count;
+      while (j < op_counts.size() && op_counts[j].opcode != opcode)
+        j++;
+      if (j == op_counts.size()) {
+        op_counts.push_back(BcOpCount{(uint8_t)opcode, 0});
+        segment.ncounts++;
+      }
+      op_counts[j].count++;
+    }
+    code[begin].segment = segments.size();
+    segments.push_back(segment);
+  }
+}
+
+void Bytecode::fuse() {
+  // backwards, so that longer sequences can build on the fused pairs after them;
+  // a non-terminator is never the last instruction of a block, so the
+  // following instruction is always in the same block
+  for (size_t i = code.size(); i-- > 0;) {
+    Insn& insn = code[i];
+    if (i + 1 == code.size())
+      continue;
+    const Insn& next = code[i + 1];
+
+    if (insn.opcode == Bop && next.opcode == BrCond && next.op1.is_reg && next.op1.reg == insn.lhs &&
+        RegFile::is_writable(insn.lhs))
+      insn.opcode = BopBrCond;
+    else if (insn.opcode == Uop && next.opcode == BopBrCond)
+      insn.opcode = UopBopBrCond;
+    else if (insn.opcode == Bop && next.opcode == BopBrCond)
+      insn.opcode = BopBopBrCond;
+    else if (insn.opcode == Load && (next.opcode == Bop || next.opcode == BopBrCond))
+      insn.opcode = LoadBop;
+  }
+}
+
+bool Bytecode::has_valid_registers(const Insn& insn, int nargs) const {
+  switch (insn.opcode) {
+    case Malloc:
+    case Free:
+    case Load:
+    case Store:
+    case Bop:
+    case Uop:
+    case Select:
+    case Assert:
+    case Read:
+    case Write:
+      break;
+    case Sum:
+      for (uint32_t i = 0; i < insn.nops; i++) {
+        if (!is_valid_read(operands[insn.target1 + i], nargs))
+          return false;
+      }
+      break;
+    // terminators and calls keep the checks
+    default:
+      return true;
+  }
+
+  if (!is_valid_read(insn.op1, nargs) || !is_valid_read(insn.op2, nargs) || !is_valid_read(insn.op3, nargs))
+    return false;
+  return !(A1 <= insn.lhs && insn.lhs <= A16);
+}
+
+void Bytecode::lower_stmt(const Stmt* stmt, const map<Function*, uint32_t>& function_idx) {
+  Insn insn{};
+  insn.opcode = stmt->get_opcode();
+  insn.line = stmt->get_line();
+  insn.lhs = stmt->get_lhs();
+  insn.stmt = stmt;
+
+  switch (stmt->get_opcode()) {
+    case Ret:
+      insn.op1 = lower_value(dynamic_cast<const StmtRet*>(stmt)->get_val());
+      break;
+    case BrUncond:
+      break;
+    case BrCond:
+      insn.op1 = lower_value(dynamic_cast<const StmtBrCond*>(stmt)->get_cond());
+      break;
+    case Switch:
+      insn.op1 = lower_value(dynamic_cast<const StmtSwitch*>(stmt)->get_cond());
+      break;
+    case Malloc:
+      insn.op1 = lower_value(dynamic_cast<const StmtMalloc*>(stmt)->get_val());
+      break;
+    case Free:
+      insn.op1 = lower_value(dynamic_cast<const StmtFree*>(stmt)->get_ptr());
+      break;
+    case Load: {
+      auto load = dynamic_cast<const StmtLoad*>(stmt);
+      insn.is_async = load->get_is_async();
+      insn.msize = load->get_size();
+      insn.op1 = lower_value(load->get_ptr());
+      insn.ofs = load->get_ofs();
+      break;
+    }
+    case Store: {
+      auto store = dynamic_cast<const StmtStore*>(stmt);
+      insn.msize = store->get_size();
+      insn.op1 = lower_value(store->get_ptr());
+      insn.op2 = lower_value(store->get_val());
+      insn.ofs = store->get_ofs();
+      break;
+    }
+    case Bop: {
+      auto bop = dynamic_cast<const StmtBop*>(stmt);
+      insn.bop_kind = bop->get_bop_kind();
+      insn.bop_fn = bop->get_bop_fn();
+      insn.op1 = lower_value(bop->get_val1());
+      insn.op2 = lower_value(bop->get_val2());
+      insn.size = bop->get_size();
+      break;
+    }
+    case Sum: {
+      auto sum = dynamic_cast<const StmtSum*>(stmt);
+      insn.size = sum->get_size();
+      insn.target1 = operands.size();
+      insn.nops = sum->get_values().size();
+      for (auto& v: sum->get_values())
+        operands.push_back(lower_value(v));
+      break;
+    }
+    case Uop: {
+      auto uop = dynamic_cast<const StmtUop*>(stmt);
+      insn.uop_kind = uop->get_uop_kind();
+      insn.uop_fn = uop->get_uop_fn();
+      insn.op1 = lower_value(uop->get_val());
+      insn.size = uop->get_size();
+      break;
+    }
+    case Select: {
+      auto select = dynamic_cast<const StmtSelect*>(stmt);
+      insn.op1 = lower_value(select->get_cond());
+      insn.op2 = lower_value(select->get_val_true());
+      insn.op3 = lower_value(select->get_val_false());
+      break;
+    }
+    case Call: {
+      auto call = dynamic_cast<const StmtCall*>(stmt);
+      insn.target1 = function_idx.at(call->get_callee());
+      insn.target2 = operands.size();
+      insn.nops = call->get_args().size();
+      for (auto& v: call->get_args())
+        operands.push_back(lower_value(v));
+      break;
+    }
+    case Assert: {
+      auto assert_stmt = dynamic_cast<const StmtAssert*>(stmt);
+      insn.op1 = lower_value(assert_stmt->get_op1());
+      insn.op2 = lower_value(assert_stmt->get_op2());
+      break;
+    }
+    case Read:
+      break;
+    case Write:
+      insn.op1 = lower_value(dynamic_cast<const StmtWrite*>(stmt)->get_val());
+      break;
+    default:
+      break;
+  }
+
+  code.push_back(insn);
+}
+
+const Insn* Bytecode::get_code() const { return code.data(); }
+
+size_t Bytecode::get_code_size() const { return code.size(); }
+
+const Operand* Bytecode::get_operands() const { return operands.data(); }
+
+const BcSwitch& Bytecode::get_switch(uint32_t idx) const { return switches[idx]; }
+
+const BcFunction& Bytecode::get_function(uint32_t idx) const { return functions[idx]; }
+
+uint32_t Bytecode::get_num_functions() const { return functions.size(); }
+
+const BcSegment* Bytecode::get_segments() const { return segments.data(); }
+
+const BcOpCount* Bytecode::get_op_counts() const { return op_counts.data(); }
+
+uint32_t Bytecode::get_main_function() const { return main_function; }
@@ -0,0 +1,167 @@
+#ifndef SWPP_ASM_INTERPRETER_BYTECODE_H
+#define SWPP_ASM_INTERPRETER_BYTECODE_H
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+#include "opcode.h"
+#include "size.h"
+#include "reg.h"
+#include "regfile.h"
+#include "program.h"
+#include "arith.h"
+#include "jumptable.h"
+
+using namespace std;
+
+
+/**
+ * opcodes of the bytecode only, numbered after Opcode; the first instruction
+ * of a fused sequence gets one and runs the following instructions, which
+ * stay in place so that jump targets are unchanged
+ */
+enum FusedOpcode {
+  // a binary operation and a conditional branch on its result
+  BopBrCond = LEN_OPCODE,
+  // a unary operation followed by BopBrCond, as in incr; icmp; br
+  UopBopBrCond,
+  // a binary operation followed by BopBrCond, as in add; icmp; br
+  BopBopBrCond,
+  // a load followed by a binary operation
+  LoadBop,
+  // not fused: a statement whose registers may be invalid, run with the checks of the statement engine
+  Checked,
+
+  LEN_BC_OPCODE
+};
+
+/** pre-decoded operand: a register or an immediate */
+struct Operand {
+  bool is_reg;
+  Reg reg;
+  uint64_t imm;
+};
+
+/** a single flat instruction; targets are indices into Bytecode::code */
+struct Insn {
+  // an Opcode or a FusedOpcode
+  uint8_t opcode;
+  int line;
+  Reg lhs;
+
+  BopKind bop_kind;
+  UopKind uop_kind;
+  Size size;
+  MSize msize;
+  bool is_async;
+  uint64_t ofs;
+  BopFn bop_fn;
+  UopFn uop_fn;
+
+  Operand op1;
+  Operand op2;
+  Operand op3;
+
+  // br: taken/not-taken targets, switch: table index, call: callee index,
+  // sum/call: first operand in Bytecode::operands with nops operands
+  uint32_t target1;
+  uint32_t target2;
+  uint32_t nops;
+  // the statement it was lowered from
+  const Stmt* stmt;
+
+  // the first instruction of a segment: its index in Bytecode::segments
+  uint32_t segment;
+};
+
+/** number of the instructions of an opcode in a segment */
+struct BcOpCount {
+  uint8_t opcode;
+  uint32_t count;
+};
+
+/**
+ * straight-line run from the start of a block or a return point up to the
+ * next terminator or call, whose instructions are counted once on entry;
+ * counts are its op_counts from first_count
+ */
+struct BcSegment {
+  uint32_t ninsts;
+  uint32_t first_count;
+  uint32_t ncounts;
+};
+
+typedef JumpTable<uint32_t> BcSwitch;
+
+struct BcFunction {
+  const string* fname;
+  int nargs;
+  uint32_t entry;
+  // its instructions, which are contiguous
+  uint32_t begin;
+  uint32_t end;
+};
+
+
+class Bytecode {
+private:
+  vector<Insn> code;
+  vector<Operand> operands;
+  vector<BcSwitch> switches;
+  vector<BcFunction> functions;
+  vector<BcSegment> segments;
+  vector<BcOpCount> op_counts;
+  uint32_t main_function;
+
+  void lower_stmt(const Stmt* stmt, const map<Function*, uint32_t>& function_idx);
+  /**
+   * whether the registers that insn reads and writes pass the checks of RegFile
+   * in a function of nargs arguments, so that it can access them unchecked
+   */
+  bool has_valid_registers(const Insn& insn, int nargs) const;
+  /** replaces the opcodes of common sequences within a block by FusedOpcodes */
+  void fuse();
+  /** splits the code into segments; before fuse, which changes the opcodes of the first instructions */
+  void split_segments();
+
+public:
+  explicit Bytecode(const Program* program);
+
+  const Insn* get_code() const;
+  size_t get_code_size() const;
+  const Operand* get_operands() const;
+  const BcSwitch& get_switch(uint32_t idx) const;
+  const BcFunction& get_function(uint32_t idx) const;
+  uint32_t get_num_functions() const;
+  const BcSegment* get_segments() const;
+  const BcOpCount* get_op_counts() const;
+  uint32_t get_main_function() const;
+};
+
+
+inline pair<uint64_t, double> read_operand(const Operand& op, RegFile& regfile) {
+  if (op.is_reg)
+    return regfile.read_reg(op.reg);
+  else
+    return make_pair(op.imm, -1.0);
+}
+
+/** read_operand of an operand of an instruction that has_valid_registers */
+inline pair<uint64_t, double> read_valid_operand(const Operand& op, RegFile& regfile) {
+  if (op.is_reg)
+    return regfile.read_valid_reg(op.reg);
+  else
+    return make_pair(op.imm, -1.0);
+}
+
+inline pair<uint64_t, double> peek_operand(const Operand& op, const RegFile& regfile) {
+  if (op.is_reg)
+    return regfile.peek_reg(op.reg);
+  else
+    return make_pair(op.imm, -1.0);
+}
+
+#endif //SWPP_ASM_INTERPRETER_BYTECODE_H
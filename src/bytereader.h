@@ -0,0 +1,82 @@
+#ifndef SWPP_ASM_INTERPRETER_BYTEREADER_H
+#define SWPP_ASM_INTERPRETER_BYTEREADER_H
+
+#include <cinttypes>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+
+/**
+ * bounds-checked reads of a binary file in host byte order, e.g. a .sfbc cache
+ * or a samples file; fails from the first bad read on, which then reads as 0
+ */
+class ByteReader {
+private:
+  string_view in;
+  size_t pos;
+  bool ok;
+
+public:
+  explicit ByteReader(string_view _in): in(_in), pos(0), ok(true) {}
+
+  bool is_ok() const { return ok; }
+  bool at_end() const { return pos == in.length(); }
+  string_view get_rest() const { return in.substr(pos); }
+
+  void fail() { ok = false; }
+
+  template<typename T>
+  T get() {
+    T val{};
+    if (!ok || in.length() - pos < sizeof(T)) {
+      ok = false;
+      return val;
+    }
+    memcpy(&val, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return val;
+  }
+
+  uint64_t get_u8() { return get<uint8_t>(); }
+  uint64_t get_u32() { return get<uint32_t>(); }
+  uint64_t get_u64() { return get<uint64_t>(); }
+
+  /** an element count, each element taking at least min_size bytes */
+  uint64_t get_count(size_t min_size) {
+    uint64_t n = get_u32();
+    if (n > (in.length() - pos) / min_size)
+      ok = false;
+    return ok ? n : 0;
+  }
+
+  /** a length, then that many bytes */
+  string_view get_bytes() {
+    uint64_t n = get_count(1);
+    string_view bytes = in.substr(pos, n);
+    pos += n;
+    return bytes;
+  }
+
+  string get_str() { return string(get_bytes()); }
+
+  /** an index below bound */
+  uint64_t get_index(uint64_t bound) {
+    uint64_t idx = get_u32();
+    if (idx >= bound)
+      ok = false;
+    return ok ? idx : 0;
+  }
+
+  template<typename E>
+  E get_enum(E last) {
+    uint64_t val = get_u8();
+    if (val > (uint64_t)last)
+      ok = false;
+    return ok ? (E)val : (E)0;
+  }
+};
+
+#endif //SWPP_ASM_INTERPRETER_BYTEREADER_H
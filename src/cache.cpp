@@ -0,0 +1,516 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+
+#include "bytereader.h"
+#include "cache.h"
+#include "error.h"
+#include "mappedfile.h"
+#include "parser.h"
+
+/**
+ * layout of a .sfbc file, all integers in host byte order:
+ *   header     "SFBC", version, byte order mark, source hash, source size,
+ *              hash of the rest of the file
+ *   names      count, then (length, bytes) for every interned name
+ *   functions  count, then the name of every function
+ *   bodies     per function: nargs, block count, block names, entry block,
+ *              then per block the statement count and the statements
+ * names, functions and blocks are referred to by index, so branch targets
+ * and callees are resolved without looking anything up by name
+ */
+
+const static char SFBC_MAGIC[4] = {'S', 'F', 'B', 'C'};
+const static uint32_t SFBC_BOM = 0x01020304;
+
+
+class CacheWriter {
+private:
+  string out;
+
+public:
+  CacheWriter(): out() {}
+
+  template<typename T>
+  void put(T val) { out.append((const char*)&val, sizeof(T)); }
+
+  void put_raw(string_view bytes) { out.append(bytes.data(), bytes.length()); }
+
+  void put_u8(uint64_t val) { put<uint8_t>(val); }
+  void put_u32(uint64_t val) { put<uint32_t>(val); }
+  void put_u64(uint64_t val) { put<uint64_t>(val); }
+
+  void put_bytes(string_view bytes) {
+    put_u32(bytes.length());
+    out.append(bytes.data(), bytes.length());
+  }
+
+  void put_value(const Value& val) {
+    put_u8(val.is_reg());
+    if (val.is_reg())
+      put_u8(val.get_reg());
+    else
+      put_u64(val.get_literal());
+  }
+
+  void patch_u64(size_t pos, uint64_t val) { memcpy(&out[pos], &val, sizeof(val)); }
+
+  size_t get_pos() const { return out.length(); }
+  const string& get_output() const { return out; }
+};
+
+
+/** reads of a .sfbc file; any failure marks the whole cache as unusable */
+class CacheReader: public ByteReader {
+public:
+  explicit CacheReader(string_view _in): ByteReader(_in) {}
+
+  Reg get_reg(bool allow_none) {
+    uint64_t reg = get_u8();
+    if (reg >= (allow_none ? RegNone + 1 : NREGS))
+      fail();
+    return is_ok() ? (Reg)reg : RegNone;
+  }
+
+  Value get_value() {
+    if (get_u8())
+      return Value(get_reg(false));
+    return Value((uint64_t)get_u64());
+  }
+
+  /** the name at an index into names; "" once a read failed, so that nothing past names is read */
+  const string& get_name(const vector<const string*>& names) {
+    static const string none;
+    uint64_t idx = get_index(names.size());
+    return is_ok() ? *names[idx] : none;
+  }
+};
+
+
+uint64_t hash_source(string_view source) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c: source) {
+    hash ^= (uint8_t)c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+string cache_filename(const string& filename, const string& cache_dir, uint64_t hash) {
+  if (cache_dir.empty())
+    return filename + ".sfbc";
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.sfbc", (unsigned long long)hash);
+  return cache_dir + "/" + name;
+}
+
+
+/** false if stmt has no encoding */
+bool save_stmt(CacheWriter& w, const Stmt* stmt, const map<const Stmt*, uint32_t>& block_idx,
+               const map<const Function*, uint32_t>& function_idx) {
+  w.put_u8(stmt->get_opcode());
+  w.put_u32(stmt->get_line());
+  w.put_u8(stmt->get_lhs());
+
+  switch (stmt->get_opcode()) {
+    case Ret:
+      w.put_value(dynamic_cast<const StmtRet*>(stmt)->get_val());
+      break;
+    case BrUncond:
+      w.put_u32(block_idx.at(dynamic_cast<const StmtBrUncond*>(stmt)->get_bb()));
+      break;
+    case BrCond: {
+      auto br = dynamic_cast<const StmtBrCond*>(stmt);
+      w.put_value(br->get_cond());
+      w.put_u32(block_idx.at(br->get_true_bb()));
+      w.put_u32(block_idx.at(br->get_false_bb()));
+      break;
+    }
+    case Switch: {
+      auto sw = dynamic_cast<const StmtSwitch*>(stmt);
+      w.put_value(sw->get_cond());
+      w.put_u32(sw->get_targets().size());
+      for (auto& it: sw->get_targets()) {
+        w.put_u64(it.first);
+        w.put_u32(block_idx.at(it.second));
+      }
+      w.put_u32(block_idx.at(sw->get_default()));
+      break;
+    }
+    case Malloc:
+      w.put_value(dynamic_cast<const StmtMalloc*>(stmt)->get_val());
+      break;
+    case Free:
+      w.put_value(dynamic_cast<const StmtFree*>(stmt)->get_ptr());
+      break;
+    case Load: {
+      auto load = dynamic_cast<const StmtLoad*>(stmt);
+      w.put_u8(load->get_is_async());
+      w.put_u8(load->get_size());
+      w.put_value(load->get_ptr());
+      w.put_u64(load->get_ofs());
+      break;
+    }
+    case Store: {
+      auto store = dynamic_cast<const StmtStore*>(stmt);
+      w.put_u8(store->get_size());
+      w.put_value(store->get_val());
+      w.put_value(store->get_ptr());
+      w.put_u64(store->get_ofs());
+      break;
+    }
+    case Bop: {
+      auto bop = dynamic_cast<const StmtBop*>(stmt);
+      w.put_u8(bop->get_bop_kind());
+      w.put_value(bop->get_val1());
+      w.put_value(bop->get_val2());
+      w.put_u8(bop->get_size());
+      break;
+    }
+    case Sum: {
+      auto sum = dynamic_cast<const StmtSum*>(stmt);
+      w.put_u32(sum->get_values().size());
+      for (auto& v: sum->get_values())
+        w.put_value(v);
+      w.put_u8(sum->get_size());
+      break;
+    }
+    case Uop: {
+      auto uop = dynamic_cast<const StmtUop*>(stmt);
+      w.put_u8(uop->get_uop_kind());
+      w.put_value(uop->get_val());
+      w.put_u8(uop->get_size());
+      break;
+    }
+    case Select: {
+      auto select = dynamic_cast<const StmtSelect*>(stmt);
+      w.put_value(select->get_cond());
+      w.put_value(select->get_val_true());
+      w.put_value(select->get_val_false());
+      break;
+    }
+    case Call: {
+      auto call = dynamic_cast<const StmtCall*>(stmt);
+      w.put_u32(function_idx.at(call->get_callee()));
+      w.put_u32(call->get_args().size());
+      for (auto& v: call->get_args())
+        w.put_value(v);
+      break;
+    }
+    case Assert: {
+      auto assert_stmt = dynamic_cast<const StmtAssert*>(stmt);
+      w.put_value(assert_stmt->get_op1());
+      w.put_value(assert_stmt->get_op2());
+      break;
+    }
+    case Read:
+      break;
+    case Write:
+      w.put_value(dynamic_cast<const StmtWrite*>(stmt)->get_val());
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+bool save_cached_program(const string& cache_file, const Program* program, uint64_t hash, uint64_t source_size) {
+  CacheWriter w;
+  w.put_raw(string_view(SFBC_MAGIC, sizeof(SFBC_MAGIC)));
+  w.put_u32(SFBC_VERSION);
+  w.put_u32(SFBC_BOM);
+  w.put_u64(hash);
+  w.put_u64(source_size);
+  size_t checksum_pos = w.get_pos();
+  w.put_u64(0);
+  size_t payload_pos = w.get_pos();
+
+  // every name once, in order of first use
+  vector<string_view> names;
+  map<string_view, uint32_t> name_idx;
+  auto name_of = [&](string_view name) {
+    auto it = name_idx.find(name);
+    if (it != name_idx.end())
+      return it->second;
+    uint32_t idx = names.size();
+    names.push_back(name);
+    name_idx.insert(pair<string_view, uint32_t>(name, idx));
+    return idx;
+  };
+
+  map<const Function*, uint32_t> function_idx;
+  for (auto& it: program->get_function_map()) {
+    name_of(it.first);
+    function_idx.insert(pair<const Function*, uint32_t>(it.second, function_idx.size()));
+    for (auto& bb: it.second->get_bb_map())
+      name_of(bb.first);
+  }
+
+  w.put_u32(names.size());
+  for (auto& name: names)
+    w.put_bytes(name);
+
+  w.put_u32(function_idx.size());
+  for (auto& it: program->get_function_map())
+    w.put_u32(name_idx.at(it.first));
+
+  for (auto& it: program->get_function_map()) {
+    const Function* function = it.second;
+    map<const Stmt*, uint32_t> block_idx;
+    for (auto& bb: function->get_bb_map())
+      block_idx.insert(pair<const Stmt*, uint32_t>(bb.second, block_idx.size()));
+
+    w.put_u32(function->get_nargs());
+    w.put_u32(block_idx.size());
+    for (auto& bb: function->get_bb_map())
+      w.put_u32(name_idx.at(bb.first));
+    w.put_u32(block_idx.at(function->get_first_bb()));
+
+    for (auto& bb: function->get_bb_map()) {
+      uint32_t nstmts = 0;
+      for (const Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next())
+        nstmts++;
+      w.put_u32(nstmts);
+      for (const Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next()) {
+        if (!save_stmt(w, stmt, block_idx, function_idx))
+          return false;
+      }
+    }
+  }
+
+  w.patch_u64(checksum_pos, hash_source(string_view(w.get_output()).substr(payload_pos)));
+
+  // write to a private file first so that concurrent runs never see a partial cache
+  string tmp_file = cache_file + ".tmp." + to_string(getpid());
+  {
+    ofstream out(tmp_file, ios::binary);
+    if (!out.is_open())
+      return false;
+    out.write(w.get_output().data(), w.get_output().length());
+    if (!out.good()) {
+      out.close();
+      remove(tmp_file.c_str());
+      return false;
+    }
+  }
+  if (rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+    remove(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+Stmt* load_stmt(CacheReader& r, const vector<const string*>& blocks, const vector<const string*>& functions) {
+  auto opcode = r.get_enum<Opcode>(Write);
+  int line = r.get_u32();
+  Reg lhs = r.get_reg(true);
+  if (!r.is_ok())
+    return nullptr;
+
+  switch (opcode) {
+    case Ret:
+      return new StmtRet(line, r.get_value());
+    case BrUncond:
+      return new StmtBrUncond(line, r.get_name(blocks));
+    case BrCond: {
+      Value cond = r.get_value();
+      const string& true_bb = r.get_name(blocks);
+      const string& false_bb = r.get_name(blocks);
+      return new StmtBrCond(line, cond, true_bb, false_bb);
+    }
+    case Switch: {
+      auto stmt = new StmtSwitch(line, r.get_value());
+      uint64_t ncases = r.get_count(12);
+      for (uint64_t i = 0; i < ncases; i++) {
+        uint64_t val = r.get_u64();
+        if (!stmt->set_bb(val, r.get_name(blocks)))
+          r.fail();
+      }
+      stmt->set_default(r.get_name(blocks));
+      return stmt;
+    }
+    case Malloc:
+      return new StmtMalloc(line, lhs, r.get_value());
+    case Free:
+      return new StmtFree(line, r.get_value());
+    case Load: {
+      bool is_async = r.get_u8();
+      auto msize = r.get_enum<MSize>(MSize8);
+      Value ptr = r.get_value();
+      uint64_t ofs = r.get_u64();
+      return new StmtLoad(line, lhs, is_async, msize, ptr, ofs);
+    }
+    case Store: {
+      auto msize = r.get_enum<MSize>(MSize8);
+      Value val = r.get_value();
+      Value ptr = r.get_value();
+      uint64_t ofs = r.get_u64();
+      return new StmtStore(line, msize, val, ptr, ofs);
+    }
+    case Bop: {
+      auto kind = r.get_enum<BopKind>(Sle);
+      Value val1 = r.get_value();
+      Value val2 = r.get_value();
+      auto size = r.get_enum<Size>(Size64);
+      return new StmtBop(line, lhs, kind, val1, val2, size);
+    }
+    case Sum: {
+      vector<Value> values;
+      uint64_t nvalues = r.get_count(2);
+      for (uint64_t i = 0; i < nvalues; i++)
+        values.push_back(r.get_value());
+      auto size = r.get_enum<Size>(Size64);
+      return new StmtSum(line, lhs, values, size);
+    }
+    case Uop: {
+      auto kind = r.get_enum<UopKind>(Decr);
+      Value val = r.get_value();
+      auto size = r.get_enum<Size>(Size64);
+      return new StmtUop(line, lhs, kind, val, size);
+    }
+    case Select: {
+      Value cond = r.get_value();
+      Value val_true = r.get_value();
+      Value val_false = r.get_value();
+      return new StmtSelect(line, lhs, cond, val_true, val_false);
+    }
+    case Call: {
+      auto stmt = new StmtCall(line, lhs, r.get_name(functions));
+      uint64_t nargs = r.get_count(2);
+      for (uint64_t i = 0; i < nargs; i++)
+        stmt->push_arg(r.get_value());
+      return stmt;
+    }
+    case Assert: {
+      Value op1 = r.get_value();
+      Value op2 = r.get_value();
+      return new StmtAssert(line, op1, op2);
+    }
+    case Read:
+      return new StmtRead(line, lhs);
+    case Write:
+      return new StmtWrite(line, lhs, r.get_value());
+    default:
+      r.fail();
+      return nullptr;
+  }
+}
+
+bool is_terminator(Opcode opcode) {
+  return opcode == Ret || opcode == BrUncond || opcode == BrCond || opcode == Switch;
+}
+
+Program* load_cached_program(const string& cache_file, uint64_t hash, uint64_t source_size) {
+  MappedFile input(cache_file);
+  if (!input.is_open())
+    return nullptr;
+
+  CacheReader r(input.contents());
+  char magic[sizeof(SFBC_MAGIC)];
+  for (char& c: magic)
+    c = r.get<char>();
+  if (memcmp(magic, SFBC_MAGIC, sizeof(SFBC_MAGIC)) != 0 || r.get_u32() != SFBC_VERSION ||
+      r.get_u32() != SFBC_BOM || r.get_u64() != hash || r.get_u64() != source_size || !r.is_ok())
+    return nullptr;
+  uint64_t checksum = r.get_u64();
+  if (!r.is_ok() || hash_source(r.get_rest()) != checksum)
+    return nullptr;
+
+  unique_ptr<Program> program(new Program());
+
+  vector<const string*> names;
+  uint64_t nnames = r.get_count(4);
+  for (uint64_t i = 0; i < nnames; i++)
+    names.push_back(&program->intern(r.get_bytes()));
+
+  vector<const string*> function_names;
+  uint64_t nfunctions = r.get_count(4);
+  for (uint64_t i = 0; i < nfunctions; i++)
+    function_names.push_back(&r.get_name(names));
+
+  for (uint64_t i = 0; i < nfunctions && r.is_ok(); i++) {
+    uint64_t nargs = r.get_u32();
+    if (nargs > NARGREGS)
+      r.fail();
+    auto function = new Function(*function_names[i], (int)nargs);
+    if (!program->set_function(*function_names[i], function)) {
+      delete function;
+      r.fail();
+      break;
+    }
+
+    vector<const string*> blocks;
+    uint64_t nblocks = r.get_count(4);
+    for (uint64_t j = 0; j < nblocks; j++)
+      blocks.push_back(&r.get_name(names));
+    if (nblocks == 0 || !r.is_ok())
+      break;
+    function->set_first_bb(r.get_name(blocks));
+
+    for (uint64_t j = 0; j < nblocks && r.is_ok(); j++) {
+      uint64_t nstmts = r.get_count(6);
+      Stmt* prev_stmt = nullptr;
+      for (uint64_t k = 0; k < nstmts && r.is_ok(); k++) {
+        Stmt* stmt = load_stmt(r, blocks, function_names);
+        if (stmt == nullptr || !r.is_ok() || is_terminator(stmt->get_opcode()) != (k == nstmts - 1)) {
+          delete stmt;
+          r.fail();
+          break;
+        }
+        if (prev_stmt == nullptr) {
+          if (!function->set_bb(*blocks[j], stmt)) {
+            delete stmt;
+            r.fail();
+            break;
+          }
+        }
+        else
+          prev_stmt->set_next(stmt);
+        prev_stmt = stmt;
+      }
+      if (prev_stmt == nullptr)
+        r.fail();
+    }
+  }
+
+  if (!r.is_ok() || !r.at_end())
+    return nullptr;
+
+  Function* main = program->get_function("main");
+  if (main == nullptr || main->get_nargs() != 0)
+    return nullptr;
+
+  // every target refers to an existing block and function, so linking cannot fail
+  program->link();
+  error_line_num = 0;
+
+  return program.release();
+}
+
+Program* parse_cached(const string& filename, const string& cache_dir, unsigned jobs) {
+  MappedFile input(filename);
+  if (!input.is_open())
+    return nullptr;
+
+  string_view source = input.contents();
+  uint64_t hash = hash_source(source);
+  string cache_file = cache_filename(filename, cache_dir, hash);
+
+  Program* program = load_cached_program(cache_file, hash, source.length());
+  if (program != nullptr) {
+    program->set_filename(filename);
+    return program;
+  }
+
+  program = parse_source(source, filename, jobs);
+  save_cached_program(cache_file, program, hash, source.length());
+  return program;
+}
@@ -0,0 +1,31 @@
+#ifndef SWPP_ASM_INTERPRETER_CACHE_H
+#define SWPP_ASM_INTERPRETER_CACHE_H
+
+#include <cinttypes>
+#include <string>
+#include <string_view>
+
+#include "program.h"
+
+using namespace std;
+
+
+/** bumped whenever the layout of a .sfbc file changes */
+#define SFBC_VERSION 1
+
+uint64_t hash_source(string_view source);
+
+/** the cache file of a source with the given hash, next to it unless a directory is given */
+string cache_filename(const string& filename, const string& cache_dir, uint64_t hash);
+
+/** a linked Program, or nullptr if the cache is missing, stale or corrupted */
+Program* load_cached_program(const string& cache_file, uint64_t hash, uint64_t source_size);
+bool save_cached_program(const string& cache_file, const Program* program, uint64_t hash, uint64_t source_size);
+
+/**
+ * parse() through the binary cache; syntax errors are always reported by
+ * a fresh parse since only valid programs are cached
+ */
+Program* parse_cached(const string& filename, const string& cache_dir, unsigned jobs = 1);
+
+#endif //SWPP_ASM_INTERPRETER_CACHE_H
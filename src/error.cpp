@@ -1,24 +1,28 @@
-#include <iostream>
-#include <cstdlib>
-
 #include "error.h"
 
 
-string error_filename;
-int error_line_num = 0;
+thread_local string error_filename;
+thread_local int error_line_num = 0;
+
+SyntaxError::SyntaxError(const string& msg): runtime_error(msg) {}
+
+ExecutionError::ExecutionError(const string& msg): runtime_error(msg) {}
+
+BudgetExceeded::BudgetExceeded(const string& msg): ExecutionError(msg) {}
 
 void invoke_syntax_error(const string& msg) {
-  cout << "Syntax error at " << error_filename << ":" << error_line_num << ": " << msg << endl;
-  exit(EXIT_FAILURE);
+  throw SyntaxError("Syntax error at " + error_filename + ":" + to_string(error_line_num) + ": " + msg);
 }
 
 void invoke_runtime_error(const string& msg) {
-  cout << "Runtime error at " << error_filename << ":" << error_line_num << ": " << msg << endl;
-  exit(EXIT_FAILURE);
+  throw ExecutionError("Runtime error at " + error_filename + ":" + to_string(error_line_num) + ": " + msg);
 }
 
 void invoke_assertion_failed(const RegFile& regfile) {
-  cout << "Assertion failed at " << error_filename << ":" << error_line_num << endl;
-  cout << "Registers: " << regfile.to_string() << endl;
-  exit(EXIT_FAILURE);
+  throw ExecutionError("Assertion failed at " + error_filename + ":" + to_string(error_line_num) + "\n" +
+                       "Registers: " + regfile.to_string());
+}
+
+void invoke_budget_exceeded(const string& msg) {
+  throw BudgetExceeded("Budget exceeded at " + error_filename + ":" + to_string(error_line_num) + ": " + msg);
 }
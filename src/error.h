@@ -2,17 +2,42 @@
 #define SWPP_ASM_INTERPRETER_ERROR_H
 
 #include <string>
+#include <stdexcept>
 
 #include "regfile.h"
 
 using namespace std;
 
 
-extern string error_filename;
-extern int error_line_num;
+// where the current thread parses or executes, for the messages below
+extern thread_local string error_filename;
+extern thread_local int error_line_num;
 
-void invoke_syntax_error(const string& msg);
-void invoke_runtime_error(const string& msg);
-void invoke_assertion_failed(const RegFile& regfile);
+/** a program rejected by the parser; what() is the report */
+class SyntaxError: public runtime_error {
+public:
+  explicit SyntaxError(const string& msg);
+};
+
+/** an execution stopped by a runtime error or a failed assertion; what() is the report */
+class ExecutionError: public runtime_error {
+public:
+  explicit ExecutionError(const string& msg);
+};
+
+/** an execution stopped by --max-insts or --max-cost; its logs are still written */
+class BudgetExceeded: public ExecutionError {
+public:
+  explicit BudgetExceeded(const string& msg);
+};
+
+// exit status of an execution stopped by BudgetExceeded
+#define EXIT_BUDGET_EXCEEDED 3
+
+/** syntax errors stop the parse, execution errors only the current execution */
+[[noreturn]] void invoke_syntax_error(const string& msg);
+[[noreturn]] void invoke_runtime_error(const string& msg);
+[[noreturn]] void invoke_assertion_failed(const RegFile& regfile);
+[[noreturn]] void invoke_budget_exceeded(const string& msg);
 
 #endif //SWPP_ASM_INTERPRETER_ERROR_H
@@ -1,33 +1,67 @@
+#include <algorithm>
+
 #include "function.h"
+#include "error.h"
+
 
+Function::Function(const string& _fname, int _nargs):
+fname(_fname), nargs(_nargs), first_bb(nullptr), first_stmt(nullptr), bb_map() {}
 
-Function::Function(string _fname, int _nargs):
-fname(std::move(_fname)), nargs(_nargs), first_bb(), bb_map() {}
+Function::~Function() {
+  for (auto& it: bb_map) {
+    for (Stmt* stmt = it.second; stmt != nullptr;) {
+      Stmt* next = stmt->get_next();
+      delete stmt;
+      stmt = next;
+    }
+  }
+}
 
 const string & Function::get_fname() const { return fname; }
 
 int Function::get_nargs() const { return nargs; }
 
-Stmt* Function::get_first_bb() const {
-  auto it = bb_map.find(first_bb);
-  if (it == bb_map.end())
-    return nullptr;
-  return it->second;
-}
+Stmt* Function::get_first_bb() const { return first_stmt; }
 
-void Function::set_first_bb(const string& bb) { first_bb = bb; }
+void Function::set_first_bb(const string& bb) { first_bb = &bb; }
 
-Stmt* Function::get_bb(const string &bbname) const {
+Stmt* Function::get_bb(string_view bbname) const {
   auto it = bb_map.find(bbname);
   if (it == bb_map.end())
     return nullptr;
   return it->second;
 }
 
+const map<string_view, Stmt*>& Function::get_bb_map() const { return bb_map; }
+
 bool Function::set_bb(const string &bbname, Stmt *stmt) {
   auto it = bb_map.find(bbname);
   if (it != bb_map.end())
     return false;
-  bb_map.insert(pair<string, Stmt*>(bbname, stmt));
+  bb_map.insert(pair<string_view, Stmt*>(bbname, stmt));
   return true;
 }
+
+int Function::get_line() const {
+  int line = 0;
+  for (auto& it: bb_map) {
+    if (line == 0 || it.second->get_line() < line)
+      line = it.second->get_line();
+  }
+  return line;
+}
+
+void Function::link(Program* program) {
+  first_stmt = get_bb(*first_bb);
+  // bb_map is in name order
+  vector<Stmt*> bbs;
+  for (auto& it: bb_map)
+    bbs.push_back(it.second);
+  sort(bbs.begin(), bbs.end(), [](const Stmt* a, const Stmt* b) { return a->get_line() < b->get_line(); });
+  for (Stmt* bb: bbs) {
+    for (Stmt* stmt = bb; stmt != nullptr; stmt = stmt->get_next()) {
+      error_line_num = stmt->get_line();
+      stmt->link(this, program);
+    }
+  }
+}
@@ -2,28 +2,41 @@
 #define SWPP_ASM_INTERPRETER_FUNCTION_H
 
 #include <map>
+#include <string_view>
+#include <vector>
 
 #include "stmt.h"
 
 using namespace std;
 
 
+/** owns the statements of its basic blocks */
 class Function {
 private:
-  const string fname;
+  const string& fname;
   const int nargs;
-  string first_bb;
-  map<string, Stmt*> bb_map;
+  const string* first_bb;
+  Stmt* first_stmt;
+  map<string_view, Stmt*> bb_map;
 
 public:
-  Function(string _fname, int _nargs);
+  /** names are interned by the owning Program */
+  Function(const string& _fname, int _nargs);
+  ~Function();
+  Function(const Function&) = delete;
+  Function& operator=(const Function&) = delete;
 
   const string& get_fname() const;
   int get_nargs() const;
   Stmt* get_first_bb() const;
   void set_first_bb(const string& bb);
-  Stmt* get_bb(const string& bbname) const;
+  Stmt* get_bb(string_view bbname) const;
+  const map<string_view, Stmt*>& get_bb_map() const;
   bool set_bb(const string& bbname, Stmt* stmt);
+  /** the line of its first statement, 0 if it has none */
+  int get_line() const;
+  /** links its blocks in source order, so that an error is reported at its earliest line */
+  void link(Program* program);
 };
 
 #endif //SWPP_ASM_INTERPRETER_FUNCTION_H
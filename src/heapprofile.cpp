@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#include "heapprofile.h"
+#include "error.h"
+
+
+HeapProfile::HeapProfile(): sites(), site_of(), live_bytes(0), peak_bytes(0), epoch(0) {}
+
+void HeapProfile::reset(const Program* program) {
+  int max_line = 0;
+  for (auto& f: program->get_function_map())
+    for (auto& bb: f.second->get_bb_map())
+      for (Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next())
+        max_line = max(max_line, stmt->get_line());
+
+  sites.assign(max_line + 1, HeapSite{0, 0, 0, 0, 0, 0, 0, 0, 0});
+  site_of.clear();
+  live_bytes = 0;
+  peak_bytes = 0;
+  epoch = 0;
+}
+
+HeapSite& HeapProfile::change_site(int line) {
+  if ((size_t)line >= sites.size())
+    sites.resize(line + 1, HeapSite{0, 0, 0, 0, 0, 0, 0, 0, 0});
+  HeapSite& site = sites[line];
+  // unchanged since the last peak, so it still holds what it held then
+  if (site.changed_epoch < epoch) {
+    site.peak_bytes = site.live_bytes;
+    site.peak_blocks = site.live_blocks;
+    site.peak_epoch = epoch;
+    site.changed_epoch = epoch;
+  }
+  return site;
+}
+
+HeapSite HeapProfile::at_peak(const HeapSite& site) const {
+  HeapSite result = site;
+  if (site.changed_epoch == epoch && site.peak_epoch == epoch) {
+    result.live_bytes = site.peak_bytes;
+    result.live_blocks = site.peak_blocks;
+  }
+  return result;
+}
+
+void HeapProfile::record_malloc(uint64_t addr, uint64_t size) {
+  int line = error_line_num;
+  HeapSite& site = change_site(line);
+  site.mallocs++;
+  site.alloced_bytes += size;
+  site.live_bytes += size;
+  site.live_blocks++;
+  site_of[addr] = line;
+
+  live_bytes += size;
+  if (live_bytes > peak_bytes) {
+    peak_bytes = live_bytes;
+    epoch++;
+  }
+}
+
+void HeapProfile::record_free(uint64_t addr, uint64_t size) {
+  auto it = site_of.find(addr);
+  if (it == site_of.end())
+    return;
+  HeapSite& site = change_site(it->second);
+  site_of.erase(it);
+  site.frees++;
+  site.live_bytes -= size;
+  site.live_blocks--;
+  live_bytes -= size;
+}
+
+void HeapProfile::write_report(Output& out, const Program* program) const {
+  struct Entry {
+    const string* fname;
+    int line;
+    HeapSite site;
+  };
+
+  vector<Entry> entries;
+  for (auto& f: program->get_function_map()) {
+    for (auto& bb: f.second->get_bb_map()) {
+      for (const Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next()) {
+        int line = stmt->get_line();
+        if (stmt->get_opcode() == Malloc && (size_t)line < sites.size() && sites[line].mallocs > 0)
+          entries.push_back(Entry{&f.second->get_fname(), line, at_peak(sites[line])});
+      }
+    }
+  }
+
+  sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+    if (a.site.live_bytes != b.site.live_bytes)
+      return a.site.live_bytes > b.site.live_bytes;
+    if (a.site.alloced_bytes != b.site.alloced_bytes)
+      return a.site.alloced_bytes > b.site.alloced_bytes;
+    return a.line < b.line;
+  });
+
+  out.write_str("Max heap usage (bytes): ");
+  out.write_line(peak_bytes);
+  out.write_str("Function\tLine\tBytes at peak\tBlocks at peak\tMallocs\tFrees\tBytes allocated\n");
+  for (auto& e: entries) {
+    out.write_str(*e.fname);
+    out.write_str("\t");
+    out.write_u64(e.line);
+    out.write_str("\t");
+    out.write_u64(e.site.live_bytes);
+    out.write_str("\t");
+    out.write_u64(e.site.live_blocks);
+    out.write_str("\t");
+    out.write_u64(e.site.mallocs);
+    out.write_str("\t");
+    out.write_u64(e.site.frees);
+    out.write_str("\t");
+    out.write_line(e.site.alloced_bytes);
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef SWPP_ASM_INTERPRETER_HEAPPROFILE_H
+#define SWPP_ASM_INTERPRETER_HEAPPROFILE_H
+
+#include <cinttypes>
+#include <unordered_map>
+#include <vector>
+
+#include "program.h"
+#include "io.h"
+
+using namespace std;
+
+
+/** allocations of the malloc on a single line */
+struct HeapSite {
+  uint64_t mallocs;
+  uint64_t frees;
+  uint64_t alloced_bytes;
+  uint64_t live_bytes;
+  uint64_t live_blocks;
+  // live_bytes and live_blocks at the peak numbered peak_epoch, saved on the first change after it
+  uint64_t peak_bytes;
+  uint64_t peak_blocks;
+  uint64_t peak_epoch;
+  // the number of peaks before the last change
+  uint64_t changed_epoch;
+};
+
+/**
+ * heap usage by malloc site, and what each site held when the heap usage was
+ * at its maximum; the snapshot is taken lazily, so recording stays O(1)
+ */
+class HeapProfile {
+private:
+  vector<HeapSite> sites;
+  // the site of each live block
+  unordered_map<uint64_t, int> site_of;
+  uint64_t live_bytes;
+  uint64_t peak_bytes;
+  // the number of times live_bytes reached a new maximum
+  uint64_t epoch;
+
+  HeapSite& change_site(int line);
+  HeapSite at_peak(const HeapSite& site) const;
+
+public:
+  HeapProfile();
+
+  /** clears the profile and makes room for every line of program */
+  void reset(const Program* program);
+
+  /** a block allocated by the executing statement, as in error_line_num */
+  void record_malloc(uint64_t addr, uint64_t size);
+  void record_free(uint64_t addr, uint64_t size);
+
+  /** sites sorted by their bytes live at the peak */
+  void write_report(Output& out, const Program* program) const;
+};
+
+#endif //SWPP_ASM_INTERPRETER_HEAPPROFILE_H
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io.h"
+
+
+/** the characters skipped by operator>> in the classic locale */
+static bool is_space(int c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+Input::Input(): pos(nullptr), end(nullptr) {}
+
+Input::~Input() {}
+
+void Input::set_buffer(const char* begin, const char* _end) {
+  pos = begin;
+  end = _end;
+}
+
+bool Input::read_u64(uint64_t& val) {
+  int c;
+  do {
+    c = get();
+  } while (is_space(c));
+  if (c < 0)
+    return false;
+
+  bool neg = false;
+  if (c == '+' || c == '-') {
+    neg = c == '-';
+    c = get();
+  }
+
+  bool digits = false;
+  bool overflow = false;
+  uint64_t mag = 0;
+  while (c >= '0' && c <= '9') {
+    uint64_t digit = c - '0';
+    if (mag > (UINT64_MAX - digit) / 10)
+      overflow = true;
+    mag = mag * 10 + digit;
+    digits = true;
+    c = get();
+  }
+
+  // the rest of the word is ignored
+  while (c >= 0 && !is_space(c))
+    c = get();
+
+  if (!digits || overflow)
+    return false;
+  val = neg ? -mag : mag;
+  return true;
+}
+
+FdInput::FdInput(int _fd, Output* _tied): fd(_fd), buffer(IO_BUFFER_SIZE), tied(_tied) {}
+
+bool FdInput::refill() {
+  if (tied != nullptr)
+    tied->flush();
+
+  ssize_t n;
+  do {
+    n = read(fd, buffer.data(), buffer.size());
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return false;
+
+  set_buffer(buffer.data(), buffer.data() + n);
+  return true;
+}
+
+MemoryInput::MemoryInput(string_view data) {
+  set_buffer(data.data(), data.data() + data.length());
+}
+
+bool MemoryInput::refill() { return false; }
+
+CallbackInput::CallbackInput(function<size_t(char* buf, size_t size)> _read):
+read(move(_read)), buffer(IO_BUFFER_SIZE) {}
+
+bool CallbackInput::refill() {
+  size_t n = read(buffer.data(), buffer.size());
+  if (n == 0)
+    return false;
+  set_buffer(buffer.data(), buffer.data() + min(n, buffer.size()));
+  return true;
+}
+
+
+Output::Output(): buffer(IO_BUFFER_SIZE), length(0) {}
+
+Output::~Output() {}
+
+/** formats val in decimal, followed by suffix unless it is 0, at the end of buf */
+static size_t format_u64(char (&buf)[21], uint64_t val, char suffix) {
+  char* p = buf + sizeof(buf);
+  if (suffix != 0)
+    *--p = suffix;
+  do {
+    *--p = '0' + val % 10;
+    val /= 10;
+  } while (val != 0);
+  return buf + sizeof(buf) - p;
+}
+
+void Output::write_u64(uint64_t val) {
+  char buf[21];
+  size_t size = format_u64(buf, val, 0);
+  write_str(string_view(buf + sizeof(buf) - size, size));
+}
+
+void Output::write_line(uint64_t val) {
+  char buf[21];
+  size_t size = format_u64(buf, val, '\n');
+  if (buffer.size() - length < size)
+    flush();
+  memcpy(buffer.data() + length, buf + sizeof(buf) - size, size);
+  length += size;
+}
+
+void Output::write_fixed(double val) {
+  char buf[64];
+  int n = snprintf(buf, sizeof(buf), "%.4f", val);
+  if (n < 0)
+    return;
+  if ((size_t)n < sizeof(buf)) {
+    write_str(string_view(buf, n));
+    return;
+  }
+  // above about 1e58, all digits of the integer part are printed
+  vector<char> big(n + 1);
+  snprintf(big.data(), big.size(), "%.4f", val);
+  write_str(string_view(big.data(), n));
+}
+
+void Output::write_str(string_view str) {
+  if (buffer.size() - length < str.length()) {
+    flush();
+    if (str.length() > buffer.size()) {
+      write_out(str.data(), str.length());
+      return;
+    }
+  }
+  memcpy(buffer.data() + length, str.data(), str.length());
+  length += str.length();
+}
+
+void Output::flush() {
+  if (length > 0)
+    write_out(buffer.data(), length);
+  length = 0;
+}
+
+FdOutput::FdOutput(int _fd): fd(_fd), owned(false), error(0) {}
+
+FdOutput::FdOutput(const string& filename):
+fd(open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)), owned(true), error(fd < 0 ? errno : 0) {}
+
+FdOutput::~FdOutput() {
+  flush();
+  if (owned && fd >= 0)
+    close(fd);
+}
+
+bool FdOutput::is_open() const { return fd >= 0; }
+
+int FdOutput::get_error() const { return error; }
+
+string FdOutput::check(const string& name) {
+  flush();
+  if (error == 0)
+    return "";
+  return "cannot write " + name + ": " + strerror(error);
+}
+
+void FdOutput::write_out(const char* data, size_t size) {
+  while (size > 0 && error == 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      error = errno;
+    else if (n == 0)
+      error = EIO;
+    else {
+      data += n;
+      size -= n;
+    }
+  }
+}
+
+StringOutput::StringOutput(): data() {}
+
+void StringOutput::write_out(const char* _data, size_t size) { data.append(_data, size); }
+
+const string& StringOutput::get_str() const { return data; }
+
+CallbackOutput::CallbackOutput(function<void(const char* data, size_t size)> _write): write(move(_write)) {}
+
+void CallbackOutput::write_out(const char* data, size_t size) { write(data, size); }
+
+
+FdOutput& std_output() {
+  static FdOutput output(STDOUT_FILENO);
+  return output;
+}
+
+Input& std_input() {
+  static FdInput input(STDIN_FILENO, &std_output());
+  return input;
+}
@@ -0,0 +1,164 @@
+#ifndef SWPP_ASM_INTERPRETER_IO_H
+#define SWPP_ASM_INTERPRETER_IO_H
+
+#include <cinttypes>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+
+#define IO_BUFFER_SIZE (1 << 20)
+
+class Output;
+
+/** buffered source of the read function */
+class Input {
+private:
+  const char* pos;
+  const char* end;
+
+  int get() {
+    if (pos == end && !refill())
+      return -1;
+    return (unsigned char)*pos++;
+  }
+
+protected:
+  void set_buffer(const char* begin, const char* _end);
+  /** makes more data available through set_buffer; false at the end of the input */
+  virtual bool refill() = 0;
+
+public:
+  Input();
+  virtual ~Input();
+  Input(const Input&) = delete;
+  Input& operator=(const Input&) = delete;
+
+  /**
+   * reads the next whitespace-separated word and parses it as stoull would,
+   * i.e. an optionally signed decimal prefix; false if it is not a number
+   */
+  bool read_u64(uint64_t& val);
+};
+
+/** input read from a file descriptor; tied is flushed before blocking on it */
+class FdInput: public Input {
+private:
+  int fd;
+  vector<char> buffer;
+  Output* tied;
+
+protected:
+  bool refill() override;
+
+public:
+  explicit FdInput(int _fd, Output* _tied = nullptr);
+};
+
+/** input held in memory, which must outlive it */
+class MemoryInput: public Input {
+protected:
+  bool refill() override;
+
+public:
+  explicit MemoryInput(string_view data);
+};
+
+/** input pulled from a callback, which fills up to size bytes of buf and returns how many, 0 at the end */
+class CallbackInput: public Input {
+private:
+  function<size_t(char* buf, size_t size)> read;
+  vector<char> buffer;
+
+protected:
+  bool refill() override;
+
+public:
+  explicit CallbackInput(function<size_t(char* buf, size_t size)> _read);
+};
+
+
+/** buffered sink of the write function, only written out when full or flushed */
+class Output {
+private:
+  vector<char> buffer;
+  size_t length;
+
+protected:
+  virtual void write_out(const char* data, size_t size) = 0;
+
+public:
+  Output();
+  virtual ~Output();
+  Output(const Output&) = delete;
+  Output& operator=(const Output&) = delete;
+
+  /** val in decimal */
+  void write_u64(uint64_t val);
+  /** val in decimal, followed by a newline */
+  void write_line(uint64_t val);
+  /** val with 4 decimals, as fixed << setprecision(4) prints it */
+  void write_fixed(double val);
+  void write_str(string_view str);
+  void flush();
+};
+
+/** output written to a file descriptor; after a failed write the rest is dropped */
+class FdOutput: public Output {
+private:
+  int fd;
+  bool owned;
+  int error;
+
+protected:
+  void write_out(const char* data, size_t size) override;
+
+public:
+  explicit FdOutput(int _fd);
+  /** creates or truncates filename */
+  explicit FdOutput(const string& filename);
+  ~FdOutput() override;
+
+  bool is_open() const;
+  /** errno of the failed open or write, 0 if there was none */
+  int get_error() const;
+  /** flushes, then "cannot write <name>: <reason>" if anything was lost, empty otherwise */
+  string check(const string& name);
+};
+
+/** output kept in memory */
+class StringOutput: public Output {
+private:
+  string data;
+
+protected:
+  void write_out(const char* _data, size_t size) override;
+
+public:
+  StringOutput();
+  /** what was written and flushed so far */
+  const string& get_str() const;
+};
+
+/** output pushed to a callback as the buffer fills and on flush */
+class CallbackOutput: public Output {
+private:
+  function<void(const char* data, size_t size)> write;
+
+protected:
+  void write_out(const char* data, size_t size) override;
+
+public:
+  explicit CallbackOutput(function<void(const char* data, size_t size)> _write);
+};
+
+
+/** fd 0 and fd 1, flushed at exit */
+Input& std_input();
+FdOutput& std_output();
+
+#endif //SWPP_ASM_INTERPRETER_IO_H
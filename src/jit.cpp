@@ -0,0 +1,471 @@
+#include <cstddef>
+#include <cstring>
+
+#include "jit.h"
+#include "x64code.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_NATIVE
+#include <sys/mman.h>
+#endif
+
+
+#ifdef JIT_NATIVE
+
+// native code keeps the JitFrame in rbx and the register values in r13
+#define FRAME_REG RBX
+#define REGS_REG R13
+
+static uint64_t exit_code(JitExit exit, uint32_t pc) {
+  return (uint64_t)exit << 32 | pc;
+}
+
+static uint64_t double_bits(double val) {
+  uint64_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return bits;
+}
+
+static uint64_t lookup_switch(const BcSwitch* table, uint64_t val) {
+  return table->lookup(val);
+}
+
+/** copies code to executable memory; nullptr if there is none */
+static uint8_t* place_code(const vector<uint8_t>& code) {
+  void* mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return nullptr;
+  memcpy(mem, code.data(), code.size());
+  if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, code.size());
+    return nullptr;
+  }
+  return (uint8_t*)mem;
+}
+
+/** what insn runs, seeing through the FusedOpcode of the first instruction of a sequence */
+static uint8_t base_opcode(const Insn& insn) {
+  if (insn.opcode < LEN_OPCODE || insn.opcode == Checked)
+    return insn.opcode;
+  return insn.stmt->get_opcode();
+}
+
+static bool starts_segment(const Insn* code, uint32_t pc, uint32_t begin) {
+  if (pc == begin)
+    return true;
+  uint8_t prev = code[pc - 1].stmt->get_opcode();
+  return prev == Ret || prev == BrUncond || prev == BrCond || prev == Switch || prev == Call;
+}
+
+/** as Bytecode::is_valid_read; terminators keep the checks of RegFile, which native code does not do */
+static bool is_valid_read(const Operand& op, int nargs) {
+  return !op.is_reg || (op.reg != RegNone && !((int)A1 + nargs <= op.reg && op.reg <= A16));
+}
+
+static void emit_exit(X64Code& x, uint32_t exit, JitExit why, uint32_t pc) {
+  x.mov_imm(RAX, exit_code(why, pc));
+  x.jmp(exit);
+}
+
+/** double [base + disp] += val, with the same rounding as in the interpreter */
+static void emit_add_double(X64Code& x, X64Reg base, int32_t disp, double val) {
+  x.movsd_load(XMM0, base, disp);
+  x.mov_imm(RCX, double_bits(val));
+  x.movq_to_xmm(XMM1, RCX);
+  x.addsd(XMM0, XMM1);
+  x.movsd_store(base, disp, XMM0);
+}
+
+/** State::bc_enter */
+static void emit_count_segment(X64Code& x, const JitRuntime& runtime, const Bytecode& bytecode,
+                               const BcSegment& segment) {
+  x.mov_imm(RAX, (uint64_t)runtime.executed);
+  x.alu_mem_imm(AluAdd, RAX, 0, segment.ninsts);
+  const BcOpCount* counts = bytecode.get_op_counts() + segment.first_count;
+  for (uint32_t i = 0; i < segment.ncounts; i++) {
+    x.mov_imm(RAX, (uint64_t)(runtime.inst_count + counts[i].opcode));
+    x.alu_mem_imm(AluAdd, RAX, 0, counts[i].count);
+  }
+}
+
+/** State::bc_charge without waiting, as adding a wait cost of 0 changes no bits; clobbers rax and rcx */
+static void emit_charge(X64Code& x, const JitRuntime& runtime, Opcode opcode, double inst_cost) {
+  emit_add_double(x, FRAME_REG, offsetof(JitFrame, frame_cost), inst_cost);
+  x.mov_imm(RAX, (uint64_t)(runtime.cost_per_inst + opcode));
+  emit_add_double(x, RAX, 0, inst_cost);
+}
+
+/**
+ * CHECK_BUDGET of the transfer at line to target, or to the instruction in
+ * rdx if target is UINT32_MAX; keeps rdx
+ */
+static void emit_check_budget(X64Code& x, const JitRuntime& runtime, uint32_t exit, int line, uint32_t target) {
+  uint32_t over = x.new_label();
+  uint32_t ok = x.new_label();
+  x.mov_imm(RAX, (uint64_t)runtime.executed);
+  x.mov_load(RAX, RAX, 0);
+  x.mov_imm(RCX, (uint64_t)runtime.inst_limit);
+  x.mov_load(RCX, RCX, 0);
+  x.alu(AluCmp, RAX, RCX);
+  x.jcc(CondA, over);
+  x.movsd_load(XMM0, FRAME_REG, offsetof(JitFrame, base_cost));
+  x.movsd_load(XMM1, FRAME_REG, offsetof(JitFrame, frame_cost));
+  x.addsd(XMM0, XMM1);
+  x.mov_imm(RAX, (uint64_t)runtime.cost_limit);
+  x.movsd_load(XMM1, RAX, 0);
+  x.ucomisd(XMM0, XMM1);
+  // also when unordered, as > is false for NaN
+  x.jcc(CondBE, ok);
+  x.bind(over);
+  x.mov_imm(RAX, line);
+  x.mov_store(FRAME_REG, offsetof(JitFrame, line), RAX);
+  if (target != UINT32_MAX)
+    emit_exit(x, exit, JitExitBudget, target);
+  else {
+    x.mov_imm(RAX, exit_code(JitExitBudget, 0));
+    x.alu(AluOr, RAX, RDX);
+    x.jmp(exit);
+  }
+  x.bind(ok);
+}
+
+static void emit_read(X64Code& x, X64Reg dst, const Operand& op) {
+  if (op.is_reg)
+    x.mov_load(dst, REGS_REG, op.reg * sizeof(uint64_t));
+  else
+    x.mov_imm(dst, op.imm);
+}
+
+/** RegFile::write_valid_reg of rax, which skips the wait as no register waits in native code */
+static void emit_write(X64Code& x, const JitRuntime& runtime, Reg lhs) {
+  if (lhs == RegNone)
+    return;
+  uint32_t dirty = x.new_label();
+  uint32_t done = x.new_label();
+  x.mov_imm(RCX, (uint64_t)runtime.dirty);
+  x.bt_mem(RCX, 0, lhs);
+  x.jcc(CondB, dirty);
+  // the first write in the call saves the register of the caller
+  x.mov_reg(RDX, RAX);
+  x.mov_reg(RDI, FRAME_REG);
+  x.mov_imm(RSI, lhs);
+  x.mov_imm(RAX, (uint64_t)runtime.write);
+  x.call_reg(RAX);
+  x.jmp(done);
+  x.bind(dirty);
+  x.mov_store(REGS_REG, lhs * sizeof(uint64_t), RAX);
+  x.bind(done);
+}
+
+static void emit_call(X64Code& x, uint32_t exit, JitCall call, const Insn* insn, uint32_t pc) {
+  uint32_t ok = x.new_label();
+  x.mov_reg(RDI, FRAME_REG);
+  x.mov_imm(RSI, (uint64_t)insn);
+  x.mov_imm(RAX, (uint64_t)call);
+  x.call_reg(RAX);
+  x.test32(RAX, RAX);
+  x.jcc(CondE, ok);
+  emit_exit(x, exit, JitExitError, pc);
+  x.bind(ok);
+}
+
+static bool is_signed_kind(BopKind bop_kind) {
+  return bop_kind == Ashr || bop_kind == Sdiv || bop_kind == Srem ||
+         bop_kind == Sgt || bop_kind == Sge || bop_kind == Slt || bop_kind == Sle;
+}
+
+/** bop in arith.cpp, from rax and rcx to rax; false for divisions, which can throw */
+static bool emit_bop(X64Code& x, BopKind bop_kind, Size size) {
+  int bits = bw_of(size);
+  switch (bop_kind) {
+    case Add: x.alu(AluAdd, RAX, RCX); break;
+    case Sub: x.alu(AluSub, RAX, RCX); break;
+    case And: x.alu(AluAnd, RAX, RCX); break;
+    case Or: x.alu(AluOr, RAX, RCX); break;
+    case Xor: x.alu(AluXor, RAX, RCX); break;
+    case Mul: x.imul(RAX, RCX); break;
+    case Shl:
+    case Lshr:
+    case Ashr:
+      if (bop_kind == Lshr)
+        x.zero_extend(RAX, bits);
+      else if (bop_kind == Ashr)
+        x.sign_extend(RAX, bits);
+      // bits is a power of two
+      x.alu_imm(AluAnd, RCX, bits - 1);
+      x.shift_cl(bop_kind == Shl ? ShiftShl : bop_kind == Lshr ? ShiftShr : ShiftSar, RAX);
+      break;
+    case Eq: case Ne: case Ugt: case Uge: case Ult: case Ule:
+    case Sgt: case Sge: case Slt: case Sle: {
+      if (is_signed_kind(bop_kind)) {
+        x.sign_extend(RAX, bits);
+        x.sign_extend(RCX, bits);
+      }
+      else {
+        x.zero_extend(RAX, bits);
+        x.zero_extend(RCX, bits);
+      }
+      x.alu(AluCmp, RAX, RCX);
+      X64Cond cond;
+      switch (bop_kind) {
+        case Eq: cond = CondE; break;
+        case Ne: cond = CondNE; break;
+        case Ugt: cond = CondA; break;
+        case Uge: cond = CondAE; break;
+        case Ult: cond = CondB; break;
+        case Ule: cond = CondBE; break;
+        case Sgt: cond = CondG; break;
+        case Sge: cond = CondGE; break;
+        case Slt: cond = CondL; break;
+        default: cond = CondLE; break;
+      }
+      x.set_cond(cond, RAX);
+      return true;
+    }
+    default:
+      return false;
+  }
+  x.zero_extend(RAX, bits);
+  return true;
+}
+
+/**
+ * native code of the straight-line insn at pc; false if the interpreter runs it,
+ * in which case the rest of its segment is left to the interpreter too
+ */
+static bool emit_insn(X64Code& x, const JitRuntime& runtime, const Bytecode& bytecode, uint32_t exit,
+                      const Insn& insn, uint32_t pc) {
+  switch (base_opcode(insn)) {
+    case Bop:
+      emit_read(x, RAX, insn.op1);
+      emit_read(x, RCX, insn.op2);
+      // the runtime call charges it
+      if (!emit_bop(x, insn.bop_kind, insn.size)) {
+        emit_call(x, exit, runtime.bop, &insn, pc);
+        return true;
+      }
+      emit_write(x, runtime, insn.lhs);
+      emit_charge(x, runtime, Bop, cost_of(insn.bop_kind));
+      return true;
+    case Uop:
+      emit_read(x, RAX, insn.op1);
+      x.alu_imm(insn.uop_kind == Incr ? AluAdd : AluSub, RAX, 1);
+      x.zero_extend(RAX, bw_of(insn.size));
+      emit_write(x, runtime, insn.lhs);
+      emit_charge(x, runtime, Uop, Cost::UOP);
+      return true;
+    case Sum: {
+      const Operand* operands = bytecode.get_operands() + insn.target1;
+      x.mov_imm(RAX, 0);
+      for (uint32_t i = 0; i < insn.nops; i++) {
+        emit_read(x, RCX, operands[i]);
+        x.alu(AluAdd, RAX, RCX);
+      }
+      emit_write(x, runtime, insn.lhs);
+      emit_charge(x, runtime, Sum, Cost::SUM);
+      return true;
+    }
+    case Select:
+      emit_read(x, RAX, insn.op1);
+      emit_read(x, RCX, insn.op2);
+      emit_read(x, RDX, insn.op3);
+      x.test(RAX, RAX);
+      x.cmov(CondE, RCX, RDX);
+      x.mov_reg(RAX, RCX);
+      emit_write(x, runtime, insn.lhs);
+      emit_charge(x, runtime, Select, Cost::TERNARY);
+      return true;
+    case Assert: {
+      // a failing assertion runs again in the interpreter, which reports it
+      uint32_t ok = x.new_label();
+      emit_read(x, RAX, insn.op1);
+      emit_read(x, RCX, insn.op2);
+      x.alu(AluCmp, RAX, RCX);
+      x.jcc(CondE, ok);
+      emit_exit(x, exit, JitExitInterpret, pc);
+      x.bind(ok);
+      emit_charge(x, runtime, Assert, Cost::ASSERT);
+      return true;
+    }
+    case Load:
+      // an aload makes its register wait
+      if (insn.is_async)
+        return false;
+      emit_call(x, exit, runtime.load, &insn, pc);
+      return true;
+    case Store:
+      emit_call(x, exit, runtime.store, &insn, pc);
+      return true;
+    case Malloc:
+      emit_call(x, exit, runtime.malloc, &insn, pc);
+      return true;
+    case Free:
+      emit_call(x, exit, runtime.free, &insn, pc);
+      return true;
+    default:
+      return false;
+  }
+}
+
+#endif
+
+Jit::Jit(const Bytecode& _bytecode, const JitRuntime& _runtime):
+bytecode(_bytecode), runtime(_runtime), error(), frame{0, 0, _runtime.state, &error, 0}, functions(), function_of(),
+trampoline(nullptr), trampoline_size(0), epilogue(nullptr) {
+  function_of.resize(bytecode.get_code_size());
+  for (uint32_t i = 0; i < bytecode.get_num_functions(); i++) {
+    const BcFunction& f = bytecode.get_function(i);
+    // main is first entered without arguments, whatever it declares
+    int nargs = i == bytecode.get_main_function() ? 0 : f.nargs;
+    functions.push_back(JitFunction{f.begin, f.end, nargs, 0, false, nullptr, 0, {}, {}});
+    for (uint32_t pc = f.begin; pc < f.end; pc++)
+      function_of[pc] = i;
+  }
+
+#ifdef JIT_NATIVE
+  // enter(JitFrame* frame, const void* target) keeps the stack aligned for runtime calls
+  X64Code x;
+  x.push(FRAME_REG);
+  x.push(REGS_REG);
+  x.alu_imm(AluSub, RSP, 8);
+  x.mov_reg(FRAME_REG, RDI);
+  x.mov_imm(REGS_REG, (uint64_t)runtime.regs);
+  x.jmp_reg(RSI);
+  size_t epilogue_offset = x.size();
+  x.alu_imm(AluAdd, RSP, 8);
+  x.pop(REGS_REG);
+  x.pop(FRAME_REG);
+  x.ret();
+
+  const vector<uint8_t>& code = x.finish();
+  trampoline = place_code(code);
+  if (trampoline != nullptr) {
+    trampoline_size = code.size();
+    epilogue = trampoline + epilogue_offset;
+  }
+#endif
+}
+
+Jit::~Jit() {
+#ifdef JIT_NATIVE
+  for (auto& function: functions) {
+    if (function.code != nullptr)
+      munmap(function.code, function.size);
+  }
+  if (trampoline != nullptr)
+    munmap(trampoline, trampoline_size);
+#endif
+}
+
+bool Jit::is_supported() {
+#ifdef JIT_NATIVE
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Jit::compile(JitFunction& function) {
+  function.compiled = true;
+#ifdef JIT_NATIVE
+  if (trampoline == nullptr)
+    return;
+
+  const Insn* code = bytecode.get_code();
+  uint32_t begin = function.begin;
+  uint32_t n = function.end - begin;
+  X64Code x;
+  uint32_t exit = x.new_label();
+  vector<uint32_t> body(n, UINT32_MAX), entry(n, UINT32_MAX);
+  for (uint32_t i = 0; i < n; i++) {
+    if (starts_segment(code, begin + i, begin)) {
+      body[i] = x.new_label();
+      entry[i] = x.new_label();
+    }
+  }
+  // the switch tables jump through entry, which must not move
+  function.entry.assign(n, nullptr);
+  function.body.assign(n, nullptr);
+
+  for (uint32_t s = 0; s < n; s++) {
+    if (body[s] == UINT32_MAX)
+      continue;
+    x.bind(entry[s]);
+    emit_count_segment(x, runtime, bytecode, bytecode.get_segments()[code[begin + s].segment]);
+    x.bind(body[s]);
+
+    for (uint32_t pc = begin + s;; pc++) {
+      const Insn& insn = code[pc];
+      uint8_t opcode = base_opcode(insn);
+      if (opcode == BrUncond) {
+        emit_charge(x, runtime, BrUncond, Cost::BRUNCOND);
+        emit_check_budget(x, runtime, exit, insn.line, insn.target1);
+        x.jmp(entry[insn.target1 - begin]);
+        break;
+      }
+      if (opcode == BrCond && is_valid_read(insn.op1, function.nargs)) {
+        uint32_t not_taken = x.new_label();
+        emit_read(x, RAX, insn.op1);
+        x.test(RAX, RAX);
+        x.jcc(CondE, not_taken);
+        emit_charge(x, runtime, BrCond, Cost::BRCOND_TRUE);
+        emit_check_budget(x, runtime, exit, insn.line, insn.target1);
+        x.jmp(entry[insn.target1 - begin]);
+        x.bind(not_taken);
+        emit_charge(x, runtime, BrCond, Cost::BRCOND_FALSE);
+        emit_check_budget(x, runtime, exit, insn.line, insn.target2);
+        x.jmp(entry[insn.target2 - begin]);
+        break;
+      }
+      if (opcode == Switch && is_valid_read(insn.op1, function.nargs)) {
+        emit_read(x, RSI, insn.op1);
+        x.mov_imm(RDI, (uint64_t)&bytecode.get_switch(insn.target1));
+        x.mov_imm(RAX, (uint64_t)lookup_switch);
+        x.call_reg(RAX);
+        x.mov_reg(RDX, RAX);
+        emit_charge(x, runtime, Switch, Cost::SWITCH);
+        emit_check_budget(x, runtime, exit, insn.line, UINT32_MAX);
+        x.alu_imm(AluSub, RDX, begin);
+        x.mov_imm(RCX, (uint64_t)function.entry.data());
+        x.jmp_table(RCX, RDX);
+        break;
+      }
+      if (!emit_insn(x, runtime, bytecode, exit, insn, pc)) {
+        emit_exit(x, exit, JitExitInterpret, pc);
+        break;
+      }
+    }
+  }
+
+  x.bind(exit);
+  x.mov_imm(RCX, (uint64_t)epilogue);
+  x.jmp_reg(RCX);
+
+  const vector<uint8_t>& bytes = x.finish();
+  function.code = place_code(bytes);
+  if (function.code == nullptr)
+    return;
+  function.size = bytes.size();
+  for (uint32_t i = 0; i < n; i++) {
+    if (body[i] != UINT32_MAX) {
+      function.body[i] = function.code + x.label_offset(body[i]);
+      function.entry[i] = function.code + x.label_offset(entry[i]);
+    }
+  }
+#endif
+}
+
+uint64_t Jit::run(const void* target, double& frame_cost, double base_cost) {
+  typedef uint64_t (*Enter)(JitFrame* frame, const void* target);
+  frame.frame_cost = frame_cost;
+  frame.base_cost = base_cost;
+  uint64_t exit = ((Enter)(void*)trampoline)(&frame, target);
+  frame_cost = frame.frame_cost;
+  return exit;
+}
+
+exception_ptr Jit::take_error() {
+  exception_ptr e = error;
+  error = nullptr;
+  return e;
+}
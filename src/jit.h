@@ -0,0 +1,133 @@
+#ifndef SWPP_ASM_INTERPRETER_JIT_H
+#define SWPP_ASM_INTERPRETER_JIT_H
+
+#include <cinttypes>
+#include <exception>
+#include <vector>
+
+#include "bytecode.h"
+
+using namespace std;
+
+
+// a function is compiled once it has made this many calls and back-edges
+#define JIT_THRESHOLD 1000
+
+/** why native code returned to the interpreter, in the upper half of what it returns */
+enum JitExit {
+  // run the instruction in the interpreter; its segment is counted
+  JitExitInterpret = 0,
+  // CHECK_BUDGET stopped the transfer to the instruction, whose segment is not counted yet
+  JitExitBudget,
+  // a runtime call threw, at the instruction
+  JitExitError
+};
+
+/** the locals of the interpreter that native code works on */
+struct JitFrame {
+  double frame_cost;
+  double base_cost;
+  void* state;
+  exception_ptr* error;
+  // the line of the transfer of JitExitBudget
+  int64_t line;
+};
+
+/**
+ * a runtime call of native code, which cannot unwind: 0 on success, and
+ * otherwise the exception is in *frame->error
+ */
+typedef int (*JitCall)(JitFrame* frame, const Insn* insn);
+typedef void (*JitWrite)(JitFrame* frame, uint64_t reg, uint64_t val);
+
+/** where native code finds the state of the interpreter, and how it calls back */
+struct JitRuntime {
+  void* state;
+  uint64_t* regs;
+  const uint64_t* dirty;
+  uint64_t* executed;
+  const uint64_t* inst_limit;
+  // re-read at every check, since it also stops at the next sample
+  const double* cost_limit;
+  uint64_t* inst_count;
+  double* cost_per_inst;
+  // sync loads, stores, memory allocation and divisions, as in the interpreter
+  JitCall load;
+  JitCall store;
+  JitCall malloc;
+  JitCall free;
+  JitCall bop;
+  // write_valid_reg, for the first write of a register in a call
+  JitWrite write;
+  uint64_t threshold;
+};
+
+struct JitFunction {
+  uint32_t begin;
+  uint32_t end;
+  int nargs;
+  uint64_t hotness;
+  bool compiled;
+  uint8_t* code;
+  size_t size;
+  // by instruction from begin, native code of the segments that start there,
+  // after and before charging the segment; nullptr elsewhere
+  vector<const void*> body;
+  vector<const void*> entry;
+};
+
+/**
+ * template JIT of the bytecode: once a function is hot, its segments are
+ * stitched from native code per opcode that accesses the registers in RegFile
+ * and charges costs exactly as the interpreter does; native code runs while no
+ * register waits for an aload, and returns to the interpreter for calls,
+ * returns, I/O, aloads and checked instructions
+ */
+class Jit {
+private:
+  const Bytecode& bytecode;
+  JitRuntime runtime;
+  exception_ptr error;
+  JitFrame frame;
+  vector<JitFunction> functions;
+  // the function of each instruction
+  vector<uint32_t> function_of;
+  // saves the registers that native code pins, and restores them on exit
+  uint8_t* trampoline;
+  size_t trampoline_size;
+  const void* epilogue;
+
+  void compile(JitFunction& function);
+
+public:
+  Jit(const Bytecode& _bytecode, const JitRuntime& _runtime);
+  ~Jit();
+
+  /** whether native code can run on this platform; the interpreter runs everything otherwise */
+  static bool is_supported();
+
+  /**
+   * native code for the segment at pc, which the interpreter has counted, or
+   * nullptr; hot counts a call or a back-edge of its function
+   */
+  const void* enter(uint32_t pc, bool hot) {
+    JitFunction& function = functions[function_of[pc]];
+    if (!function.compiled) {
+      if (!hot || ++function.hotness < runtime.threshold)
+        return nullptr;
+      compile(function);
+    }
+    return function.body[pc - function.begin];
+  }
+
+  /** runs native code from target; returns the JitExit above the index of the instruction it stopped at */
+  uint64_t run(const void* target, double& frame_cost, double base_cost);
+
+  /** the exception of JitExitError */
+  exception_ptr take_error();
+
+  /** the line of the last JitExitBudget */
+  int get_exit_line() const { return (int)frame.line; }
+};
+
+#endif //SWPP_ASM_INTERPRETER_JIT_H
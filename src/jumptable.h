@@ -0,0 +1,69 @@
+#ifndef SWPP_ASM_INTERPRETER_JUMPTABLE_H
+#define SWPP_ASM_INTERPRETER_JUMPTABLE_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+
+// a case range is dense if it has at most this many slots per case, or is tiny
+#define JUMP_TABLE_DENSITY 4
+#define JUMP_TABLE_MIN_SLOTS 16
+
+/**
+ * targets of a switch by case value: an array over the case range when it is
+ * compact, and sorted arrays searched by bisection otherwise
+ */
+template <typename T>
+class JumpTable {
+private:
+  uint64_t base;
+  // dense[val - base], with default_target in the gaps; empty if sparse
+  vector<T> dense;
+  vector<uint64_t> keys;
+  vector<T> targets;
+  T default_target;
+
+public:
+  JumpTable(): base(0), dense(), keys(), targets(), default_target() {}
+
+  JumpTable(const map<uint64_t, T>& cases, T _default_target):
+  base(0), dense(), keys(), targets(), default_target(_default_target) {
+    if (cases.empty())
+      return;
+
+    base = cases.begin()->first;
+    uint64_t range = cases.rbegin()->first - base;
+    if (range < max<uint64_t>(cases.size() * JUMP_TABLE_DENSITY, JUMP_TABLE_MIN_SLOTS)) {
+      dense.assign(range + 1, default_target);
+      for (auto& it: cases)
+        dense[it.first - base] = it.second;
+      return;
+    }
+
+    keys.reserve(cases.size());
+    targets.reserve(cases.size());
+    for (auto& it: cases) {
+      keys.push_back(it.first);
+      targets.push_back(it.second);
+    }
+  }
+
+  T lookup(uint64_t val) const {
+    if (!dense.empty()) {
+      // wraps around for values below base
+      uint64_t idx = val - base;
+      return idx < dense.size() ? dense[idx] : default_target;
+    }
+
+    auto it = lower_bound(keys.begin(), keys.end(), val);
+    if (it == keys.end() || *it != val)
+      return default_target;
+    return targets[it - keys.begin()];
+  }
+};
+
+#endif //SWPP_ASM_INTERPRETER_JUMPTABLE_H
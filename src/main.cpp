@@ -1,52 +1,216 @@
 #include <iostream>
-#include <fstream>
-#include <iomanip>
+#include <thread>
+#include <vector>
 
 #include "parser.h"
+#include "cache.h"
+#include "batch.h"
+#include "io.h"
 #include "state.h"
 #include "error.h"
 
 using namespace std;
 
 
+bool parse_option(const string& arg, uint64_t& value) {
+  string val = arg.substr(arg.find('=') + 1);
+  if (val.empty() || val.find_first_not_of("0123456789") != string::npos)
+    return false;
+  try {
+    value = stoull(val);
+    return true;
+  } catch (exception& e) {
+    return false;
+  }
+}
+
+bool parse_option(const string& arg, double& value) {
+  string val = arg.substr(arg.find('=') + 1);
+  if (val.empty() || val.find_first_not_of("0123456789.") != string::npos)
+    return false;
+  try {
+    size_t end;
+    value = stod(val, &end);
+    return end == val.length();
+  } catch (exception& e) {
+    return false;
+  }
+}
+
+/** status, or EXIT_FAILURE after reporting the errors of the output and the logs if there were any */
+int exit_status(int status, const string& output_error, const string& log_error) {
+  for (const string& error: {output_error, log_error}) {
+    if (!error.empty()) {
+      cerr << "Error: " << error << endl;
+      status = EXIT_FAILURE;
+    }
+  }
+  return status;
+}
+
+void print_usage() {
+  cout << "USAGE: sf-interpreter [options] <input assembly file>" << endl;
+  cout << "       sf-interpreter [options] --batch <input assembly file> <input file>..." << endl;
+  cout << "Options:" << endl;
+  cout << "  --engine=tree       execute statements directly (default)" << endl;
+  cout << "  --engine=bytecode   lower the program to bytecode before execution" << endl;
+  cout << "  --jit               with --engine=bytecode, compile hot functions to native code on x86-64 Linux" << endl;
+  cout << "  --jit-threshold=N   compile a function after N calls and loop iterations (default " << JIT_THRESHOLD << ")" << endl;
+  cout << "  --max-call-depth=N  abort when more than N calls are active (default: unlimited)" << endl;
+  cout << "  --cost-tree=context merge repeated calls along the same call path in the cost log (default)" << endl;
+  cout << "  --cost-tree=calls   log every call separately" << endl;
+  cout << "  --cost-log=text     write sf-interpreter-cost.log (default)" << endl;
+  cout << "  --cost-log=jsonl    write sf-interpreter-cost.jsonl, one JSON object per line" << endl;
+  cout << "  --max-insts=N       stop after executing more than N instructions" << endl;
+  cout << "  --max-cost=C        stop once the execution cost exceeds C" << endl;
+  cout << "                      a stopped run still writes its logs and exits with status " << EXIT_BUDGET_EXCEEDED << endl;
+  cout << "  --profile           also write sf-interpreter-profile.log and sf-interpreter-stacks.txt" << endl;
+  cout << "  --heap-profile      also write sf-interpreter-heap.log, the heap usage by malloc site" << endl;
+  cout << "                      and what each site held when the usage was at its maximum" << endl;
+  cout << "  --aload-report      also write sf-interpreter-aload.log, the loads that aload would speed up" << endl;
+  cout << "  --sample=N          also write sf-interpreter-samples.bin, the call chain every N units of cost;" << endl;
+  cout << "                      sf-samples converts it to collapsed stacks or a pprof profile" << endl;
+  cout << "  --cache             reuse the parsed program from <input>.sfbc, writing it if stale" << endl;
+  cout << "  --cache-dir=DIR     as --cache, but keep the cache files in DIR" << endl;
+  cout << "  --batch             run the program once per input file, writing <input file>.stdout and" << endl;
+  cout << "                      <input file>.sf-interpreter*.log" << endl;
+  cout << "  --jobs=N            number of worker threads of parsing and of --batch (default: number of cores)" << endl;
+  cout << "  --snapshot          with --batch, run the program once up to its first read and fork a" << endl;
+  cout << "                      process per input file from there, up to N at a time" << endl;
+}
+
 int main(int argc, char** argv) {
-  if (argc != 2) {
-    cout << "USAGE: sf-interpreter <input assembly file>" << endl;
-    return 1;
+  string filename;
+  bool use_bytecode = false;
+  ExecOptions options;
+  bool use_cache = false;
+  string cache_dir;
+  bool use_batch = false;
+  bool use_snapshot = false;
+  uint64_t jobs = thread::hardware_concurrency();
+  vector<string> inputs;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--engine=tree")
+      use_bytecode = false;
+    else if (arg == "--engine=bytecode")
+      use_bytecode = true;
+    else if (arg == "--jit")
+      options.jit = true;
+    else if (arg.rfind("--jit-threshold=", 0) == 0 && parse_option(arg, options.jit_threshold) &&
+             options.jit_threshold > 0)
+      continue;
+    else if (arg.rfind("--max-call-depth=", 0) == 0 && parse_option(arg, options.max_call_depth))
+      continue;
+    else if (arg.rfind("--max-insts=", 0) == 0 && parse_option(arg, options.max_insts))
+      continue;
+    else if (arg.rfind("--max-cost=", 0) == 0 && parse_option(arg, options.max_cost))
+      continue;
+    else if (arg == "--cost-tree=context")
+      options.cost_tree_mode = CostTreeContext;
+    else if (arg == "--cost-tree=calls")
+      options.cost_tree_mode = CostTreeCalls;
+    else if (arg == "--cost-log=text")
+      options.cost_log_format = CostLogText;
+    else if (arg == "--cost-log=jsonl")
+      options.cost_log_format = CostLogJsonLines;
+    else if (arg == "--profile")
+      options.profile = true;
+    else if (arg == "--heap-profile")
+      options.heap_profile = true;
+    else if (arg == "--aload-report")
+      options.aload_report = true;
+    else if (arg.rfind("--sample=", 0) == 0 && parse_option(arg, options.sample_period) &&
+             options.sample_period > 0)
+      continue;
+    else if (arg == "--cache")
+      use_cache = true;
+    else if (arg.rfind("--cache-dir=", 0) == 0 && arg.length() > 12) {
+      use_cache = true;
+      cache_dir = arg.substr(12);
+    }
+    else if (arg == "--batch")
+      use_batch = true;
+    else if (arg == "--snapshot")
+      use_snapshot = true;
+    else if (arg.rfind("--jobs=", 0) == 0 && parse_option(arg, jobs) && jobs > 0)
+      continue;
+    else if (arg.rfind("--", 0) != 0 && filename.empty())
+      filename = arg;
+    else if (arg.rfind("--", 0) != 0)
+      inputs.push_back(arg);
+    else {
+      print_usage();
+      return 1;
+    }
   }
 
-  string filename = argv[1];
-  error_filename = filename;
+  if (filename.empty() || (!use_batch && (!inputs.empty() || use_snapshot)) || (options.jit && !use_bytecode)) {
+    print_usage();
+    return 1;
+  }
 
-  Program* program = parse(filename);
+  Program* program;
+  try {
+    program = use_cache ? parse_cached(filename, cache_dir, jobs) : parse(filename, jobs);
+  } catch (SyntaxError& e) {
+    cout << e.what() << endl;
+    return EXIT_FAILURE;
+  }
   if (program == nullptr) {
     cout << "Error: cannot find " << filename << endl;
     return 1;
   }
 
+  if (use_batch) {
+    Bytecode* bytecode = use_bytecode ? new Bytecode(program) : nullptr;
+    Batch batch(program, bytecode, options);
+    for (auto& input: inputs)
+      batch.add_input(input);
+    if (use_snapshot)
+      batch.run_from_snapshot(jobs);
+    else
+      batch.run(jobs);
+
+    int failed = 0, budget_exceeded = 0;
+    for (auto& result: batch.get_results()) {
+      if (result.ok)
+        cout << result.input << ": returned " << result.ret << endl;
+      else {
+        cout << result.input << ": " << result.error.substr(0, result.error.find('\n')) << endl;
+        failed++;
+        budget_exceeded += result.budget_exceeded;
+      }
+    }
+    delete bytecode;
+    // a budget stop only when every failure was one, as for a single run
+    if (failed == 0)
+      return 0;
+    return budget_exceeded == failed ? EXIT_BUDGET_EXCEEDED : EXIT_FAILURE;
+  }
+
   State state;
   state.set_program(program);
-  uint64_t ret = state.exec_program();
-
-  ofstream log("sf-interpreter.log");
-  double exec_cost = state.get_cost_value();
-  double max_heap_size = state.get_max_alloced_size();
-  log << fixed << setprecision(4);
-  log << "Returned: " << ret << endl;
-  log << "Execution cost: " << exec_cost << endl;
-  log << "Max heap usage (bytes): " << max_heap_size << endl;
-  log << "Total cost: " << exec_cost + max_heap_size * 16.0 << endl;
-  log.close();
-
-  ofstream cost_log("sf-interpreter-cost.log");
-  cost_log << fixed << setprecision(4);
-  cost_log << "Total waiting cost: " << state.get_total_wait_cost() << endl;
-  cost_log << state.get_cost()->to_string("");
-  cost_log.close();
-
-  ofstream inst_log("sf-interpreter-inst.log");
-  inst_log << state.inst_log_to_string();
-  inst_log.close();
-
-  return 0;
+  state.set_options(options);
+  uint64_t ret;
+  try {
+    if (use_bytecode) {
+      Bytecode bytecode(program);
+      ret = state.exec_bytecode(bytecode);
+    }
+    else
+      ret = state.exec_program();
+  } catch (BudgetExceeded& e) {
+    string output_error = std_output().check("the standard output");
+    cout << e.what() << endl;
+    return exit_status(EXIT_BUDGET_EXCEEDED, output_error, state.write_logs(0, ""));
+  } catch (ExecutionError& e) {
+    string output_error = std_output().check("the standard output");
+    cout << e.what() << endl;
+    return exit_status(EXIT_FAILURE, output_error, "");
+  }
+  string output_error = std_output().check("the standard output");
+
+  return exit_status(0, output_error, state.write_logs(ret, ""));
 }
@@ -0,0 +1,44 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mappedfile.h"
+
+
+MappedFile::MappedFile(const string& filename):
+fd(open(filename.c_str(), O_RDONLY)), mapped(MAP_FAILED), length(0), buffer() {
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    length = st.st_size;
+    mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      madvise(mapped, length, MADV_SEQUENTIAL);
+      return;
+    }
+  }
+
+  // not mappable, e.g. a pipe
+  char chunk[1 << 16];
+  ssize_t n;
+  while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+    buffer.append(chunk, n);
+}
+
+MappedFile::~MappedFile() {
+  if (mapped != MAP_FAILED)
+    munmap(mapped, length);
+  if (fd >= 0)
+    close(fd);
+}
+
+bool MappedFile::is_open() const { return fd >= 0; }
+
+string_view MappedFile::contents() const {
+  if (mapped != MAP_FAILED)
+    return string_view((const char*)mapped, length);
+  return buffer;
+}
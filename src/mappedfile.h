@@ -0,0 +1,29 @@
+#ifndef SWPP_ASM_INTERPRETER_MAPPEDFILE_H
+#define SWPP_ASM_INTERPRETER_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+
+/** read-only view of a whole file, mapped when possible */
+class MappedFile {
+private:
+  int fd;
+  void* mapped;
+  size_t length;
+  string buffer;
+
+public:
+  explicit MappedFile(const string& filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool is_open() const;
+  string_view contents() const;
+};
+
+#endif //SWPP_ASM_INTERPRETER_MAPPEDFILE_H
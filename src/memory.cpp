@@ -1,33 +1,195 @@
 #include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "error.h"
 #include "opcode.h"
 #include "memory.h"
+#include "heapprofile.h"
 
 
+void* reserve(uint64_t& size) {
+  for (; size >= HEAP_GRANULE * 64; size /= 2) {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr != MAP_FAILED)
+      return ptr;
+  }
+  size = 0;
+  return nullptr;
+}
+
+/** zeroes size bytes of the heap at ptr, leaving the whole pages to the OS if there are many */
+static void zero_heap(uint8_t* ptr, uint64_t size) {
+  static const uintptr_t page = sysconf(_SC_PAGESIZE);
+  if (size >= HEAP_ZERO_BY_OS) {
+    uint8_t* first = (uint8_t*)(((uintptr_t)ptr + page - 1) & ~(page - 1));
+    uint8_t* last = (uint8_t*)((uintptr_t)(ptr + size) & ~(page - 1));
+    // private anonymous pages read as zero after MADV_DONTNEED
+    if (madvise(first, last - first, MADV_DONTNEED) == 0) {
+      memset(ptr, 0, first - ptr);
+      memset(last, 0, ptr + size - last);
+      return;
+    }
+  }
+  memset(ptr, 0, size);
+}
+
+static_assert((STACK_MAX + STACK_PAGE - 1) / STACK_PAGE <= 64, "stack_dirty has a bit per stack page");
+
 Memory::Memory() {
   memset(stack, 0, STACK_MAX);
-  freed.insert(block_t(HEAP_MIN, HEAP_MAX));
+  stack_dirty = 0;
+  memset(free_class_map, 0, sizeof(free_class_map));
+  insert_free(block_t(HEAP_MIN, HEAP_MAX));
   alloced_size = 0;
   max_alloced_size = 0;
+  heap_top = HEAP_MIN;
+  heap_dirty_top = HEAP_MIN;
+  heap_profile = nullptr;
+
+  heap_size = HEAP_RESERVE;
+  heap = (uint8_t*)reserve(heap_size);
+  uint64_t map_size = heap_size / HEAP_GRANULE / 8;
+  heap_map = (uint64_t*)reserve(map_size);
+  if (map_size != heap_size / HEAP_GRANULE / 8) {
+    if (map_size != 0)
+      munmap(heap_map, map_size);
+    if (heap != nullptr)
+      munmap(heap, heap_size);
+    heap = nullptr;
+    heap_map = nullptr;
+    heap_size = 0;
+  }
 }
 
-alloc_t Memory::find_block(uint64_t addr) const {
-  auto lb = alloced.lower_bound(alloc_t(block_t(addr, -1), nullptr));
+Memory::~Memory() {
+  if (heap != nullptr)
+    munmap(heap, heap_size);
+  if (heap_map != nullptr)
+    munmap(heap_map, heap_size / HEAP_GRANULE / 8);
+}
 
-  if (lb == alloced.begin()) {
-    invoke_runtime_error("accessing non-allocated memory");
+void Memory::reset() {
+  for (uint64_t dirty = stack_dirty; dirty != 0; dirty &= dirty - 1) {
+    uint64_t begin = __builtin_ctzll(dirty) * STACK_PAGE;
+    memset(stack + begin, 0, min(STACK_PAGE, STACK_MAX - begin));
+  }
+  stack_dirty = 0;
+
+  // blocks are zeroed when they are allocated, so only the map of the used heap is cleared
+  uint64_t used = heap_top - HEAP_MIN;
+  if (heap_map != nullptr)
+    memset(heap_map, 0, (used / HEAP_GRANULE + 63) / 64 * 8);
+  uint64_t dirty = heap_dirty_top - HEAP_MIN;
+  if (dirty > HEAP_RETAIN) {
+    madvise(heap + HEAP_RETAIN, dirty - HEAP_RETAIN, MADV_DONTNEED);
+    dirty = HEAP_RETAIN;
+  }
+  heap_top = HEAP_MIN;
+  heap_dirty_top = HEAP_MIN + dirty;
+
+  alloced.clear();
+  freed.clear();
+  for (int i = 0; i < NFREE_CLASSES; i++) {
+    if ((free_class_map[i / 64] >> (i % 64)) & 1)
+      free_classes[i].clear();
+  }
+  memset(free_class_map, 0, sizeof(free_class_map));
+  insert_free(block_t(HEAP_MIN, HEAP_MAX));
+  alloced_size = 0;
+  max_alloced_size = 0;
+}
+
+void Memory::mark_block(block_t block, bool is_alloced) {
+  uint64_t begin = (block.first - HEAP_MIN) / HEAP_GRANULE;
+  uint64_t end = (block.second - HEAP_MIN) / HEAP_GRANULE;
+
+  while (begin < end && begin % 64 != 0) {
+    uint64_t bit = (uint64_t)1 << (begin % 64);
+    heap_map[begin / 64] = is_alloced ? heap_map[begin / 64] | bit : heap_map[begin / 64] & ~bit;
+    begin++;
+  }
+
+  while (begin + 64 <= end) {
+    heap_map[begin / 64] = is_alloced ? ~(uint64_t)0 : 0;
+    begin += 64;
+  }
+
+  while (begin < end) {
+    uint64_t bit = (uint64_t)1 << (begin % 64);
+    heap_map[begin / 64] = is_alloced ? heap_map[begin / 64] | bit : heap_map[begin / 64] & ~bit;
+    begin++;
+  }
+}
+
+/** size classes: exact below 32 bytes, then four classes per power of two */
+int free_class_of(uint64_t size) {
+  uint64_t granules = size / HEAP_GRANULE;
+  if (granules < 4)
+    return (int)granules - 1;
+  int log = 63 - __builtin_clzll(granules);
+  return 4 * log + (int)((granules >> (log - 2)) & 3);
+}
+
+void Memory::insert_free(block_t block) {
+  freed.insert(block);
+  int cls = free_class_of(block.second - block.first);
+  free_classes[cls].insert(block);
+  free_class_map[cls / 64] |= (uint64_t)1 << (cls % 64);
+}
+
+void Memory::erase_free(block_t block) {
+  freed.erase(block);
+  int cls = free_class_of(block.second - block.first);
+  free_classes[cls].erase(block);
+  if (free_classes[cls].empty())
+    free_class_map[cls / 64] &= ~((uint64_t)1 << (cls % 64));
+}
+
+/** the free block of the lowest address that can hold size bytes (first fit) */
+const block_t* Memory::find_free(uint64_t size) const {
+  int cls = free_class_of(size);
+  const block_t* best = nullptr;
+
+  // every block of a larger class fits
+  for (int i = (cls + 1) / 64; i < NFREE_CLASSES / 64; i++) {
+    uint64_t bits = free_class_map[i];
+    if (i == (cls + 1) / 64)
+      bits &= ~(uint64_t)0 << ((cls + 1) % 64);
+
+    while (bits != 0) {
+      int c = i * 64 + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      const block_t* first = &*free_classes[c].begin();
+      if (best == nullptr || first->first < best->first)
+        best = first;
+    }
   }
 
-  lb--;
-  if (lb->first.second <= addr) {
+  // blocks of the same class may be too small
+  for (auto& block: free_classes[cls]) {
+    if (best != nullptr && best->first < block.first)
+      break;
+    if (block.second - block.first >= size)
+      return &block;
+  }
+
+  return best;
+}
+
+uint8_t* Memory::translate(uint64_t addr) const {
+  uint64_t ofs = addr - HEAP_MIN;
+  uint64_t granule = ofs / HEAP_GRANULE;
+
+  if (ofs >= heap_size || !((heap_map[granule / 64] >> (granule % 64)) & 1)) {
     invoke_runtime_error("accessing non-allocated memory");
+    return nullptr;
   }
 
-  return *lb;
+  return heap + ofs;
 }
 
-uint64_t load_little_endian(int size, uint8_t* ptr) {
+uint64_t load_little_endian(int size, const uint8_t* ptr) {
   uint64_t sum = 0;
   ptr = ptr + size;
 
@@ -40,20 +202,6 @@ uint64_t load_little_endian(int size, uint8_t* ptr) {
   return sum;
 }
 
-uint64_t Memory::load_stack(MSize size, uint64_t addr) const {
-  uint8_t* ptr = (uint8_t*)&stack[0];
-  return load_little_endian(msize_of(size), ptr + addr);
-}
-
-uint64_t Memory::load_heap(MSize size, uint64_t addr) const {
-  alloc_t block = find_block(addr);
-  uint64_t start = block.first.first;
-  uint64_t ofs = addr - start;
-  uint8_t* ptr = block.second + ofs;
-
-  return load_little_endian(msize_of(size), ptr);
-}
-
 void store_little_endian(int size, uint8_t* ptr, uint64_t val) {
   uint64_t mask = 0xFF;
   for (int i = 0; i < size; i++) {
@@ -63,18 +211,35 @@ void store_little_endian(int size, uint8_t* ptr, uint64_t val) {
   }
 }
 
-void Memory::store_stack(MSize size, uint64_t addr, uint64_t val) {
-  uint8_t* ptr = (uint8_t*)&stack[0];
-  return store_little_endian(msize_of(size), ptr + addr, val);
+template <MSize size> struct msize_traits {};
+template <> struct msize_traits<MSize1> { typedef uint8_t type; };
+template <> struct msize_traits<MSize2> { typedef uint16_t type; };
+template <> struct msize_traits<MSize4> { typedef uint32_t type; };
+template <> struct msize_traits<MSize8> { typedef uint64_t type; };
+
+/** accessors of a fixed width; the simulated memory is little endian */
+
+template <MSize size>
+uint64_t load_aligned(const uint8_t* ptr) {
+  typedef typename msize_traits<size>::type word_t;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  word_t val;
+  memcpy(&val, ptr, sizeof(word_t));
+  return val;
+#else
+  return load_little_endian(sizeof(word_t), ptr);
+#endif
 }
 
-void Memory::store_heap(MSize size, uint64_t addr, uint64_t val) {
-  alloc_t block = find_block(addr);
-  uint64_t start = block.first.first;
-  uint64_t ofs = addr - start;
-  uint8_t* ptr = block.second + ofs;
-
-  store_little_endian(msize_of(size), ptr, val);
+template <MSize size>
+void store_aligned(uint8_t* ptr, uint64_t val) {
+  typedef typename msize_traits<size>::type word_t;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  word_t word = (word_t)val;
+  memcpy(ptr, &word, sizeof(word_t));
+#else
+  store_little_endian(sizeof(word_t), ptr, val);
+#endif
 }
 
 bool is_stack(MSize size, uint64_t addr) {
@@ -89,19 +254,22 @@ bool is_alligned(MSize size, uint64_t addr) {
   return addr % msize_of(size) == 0;
 }
 
-double Memory::exec_load(bool is_async, MSize size, uint64_t addr, uint64_t& result) {
-  if (!is_alligned(size, addr)) {
+template <MSize size>
+double Memory::load(bool is_async, uint64_t addr, uint64_t& result) const {
+  constexpr uint64_t width = sizeof(typename msize_traits<size>::type);
+
+  if (addr % width != 0) {
     invoke_runtime_error("address not aligned");
     return 0;
   }
 
-  if (is_stack(size, addr)) {
-    result = load_stack(size, addr);
+  if (addr + width <= STACK_MAX) {
+    result = load_aligned<size>(stack + addr);
     return is_async ? Cost::ALOAD : Cost::STACK;
   }
 
-  if (is_heap(size, addr)) {
-    result = load_heap(size, addr);
+  if (HEAP_MIN <= addr && addr + width <= HEAP_MAX) {
+    result = load_aligned<size>(translate(addr));
     return is_async ? Cost::ALOAD : Cost:: HEAP;
   }
 
@@ -109,19 +277,23 @@ double Memory::exec_load(bool is_async, MSize size, uint64_t addr, uint64_t& res
   return 0;
 }
 
-double Memory::exec_store(MSize size, uint64_t addr, uint64_t val) {
-  if (!is_alligned(size, addr)) {
+template <MSize size>
+double Memory::store(uint64_t addr, uint64_t val) {
+  constexpr uint64_t width = sizeof(typename msize_traits<size>::type);
+
+  if (addr % width != 0) {
     invoke_runtime_error("address not aligned");
     return 0;
   }
 
-  if (is_stack(size, addr)) {
-    store_stack(size, addr, val);
+  if (addr + width <= STACK_MAX) {
+    store_aligned<size>(stack + addr, val);
+    stack_dirty |= (uint64_t)1 << (addr / STACK_PAGE);
     return Cost::STACK;
   }
 
-  if (is_heap(size, addr)) {
-    store_heap(size, addr, val);
+  if (HEAP_MIN <= addr && addr + width <= HEAP_MAX) {
+    store_aligned<size>(translate(addr), val);
     return Cost::HEAP;
   }
 
@@ -129,31 +301,68 @@ double Memory::exec_store(MSize size, uint64_t addr, uint64_t val) {
   return 0;
 }
 
+double Memory::exec_load(bool is_async, MSize size, uint64_t addr, uint64_t& result) {
+  switch (size) {
+    case MSize1:
+      return load<MSize1>(is_async, addr, result);
+    case MSize2:
+      return load<MSize2>(is_async, addr, result);
+    case MSize4:
+      return load<MSize4>(is_async, addr, result);
+    case MSize8:
+      return load<MSize8>(is_async, addr, result);
+  }
+  return 0;
+}
+
+double Memory::exec_store(MSize size, uint64_t addr, uint64_t val) {
+  switch (size) {
+    case MSize1:
+      return store<MSize1>(addr, val);
+    case MSize2:
+      return store<MSize2>(addr, val);
+    case MSize4:
+      return store<MSize4>(addr, val);
+    case MSize8:
+      return store<MSize8>(addr, val);
+  }
+  return 0;
+}
+
 double Memory::exec_malloc(uint64_t size, uint64_t& result) {
   if (size == 0)
     invoke_runtime_error("allocation size should not be 0");
   if (size % 8 != 0)
     invoke_runtime_error("allocation size should be multiple of 8");
 
-  for (auto it = freed.begin(); it != freed.end(); it++) {
-    if (it->second - it->first < size)
-      continue;
-
+  const block_t* it = find_free(size);
+  if (it != nullptr) {
     block_t block = *it;
-    freed.erase(block);
-    freed.insert(block_t(block.first + size, block.second));
-    uint8_t* ptr = (uint8_t*)calloc(size, sizeof(uint8_t));
-
-    if (ptr == nullptr) {
+    if (block.first + size - HEAP_MIN > heap_size) {
       invoke_runtime_error("out-of-memory");
       return 0;
     }
 
-    alloced.insert(alloc_t(block_t(block.first, block.first + size), ptr));
+    erase_free(block);
+    if (block.first + size != block.second)
+      insert_free(block_t(block.first + size, block.second));
+    // only the part that may have been written, so that a large block commits no pages before it is used
+    uint64_t end = block.first + size;
+    if (block.first < heap_dirty_top)
+      zero_heap(heap + (block.first - HEAP_MIN), min(end, heap_dirty_top) - block.first);
+    mark_block(block_t(block.first, end), true);
+
+    alloced.insert(pair<uint64_t, uint64_t>(block.first, end));
+    if (heap_top < end)
+      heap_top = end;
+    if (heap_dirty_top < end)
+      heap_dirty_top = end;
     result = block.first;
     alloced_size += size;
     if (max_alloced_size < alloced_size)
       max_alloced_size = alloced_size;
+    if (heap_profile != nullptr)
+      heap_profile->record_malloc(result, size);
     return Cost::MALLOC;
   }
 
@@ -162,43 +371,47 @@ double Memory::exec_malloc(uint64_t size, uint64_t& result) {
 }
 
 double Memory::exec_free(uint64_t addr) {
-  auto alloc_lb = alloced.lower_bound(alloc_t(block_t(addr, 0), nullptr));
+  auto alloc_it = alloced.find(addr);
 
-  if (alloc_lb == alloced.end() || alloc_lb->first.first != addr) {
+  if (alloc_it == alloced.end()) {
     invoke_runtime_error("freeing non-allocated address");
     return 0;
   }
 
-  block_t block = alloc_lb->first;
-  uint8_t* ptr = alloc_lb->second;
+  block_t block = *alloc_it;
   uint64_t size = block.second - block.first;
-  alloced.erase(alloc_lb);
-  free(ptr);
+  alloced.erase(alloc_it);
+  mark_block(block, false);
 
   auto next = freed.lower_bound(block);
 
+  if (next != freed.end() && next->first == block.second) {
+    block_t next_block = *next;
+    block = block_t(block.first, next_block.second);
+    erase_free(next_block);
+  }
+
+  next = freed.lower_bound(block);
   if (next != freed.begin()) {
     auto prev = next;
     prev--;
 
     if (prev->second == block.first) {
-      block = block_t(prev->first, block.second);
-      freed.erase(prev);
-    }
-  }
-
-  if (next != freed.end()) {
-    if (next->first == block.second) {
-      block = block_t(block.first, next->second);
-      freed.erase(next);
+      block_t prev_block = *prev;
+      block = block_t(prev_block.first, block.second);
+      erase_free(prev_block);
     }
   }
 
-  freed.insert(block);
+  insert_free(block);
   alloced_size -= size;
+  if (heap_profile != nullptr)
+    heap_profile->record_free(addr, size);
   return Cost::FREE;
 }
 
+void Memory::set_heap_profile(HeapProfile* _heap_profile) { heap_profile = _heap_profile; }
+
 uint64_t Memory::get_alloced_size() const { return alloced_size; }
 
 uint64_t Memory::get_max_alloced_size() const { return max_alloced_size; }
@@ -13,11 +13,23 @@
 #define STACK_MAX ((uint64_t)102400)
 #define HEAP_MIN ((uint64_t)204800)
 #define HEAP_MAX ((uint64_t)(numeric_limits<uint64_t>::max() - 7))
+// host address space reserved for the heap, backed lazily by the OS
+#define HEAP_RESERVE ((uint64_t)1 << 35)
+#define HEAP_GRANULE ((uint64_t)8)
+// number of size classes of free blocks
+#define NFREE_CLASSES 256
+// granularity of the stack cleared by reset
+#define STACK_PAGE ((uint64_t)4096)
+// host memory of the heap kept across resets, the rest is returned to the OS
+#define HEAP_RETAIN ((uint64_t)64 << 20)
+// blocks at least this large that malloc must zero get fresh pages from the OS instead
+#define HEAP_ZERO_BY_OS ((uint64_t)1 << 20)
 
 using namespace std;
 
 typedef pair<uint64_t, uint64_t> block_t;
-typedef pair<block_t, uint8_t*> alloc_t;
+
+class HeapProfile;
 
 bool is_stack(MSize size, uint64_t addr);
 bool is_heap(MSize size, uint64_t addr);
@@ -25,20 +37,46 @@ bool is_heap(MSize size, uint64_t addr);
 class Memory {
 private:
   uint8_t stack[STACK_MAX]{};
-  set<alloc_t> alloced;
+  // one bit per STACK_PAGE written since the last reset
+  uint64_t stack_dirty;
+  // heap address addr lives at heap + (addr - HEAP_MIN)
+  uint8_t* heap;
+  uint64_t heap_size;
+  // one bit per allocated HEAP_GRANULE of the heap
+  uint64_t* heap_map;
+  map<uint64_t, uint64_t> alloced;
+  // free blocks in address order, and the same blocks bucketed by size
   set<block_t> freed;
+  set<block_t> free_classes[NFREE_CLASSES];
+  uint64_t free_class_map[NFREE_CLASSES / 64];
   uint64_t alloced_size;
   uint64_t max_alloced_size;
+  // the end of the highest block allocated since the last reset
+  uint64_t heap_top;
+  // the heap above it is untouched since it was mapped or advised away, and so still zero
+  uint64_t heap_dirty_top;
+  // notified of every malloc and free if set
+  HeapProfile* heap_profile;
 
-  alloc_t find_block(uint64_t addr) const;
-  uint64_t load_stack(MSize size, uint64_t addr) const;
-  uint64_t load_heap(MSize size, uint64_t addr) const;
-  void store_stack(MSize size, uint64_t addr, uint64_t val);
-  void store_heap(MSize size, uint64_t addr, uint64_t val);
+  void mark_block(block_t block, bool is_alloced);
+  void insert_free(block_t block);
+  void erase_free(block_t block);
+  const block_t* find_free(uint64_t size) const;
+  uint8_t* translate(uint64_t addr) const;
+  template <MSize size> double load(bool is_async, uint64_t addr, uint64_t& result) const;
+  template <MSize size> double store(uint64_t addr, uint64_t val);
 
 public:
   Memory();
+  Memory(const Memory&) = delete;
+  Memory& operator=(const Memory&) = delete;
+  ~Memory();
+
+  /** frees everything and clears the stack, in time proportional to the memory used since the last reset */
+  void reset();
 
+  /** nullptr to stop recording */
+  void set_heap_profile(HeapProfile* _heap_profile);
   uint64_t get_alloced_size() const;
   uint64_t get_max_alloced_size() const;
   double exec_load(bool is_async, MSize size, uint64_t addr, uint64_t& result);
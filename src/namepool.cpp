@@ -0,0 +1,16 @@
+#include "namepool.h"
+
+
+NamePool::NamePool(): names(), index(), lock() {}
+
+const string& NamePool::intern(string_view name) {
+  lock_guard<mutex> guard(lock);
+  auto it = index.find(name);
+  if (it != index.end())
+    return *it->second;
+
+  names.emplace_back(name);
+  const string& interned = names.back();
+  index.insert(pair<string_view, const string*>(interned, &interned));
+  return interned;
+}
@@ -0,0 +1,32 @@
+#ifndef SWPP_ASM_INTERPRETER_NAMEPOOL_H
+#define SWPP_ASM_INTERPRETER_NAMEPOOL_H
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+
+/**
+ * owns a single copy of every function and basic block name of a program;
+ * threads parsing parts of the program intern into it at once
+ */
+class NamePool {
+private:
+  deque<string> names;
+  unordered_map<string_view, const string*> index;
+  mutex lock;
+
+public:
+  NamePool();
+  NamePool(const NamePool&) = delete;
+  NamePool& operator=(const NamePool&) = delete;
+
+  /** the returned reference stays valid as long as the pool; thread-safe */
+  const string& intern(string_view name);
+};
+
+#endif //SWPP_ASM_INTERPRETER_NAMEPOOL_H
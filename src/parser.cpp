@@ -1,9 +1,16 @@
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <exception>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <regex>
+#include <thread>
+#include <vector>
 
 #include "error.h"
+#include "mappedfile.h"
 #include "parser.h"
 
 #define PAREN(X) ("(" + (X) + ")")
@@ -82,6 +89,33 @@ const static string rWrite = SPACED(rOptAssign + tCall + tSpace + tWrite + tSpac
 const static string rCall = SPACED(rOptAssign + tCall + tSpace + tName + rArgs);
 const static string rAssert = SPACED(tAssert + tSpace + tValue + tSpace + tValue);
 
+const static regex reEmpty(tESpace + "|" + rComment);
+const static regex reStartFunction(rStartFuncion);
+const static regex reEndFunction(rEndFunction);
+const static regex reBBStart(rBBStart);
+
+const static regex reRet(rRet);
+const static regex reRetVal(rRetVal);
+const static regex reBrUncond(rBrUncond);
+const static regex reBrCond(rBrCond);
+const static regex reSwitch(rSwitch);
+
+const static regex reMalloc(rMalloc);
+const static regex reFree(rFree);
+const static regex reLoad(rLoad);
+const static regex reStore(rStore);
+
+const static regex reBop(rBop);
+const static regex reSum(rSum);
+const static regex reUop(rUop);
+const static regex reIcmp(rIcmp);
+const static regex reSelect(rSelect);
+
+const static regex reRead(rRead);
+const static regex reWrite(rWrite);
+const static regex reCall(rCall);
+const static regex reAssert(rAssert);
+
 
 enum ParserState {
   PSBegin = 0,
@@ -92,14 +126,49 @@ enum ParserState {
   PSEndFunction
 };
 
-Reg parse_reg(const string& reg) {
-  if (regex_match(reg, regex("r.*"))) {
-    int num = stoi(reg.substr(1));
+/** splits a statement into words like an istream would, reading '=' as a space */
+class Tokens {
+private:
+  string_view s;
+  size_t pos;
+  bool failed;
+
+  static bool is_separator(char c) { return c == '=' || isspace((unsigned char)c); }
+
+public:
+  explicit Tokens(string_view _s): s(_s), pos(0), failed(false) {}
+
+  Tokens& operator>>(string_view& token) {
+    while (pos < s.length() && is_separator(s[pos])) pos++;
+    size_t begin = pos;
+    while (pos < s.length() && !is_separator(s[pos])) pos++;
+    token = s.substr(begin, pos - begin);
+    failed = token.empty();
+    return *this;
+  }
+
+  explicit operator bool() const { return !failed; }
+};
+
+bool matches(string_view instr, const regex& re) {
+  return regex_match(instr.begin(), instr.end(), re);
+}
+
+/** only called on tokens of a line that already matched its pattern */
+int parse_int(string_view token) {
+  int num = 0;
+  from_chars(token.data(), token.data() + token.length(), num);
+  return num;
+}
+
+Reg parse_reg(string_view reg) {
+  if (reg.substr(0, 1) == "r") {
+    int num = parse_int(reg.substr(1));
     return (Reg)(num - 1);
   }
 
-  if (regex_match(reg, regex("arg.*"))) {
-    int num = stoi(reg.substr(3));
+  if (reg.substr(0, 3) == "arg") {
+    int num = parse_int(reg.substr(3));
     return (Reg)((int)R32 + num);
   }
 
@@ -110,24 +179,29 @@ Reg parse_reg(const string& reg) {
   return RegNone;
 }
 
-uint64_t parse_const(const string& val) {
-  try {
-    uint64_t ret = stoull(val);
-    return ret;
-  } catch (exception& e) {
+uint64_t parse_const(string_view val) {
+  uint64_t ret = 0;
+  auto res = from_chars(val.data(), val.data() + val.length(), ret);
+  if (res.ec != errc()) {
     invoke_syntax_error("constant out of range");
     return 0;
   }
+  return ret;
 }
 
-Value parse_value(const string& val) {
-  if (regex_match(val, regex(tReg)))
+/** only called on operands of a line that already matched its pattern */
+bool is_reg_token(string_view token) {
+  return !token.empty() && !isdigit((unsigned char)token[0]);
+}
+
+Value parse_value(string_view val) {
+  if (is_reg_token(val))
     return Value(parse_reg(val));
   else
     return Value(parse_const(val));
 }
 
-MSize parse_msize(const string& msize) {
+MSize parse_msize(string_view msize) {
   if (msize == "1") return MSize1;
   if (msize == "2") return MSize2;
   if (msize == "4") return MSize4;
@@ -137,7 +211,7 @@ MSize parse_msize(const string& msize) {
   return MSize1;
 }
 
-Size parse_size(const string& size) {
+Size parse_size(string_view size) {
   if (size == "1") return Size1;
   if (size == "8") return Size8;
   if (size == "16") return Size16;
@@ -148,28 +222,24 @@ Size parse_size(const string& size) {
   return Size1;
 }
 
-Function* parse_start_function(const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Function* parse_start_function(Program* program, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
-  string fname;
+  string_view fname;
   int nargs;
 
   ss >> token; // start
   ss >> fname; // fname
   ss >> token; // nargs
-  nargs = stoi(token);
+  nargs = parse_int(token);
 
-  return new Function(fname, nargs);
+  return new Function(program->intern(fname), nargs);
 }
 
-bool parse_end_function(const string& instr, const string& fname) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+bool parse_end_function(string_view instr, const string& fname) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // end
   ss >> token; // fname
@@ -177,21 +247,17 @@ bool parse_end_function(const string& instr, const string& fname) {
   return token == fname;
 }
 
-string parse_bbname(const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+const string& parse_bbname(Program* program, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // bbname:
-  return token.substr(0, token.length() - 1);
+  return program->intern(token.substr(0, token.length() - 1));
 }
 
-Stmt* parse_ret(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_ret(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // ret
 
@@ -203,41 +269,34 @@ Stmt* parse_ret(int line, const string& instr) {
   return new StmtRet(line, Value(0));
 }
 
-Stmt* parse_br_uncond(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_br_uncond(Program* program, int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // br
   ss >> token; // bbname
-  string bbname = token;
 
-  return new StmtBrUncond(line, bbname);
+  return new StmtBrUncond(line, program->intern(token));
 }
 
-Stmt* parse_br_cond(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_br_cond(Program* program, int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // br
   ss >> token; // cond
   Value cond = parse_value(token);
   ss >> token; // true_bb
-  string true_bb = token;
+  const string& true_bb = program->intern(token);
   ss >> token; // false_bb
-  string false_bb = token;
+  const string& false_bb = program->intern(token);
 
   return new StmtBrCond(line, cond, true_bb, false_bb);
 }
 
-Stmt* parse_switch(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_switch(Program* program, int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // switch
   ss >> token; // cond
@@ -245,7 +304,7 @@ Stmt* parse_switch(int line, const string& instr) {
   auto stmt = new StmtSwitch(line, cond);
 
   while (true) {
-    string token1, token2;
+    string_view token1, token2;
     ss >> token1;
 
     if (ss >> token2) {
@@ -254,22 +313,20 @@ Stmt* parse_switch(int line, const string& instr) {
         invoke_syntax_error("duplicated case in switch statement");
         return nullptr;
       }
-      stmt->set_bb(val, token2);
+      stmt->set_bb(val, program->intern(token2));
       continue;
     }
 
-    stmt->set_default(token1);
+    stmt->set_default(program->intern(token1));
     break;
   }
 
   return stmt;
 }
 
-Stmt* parse_malloc(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_malloc(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // lhs
   Reg lhs = parse_reg(token);
@@ -280,11 +337,9 @@ Stmt* parse_malloc(int line, const string& instr) {
   return new StmtMalloc(line, lhs, val);
 }
 
-Stmt* parse_free(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_free(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // malloc
   ss >> token; // ptr
@@ -293,11 +348,9 @@ Stmt* parse_free(int line, const string& instr) {
   return new StmtFree(line, ptr);
 }
 
-Stmt* parse_load(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_load(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // lhs
   Reg lhs = parse_reg(token);
@@ -311,11 +364,9 @@ Stmt* parse_load(int line, const string& instr) {
   return new StmtLoad(line, lhs, is_async, msize, ptr, 0);
 }
 
-Stmt* parse_store(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_store(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // store
   ss >> token; // size
@@ -328,11 +379,9 @@ Stmt* parse_store(int line, const string& instr) {
   return new StmtStore(line, msize, val, ptr, 0);
 }
 
-Stmt* parse_bop(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_bop(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // reg
   Reg lhs = parse_reg(token);
@@ -367,11 +416,9 @@ Stmt* parse_bop(int line, const string& instr) {
   return new StmtBop(line, lhs, kind, val1, val2, size);
 }
 
-Stmt* parse_sum(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_sum(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // reg
   Reg lhs = parse_reg(token);
@@ -390,11 +437,9 @@ Stmt* parse_sum(int line, const string& instr) {
   return new StmtSum(line, lhs, values, size);
 }
 
-Stmt* parse_uop(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_uop(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // reg
   Reg lhs = parse_reg(token);
@@ -408,11 +453,9 @@ Stmt* parse_uop(int line, const string& instr) {
   return new StmtUop(line, lhs, uop_kind, val, size);
 }
 
-Stmt* parse_icmp(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_icmp(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // reg
   Reg lhs = parse_reg(token);
@@ -445,11 +488,9 @@ Stmt* parse_icmp(int line, const string& instr) {
   return new StmtBop(line, lhs, kind, val1, val2, size);
 }
 
-Stmt* parse_select(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_select(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // lhs
   Reg lhs = parse_reg(token);
@@ -464,22 +505,19 @@ Stmt* parse_select(int line, const string& instr) {
   return new StmtSelect(line, lhs, val_cond, val_true, val_false);
 }
 
-Stmt* parse_call(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_call(Program* program, int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // reg or call
   Reg lhs = RegNone;
-  if (regex_match(token, regex(tReg))) {
+  if (token != "call") {
     lhs = parse_reg(token);
     ss >> token; // call
   }
 
   ss >> token; // fname
-  string fname = token;
-  auto stmt = new StmtCall(line, lhs, fname);
+  auto stmt = new StmtCall(line, lhs, program->intern(token));
 
   while (ss >> token) {
     Value val = parse_value(token);
@@ -489,11 +527,9 @@ Stmt* parse_call(int line, const string& instr) {
   return stmt;
 }
 
-Stmt* parse_assert(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_assert(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // assert_eq
   ss >> token; // val1
@@ -504,15 +540,13 @@ Stmt* parse_assert(int line, const string& instr) {
   return new StmtAssert(line, val1, val2);
 }
 
-Stmt* parse_read(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_read(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // reg or call
   Reg lhs = RegNone;
-  if (regex_match(token, regex(tReg))) {
+  if (token != "call") {
     lhs = parse_reg(token);
     ss >> token; // call
   }
@@ -524,15 +558,13 @@ Stmt* parse_read(int line, const string& instr) {
   return new StmtRead(line, lhs);
 }
 
-Stmt* parse_write(int line, const string& instr) {
-  string rep = regex_replace(instr, regex(tAssign), " ");
-  stringstream ss;
-  string token;
-  ss << rep;
+Stmt* parse_write(int line, string_view instr) {
+  Tokens ss(instr);
+  string_view token;
 
   ss >> token; // reg or call
   Reg lhs = RegNone;
-  if (regex_match(token, regex(tReg))) {
+  if (token != "call") {
     lhs = parse_reg(token);
     ss >> token; // call
   }
@@ -547,180 +579,324 @@ Stmt* parse_write(int line, const string& instr) {
   return new StmtWrite(line, lhs, val);
 }
 
-Stmt* parse_normal_stmt(int line, const string& instr) {
-  if (regex_match(instr, regex(rMalloc)))
-    return parse_malloc(line, instr);
-  if (regex_match(instr, regex(rFree)))
-    return parse_free(line, instr);
-  if (regex_match(instr, regex(rLoad)))
-    return parse_load(line, instr);
-  if (regex_match(instr, regex(rStore)))
-    return parse_store(line, instr);
-
-  if (regex_match(instr, regex(rBop)))
-    return parse_bop(line, instr);
-  if (regex_match(instr, regex(rSum)))
-    return parse_sum(line, instr);
-  if (regex_match(instr, regex(rUop)))
-    return parse_uop(line, instr);
-  if (regex_match(instr, regex(rIcmp)))
-    return parse_icmp(line, instr);
-  if (regex_match(instr, regex(rSelect)))
-    return parse_select(line, instr);
-
-  if (regex_match(instr, regex(rRead)))
-    return parse_read(line, instr);
-  if (regex_match(instr, regex(rWrite)))
-    return parse_write(line, instr);
-  if (regex_match(instr, regex(rCall)))
-    return parse_call(line, instr);
-
-  if (regex_match(instr, regex(rAssert)))
-    return parse_assert(line, instr);
+/** the operation name of a statement, i.e. its first word after an optional "<lhs> =" */
+string_view parse_mnemonic(string_view instr) {
+  size_t n = instr.length();
+  size_t i = 0;
+  while (i < n && isspace((unsigned char)instr[i])) i++;
+  size_t begin = i;
+  while (i < n && !isspace((unsigned char)instr[i]) && instr[i] != '=') i++;
+  size_t end = i;
+
+  while (i < n && isspace((unsigned char)instr[i])) i++;
+  if (i < n && instr[i] == '=') {
+    i++;
+    while (i < n && isspace((unsigned char)instr[i])) i++;
+    begin = i;
+    while (i < n && !isspace((unsigned char)instr[i])) i++;
+    end = i;
+  }
+
+  return instr.substr(begin, end - begin);
+}
+
+bool is_bop_mnemonic(string_view op) {
+  return op == "udiv" || op == "sdiv" || op == "urem" || op == "srem" || op == "mul" ||
+    op == "shl" || op == "lshr" || op == "ashr" || op == "and" || op == "or" || op == "xor" ||
+    op == "add" || op == "sub";
+}
+
+/** each pattern only matches statements of its own mnemonic, so try only those */
+Stmt* parse_normal_stmt(Program* program, int line, string_view instr) {
+  string_view op = parse_mnemonic(instr);
+
+  if (op == "malloc")
+    return matches(instr, reMalloc) ? parse_malloc(line, instr) : nullptr;
+  if (op == "free")
+    return matches(instr, reFree) ? parse_free(line, instr) : nullptr;
+  if (op == "load" || op == "aload")
+    return matches(instr, reLoad) ? parse_load(line, instr) : nullptr;
+  if (op == "store")
+    return matches(instr, reStore) ? parse_store(line, instr) : nullptr;
+
+  if (is_bop_mnemonic(op))
+    return matches(instr, reBop) ? parse_bop(line, instr) : nullptr;
+  if (op == "sum")
+    return matches(instr, reSum) ? parse_sum(line, instr) : nullptr;
+  if (op == "incr" || op == "decr")
+    return matches(instr, reUop) ? parse_uop(line, instr) : nullptr;
+  if (op == "icmp")
+    return matches(instr, reIcmp) ? parse_icmp(line, instr) : nullptr;
+  if (op == "select")
+    return matches(instr, reSelect) ? parse_select(line, instr) : nullptr;
+
+  if (op == "call") {
+    if (matches(instr, reRead))
+      return parse_read(line, instr);
+    if (matches(instr, reWrite))
+      return parse_write(line, instr);
+    if (matches(instr, reCall))
+      return parse_call(program, line, instr);
+    return nullptr;
+  }
+
+  if (op == "assert_eq")
+    return matches(instr, reAssert) ? parse_assert(line, instr) : nullptr;
 
   return nullptr;
 }
 
-Stmt* parse_terminator(int line, const string& instr) {
-  if (regex_match(instr, regex(rRet)))
-    return parse_ret(line, instr);
-  if (regex_match(instr, regex(rRetVal)))
-    return parse_ret(line, instr);
-  if (regex_match(instr, regex(rBrUncond)))
-    return parse_br_uncond(line, instr);
-  if (regex_match(instr, regex(rBrCond)))
-    return parse_br_cond(line, instr);
-  if (regex_match(instr, regex(rSwitch)))
-    return parse_switch(line, instr);
+Stmt* parse_terminator(Program* program, int line, string_view instr) {
+  string_view op = parse_mnemonic(instr);
+
+  if (op == "ret") {
+    if (matches(instr, reRet))
+      return parse_ret(line, instr);
+    if (matches(instr, reRetVal))
+      return parse_ret(line, instr);
+    return nullptr;
+  }
+
+  if (op == "br") {
+    if (matches(instr, reBrUncond))
+      return parse_br_uncond(program, line, instr);
+    if (matches(instr, reBrCond))
+      return parse_br_cond(program, line, instr);
+    return nullptr;
+  }
+
+  if (op == "switch")
+    return matches(instr, reSwitch) ? parse_switch(program, line, instr) : nullptr;
 
   return nullptr;
 }
 
-Program* parse(const string& filename) {
-  ParserState state = PSBegin;
-  ifstream input(filename);
+Program* parse(const string& filename, unsigned jobs) {
+  MappedFile input(filename);
 
   if (!input.is_open())
     return nullptr;
 
-  int line = 0;
-  string instr;
-  regex re(tESpace);
-  auto program = new Program();
+  return parse_source(input.contents(), filename, jobs);
+}
+
+/** a run of whole functions, parsed on its own */
+struct ParseChunk {
+  string_view source;
+  // the number of lines before it
+  int line_offset;
+  bool last;
+  // in order, with the lines they start at; owned until merged into the program
+  vector<pair<Function*, int>> functions;
+  // the first error in the chunk, which ends its parse
+  exception_ptr error;
+};
+
+/**
+ * the state machine of the parser over chunk, from the state after the end of
+ * a function; names are checked by the caller, in the order of the source
+ */
+void parse_chunk(Program* program, ParseChunk& chunk) {
+  // only the first chunk starts at line 1, and the others after the end of a function
+  ParserState state = chunk.line_offset == 0 ? PSBegin : PSEndFunction;
+  int line = chunk.line_offset;
+  string_view rest = chunk.source;
   Function* curr_function = nullptr;
-  string curr_bb;
+  const string* curr_bb = nullptr;
   Stmt* prev_stmt;
   Stmt* curr_stmt;
 
-  while (getline(input, instr)) {
-    error_line_num = ++line;
-    if (regex_match(instr, regex(tESpace + "|" + rComment))) {
-      continue;
-    }
+  error_line_num = line;
+  try {
+    while (!rest.empty()) {
+      size_t eol = rest.find('\n');
+      string_view instr = rest.substr(0, eol);
+      rest = eol == string_view::npos ? string_view() : rest.substr(eol + 1);
+
+      error_line_num = ++line;
+      if (matches(instr, reEmpty)) {
+        continue;
+      }
 
-    switch (state) {
-      /** start parsing */
-      case PSBegin: {
-        if (!regex_match(instr, regex(rStartFuncion)))
-          invoke_syntax_error("start of a function expected");
+      switch (state) {
+        /** start parsing, or parsed end of function */
+        case PSBegin:
+        case PSEndFunction: {
+          if (!matches(instr, reStartFunction))
+            invoke_syntax_error("start of a function expected");
 
-        curr_function = parse_start_function(instr);
-        string fname = curr_function->get_fname();
-        if (fname == "read" || fname == "write")
-          invoke_syntax_error("duplicated function name");
-
-        program->set_function(fname, curr_function);
-        state = PSStartFunction;
-        break;
-      }
-      /** parsed a function start */
-      case PSStartFunction: {
-        if (!regex_match(instr, regex(rBBStart)))
-          invoke_syntax_error("start of a basic block expected");
-
-        curr_bb = parse_bbname(instr);
-        curr_function->set_first_bb(curr_bb);
-        state = PSStartBB;
-        break;
-      }
-      /** parsed a basic block name */
-      case PSStartBB: {
-        curr_stmt = parse_normal_stmt(line, instr);
-        if (curr_stmt != nullptr) {
-          if (!curr_function->set_bb(curr_bb, curr_stmt))
-            invoke_syntax_error("duplicated basic block");
-          prev_stmt = curr_stmt;
-          state = PSNormal;
+          curr_function = parse_start_function(program, instr);
+          chunk.functions.emplace_back(curr_function, line);
+          state = PSStartFunction;
           break;
         }
+        /** parsed a function start */
+        case PSStartFunction: {
+          if (!matches(instr, reBBStart))
+            invoke_syntax_error("start of a basic block expected");
 
-        curr_stmt = parse_terminator(line, instr);
-        if (curr_stmt != nullptr) {
-          curr_function->set_bb(curr_bb, curr_stmt);
-          state = PSEndBB;
+          curr_bb = &parse_bbname(program, instr);
+          curr_function->set_first_bb(*curr_bb);
+          state = PSStartBB;
           break;
         }
-
-        invoke_syntax_error("instruction expected");
-        break;
-      }
-      /** parsed a non-terminating instruction */
-      case PSNormal: {
-        curr_stmt = parse_normal_stmt(line, instr);
-        if (curr_stmt != nullptr) {
-          prev_stmt->set_next(curr_stmt);
-          prev_stmt = curr_stmt;
-          state = PSNormal;
+        /** parsed a basic block name */
+        case PSStartBB: {
+          curr_stmt = parse_normal_stmt(program, line, instr);
+          if (curr_stmt != nullptr) {
+            if (!curr_function->set_bb(*curr_bb, curr_stmt)) {
+              delete curr_stmt;
+              invoke_syntax_error("duplicated basic block");
+            }
+            prev_stmt = curr_stmt;
+            state = PSNormal;
+            break;
+          }
+
+          curr_stmt = parse_terminator(program, line, instr);
+          if (curr_stmt != nullptr) {
+            // a repeated block of a single terminator is ignored
+            if (!curr_function->set_bb(*curr_bb, curr_stmt))
+              delete curr_stmt;
+            state = PSEndBB;
+            break;
+          }
+
+          invoke_syntax_error("instruction expected");
           break;
         }
-
-        curr_stmt = parse_terminator(line, instr);
-        if (curr_stmt != nullptr) {
-          prev_stmt->set_next(curr_stmt);
-          state = PSEndBB;
+        /** parsed a non-terminating instruction */
+        case PSNormal: {
+          curr_stmt = parse_normal_stmt(program, line, instr);
+          if (curr_stmt != nullptr) {
+            prev_stmt->set_next(curr_stmt);
+            prev_stmt = curr_stmt;
+            state = PSNormal;
+            break;
+          }
+
+          curr_stmt = parse_terminator(program, line, instr);
+          if (curr_stmt != nullptr) {
+            prev_stmt->set_next(curr_stmt);
+            state = PSEndBB;
+            break;
+          }
+
+          invoke_syntax_error("instruction expected");
           break;
         }
-
-        invoke_syntax_error("instruction expected");
-        break;
-      }
-      /** parsed end of basic block */
-      case PSEndBB: {
-        if (regex_match(instr, regex(rBBStart))) {
-          curr_bb = parse_bbname(instr);
-          state = PSStartBB;
+        /** parsed end of basic block */
+        case PSEndBB: {
+          if (matches(instr, reBBStart)) {
+            curr_bb = &parse_bbname(program, instr);
+            state = PSStartBB;
+            break;
+          }
+
+          if (matches(instr, reEndFunction)) {
+            if (!parse_end_function(instr, curr_function->get_fname()))
+              invoke_syntax_error("unmatching function name");
+            state = PSEndFunction;
+            break;
+          }
+
+          invoke_syntax_error("bbname or end of function expected");
           break;
         }
+      }
+    }
 
-        if (regex_match(instr, regex(rEndFunction))) {
-          if (!parse_end_function(instr, curr_function->get_fname()))
-            invoke_syntax_error("unmatching function name");
-          state = PSEndFunction;
-          break;
-        }
+    if (chunk.last && state != PSEndFunction)
+      invoke_syntax_error("function not ended");
+  } catch (...) {
+    chunk.error = current_exception();
+  }
+}
 
-        invoke_syntax_error("bbname or end of function expected");
-        break;
-      }
-      /** parsed end of function */
-      case PSEndFunction: {
-        if (!regex_match(instr, regex(rStartFuncion)))
-          invoke_syntax_error("start of a function expected");
-
-        curr_function = parse_start_function(instr);
-        string fname = curr_function->get_fname();
-        if (fname == "read" || fname == "write" || !program->set_function(fname, curr_function))
+/** whether the line at pos ends a function, i.e. starts with the word "end" */
+static bool is_end_line(string_view source, size_t pos) {
+  while (pos < source.length() && (source[pos] == ' ' || source[pos] == '\t'))
+    pos++;
+  return source.substr(pos, 4) == "end " || source.substr(pos, 4) == "end\t";
+}
+
+/**
+ * splits source into about n chunks after lines that start with "end"; a
+ * chunk before such a line either parses to the end of a function or stops
+ * with an error before it, so every chunk starts where a function may start
+ */
+static vector<ParseChunk> split_source(string_view source, size_t n) {
+  vector<ParseChunk> chunks;
+  size_t begin = 0;
+  int line_offset = 0;
+  for (size_t i = 1; i < n && begin < source.length(); i++) {
+    size_t pos = max(begin, source.length() / n * i);
+    // the start of the line after pos, then of the line after the next end
+    pos = source.find('\n', pos);
+    while (pos != string_view::npos && !is_end_line(source, pos + 1))
+      pos = source.find('\n', pos + 1);
+    if (pos == string_view::npos)
+      break;
+    pos = source.find('\n', pos + 1);
+    if (pos == string_view::npos || pos + 1 >= source.length())
+      break;
+
+    string_view text = source.substr(begin, pos + 1 - begin);
+    chunks.push_back(ParseChunk{text, line_offset, false, {}, nullptr});
+    line_offset += count(text.begin(), text.end(), '\n');
+    begin = pos + 1;
+  }
+  chunks.push_back(ParseChunk{source.substr(begin), line_offset, true, {}, nullptr});
+  return chunks;
+}
+
+Program* parse_source(string_view source, const string& filename, unsigned jobs) {
+  error_filename = filename;
+  unique_ptr<Program> program(new Program());
+  program->set_filename(filename);
+
+  // a few chunks per worker, to even out differently sized functions
+  size_t nchunks = jobs <= 1 ? 1 : max<size_t>(1, min<size_t>(jobs * 4, source.length() / PARSE_CHUNK_MIN_SIZE));
+  vector<ParseChunk> chunks = split_source(source, nchunks);
+  if (chunks.size() == 1)
+    parse_chunk(program.get(), chunks[0]);
+  else {
+    atomic<size_t> next_chunk(0);
+    auto worker = [&]() {
+      error_filename = filename;
+      for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++)
+        parse_chunk(program.get(), chunks[i]);
+    };
+    vector<thread> workers;
+    for (unsigned i = 1; i < min<size_t>(jobs, chunks.size()); i++)
+      workers.emplace_back(worker);
+    worker();
+    for (auto& w: workers)
+      w.join();
+  }
+
+  // the checks across chunks, in the order the sequential parse would fail them
+  exception_ptr error;
+  for (auto& chunk: chunks) {
+    for (auto& f: chunk.functions) {
+      const string& fname = f.first->get_fname();
+      if (error == nullptr && fname != "read" && fname != "write" && program->set_function(fname, f.first))
+        continue;
+      if (error == nullptr) {
+        try {
+          error_line_num = f.second;
           invoke_syntax_error("duplicated function name");
-        state = PSStartFunction;
-        break;
+        } catch (...) {
+          error = current_exception();
+        }
       }
+      delete f.first;
     }
+    if (error == nullptr)
+      error = chunk.error;
   }
-
-  input.close();
-
-  if (state != PSEndFunction)
-    invoke_syntax_error("function not ended");
+  if (error != nullptr)
+    rethrow_exception(error);
 
   error_line_num = 0;
 
@@ -730,5 +906,8 @@ Program* parse(const string& filename) {
   if (main->get_nargs() != 0)
     invoke_syntax_error("main function should take 0 arguments");
 
-  return program;
+  program->link();
+  error_line_num = 0;
+
+  return program.release();
 }
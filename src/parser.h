@@ -1,11 +1,23 @@
 #ifndef SWPP_ASM_INTERPRETER_PARSER_H
 #define SWPP_ASM_INTERPRETER_PARSER_H
 
+#include <string>
+#include <string_view>
+
 #include "program.h"
 
 using namespace std;
 
 
-Program* parse(const string& filename);
+// the smallest part of a source that parse_source gives a thread of its own
+#define PARSE_CHUNK_MIN_SIZE (64 << 10)
+
+/** nullptr if filename cannot be read; throws SyntaxError */
+Program* parse(const string& filename, unsigned jobs = 1);
+/**
+ * parses source, read from filename, into a linked Program; throws SyntaxError
+ * at the first error in the source, also when its functions are parsed on jobs threads
+ */
+Program* parse_source(string_view source, const string& filename, unsigned jobs = 1);
 
 #endif //SWPP_ASM_INTERPRETER_PARSER_H
@@ -0,0 +1,104 @@
+#include <algorithm>
+
+#include "profile.h"
+
+
+/** names as in sf-interpreter-inst.log, indexed by Opcode */
+static const char* const OPCODE_NAMES[LEN_OPCODE] = {
+  "Ret", "BrUncond", "BrCond", "Switch",
+  "Malloc", "Free", "Load", "Store",
+  "BinaryOp", "Sum", "UnaryOp", "Select",
+  "Call", "Assert", "Read", "Write"
+};
+
+Profile::Profile(): lines() {}
+
+void Profile::reset(const Program* program) {
+  int max_line = 0;
+  for (auto& f: program->get_function_map())
+    for (auto& bb: f.second->get_bb_map())
+      for (Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next())
+        max_line = max(max_line, stmt->get_line());
+
+  lines.assign(max_line + 1, LineProfile{0, 0.0, 0.0});
+}
+
+const LineProfile& Profile::get_line(int line) const {
+  static const LineProfile empty{0, 0.0, 0.0};
+  if (line < 0 || (size_t)line >= lines.size())
+    return empty;
+  return lines[line];
+}
+
+void Profile::write_report(Output& out, const Program* program) const {
+  struct Entry {
+    const string* fname;
+    string_view bbname;
+    const Stmt* stmt;
+    LineProfile total;
+  };
+
+  // a block is entered once per execution of its first statement
+  vector<Entry> blocks;
+  vector<Entry> hot_lines;
+  for (auto& f: program->get_function_map()) {
+    for (auto& bb: f.second->get_bb_map()) {
+      Entry block{&f.second->get_fname(), bb.first, bb.second, get_line(bb.second->get_line())};
+      block.total.inst_cost = 0.0;
+      block.total.wait_cost = 0.0;
+      for (const Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next()) {
+        const LineProfile& p = get_line(stmt->get_line());
+        block.total.inst_cost += p.inst_cost;
+        block.total.wait_cost += p.wait_cost;
+        if (p.count > 0)
+          hot_lines.push_back(Entry{block.fname, bb.first, stmt, p});
+      }
+      if (block.total.count > 0)
+        blocks.push_back(block);
+    }
+  }
+
+  auto hotter = [](const Entry& a, const Entry& b) {
+    double cost_a = a.total.inst_cost + a.total.wait_cost;
+    double cost_b = b.total.inst_cost + b.total.wait_cost;
+    if (cost_a != cost_b)
+      return cost_a > cost_b;
+    return a.stmt->get_line() < b.stmt->get_line();
+  };
+  sort(blocks.begin(), blocks.end(), hotter);
+  sort(hot_lines.begin(), hot_lines.end(), hotter);
+
+  out.write_str("Block\tLine\tCount\tCost\tWait cost\n");
+  for (auto& e: blocks) {
+    out.write_str(*e.fname);
+    out.write_str(":");
+    out.write_str(e.bbname);
+    out.write_str("\t");
+    out.write_u64(e.stmt->get_line());
+    out.write_str("\t");
+    out.write_u64(e.total.count);
+    out.write_str("\t");
+    out.write_fixed(e.total.inst_cost);
+    out.write_str("\t");
+    out.write_fixed(e.total.wait_cost);
+    out.write_str("\n");
+  }
+
+  out.write_str("\nLine\tInstruction\tBlock\tCount\tCost\tWait cost\n");
+  for (auto& e: hot_lines) {
+    out.write_u64(e.stmt->get_line());
+    out.write_str("\t");
+    out.write_str(OPCODE_NAMES[e.stmt->get_opcode()]);
+    out.write_str("\t");
+    out.write_str(*e.fname);
+    out.write_str(":");
+    out.write_str(e.bbname);
+    out.write_str("\t");
+    out.write_u64(e.total.count);
+    out.write_str("\t");
+    out.write_fixed(e.total.inst_cost);
+    out.write_str("\t");
+    out.write_fixed(e.total.wait_cost);
+    out.write_str("\n");
+  }
+}
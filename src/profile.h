@@ -0,0 +1,46 @@
+#ifndef SWPP_ASM_INTERPRETER_PROFILE_H
+#define SWPP_ASM_INTERPRETER_PROFILE_H
+
+#include <cinttypes>
+#include <vector>
+
+#include "program.h"
+#include "io.h"
+
+using namespace std;
+
+
+/** what was spent on the statement of a single line */
+struct LineProfile {
+  uint64_t count;
+  double inst_cost;
+  double wait_cost;
+};
+
+/** per-line execution profile; basic blocks are summed up from their lines */
+class Profile {
+private:
+  vector<LineProfile> lines;
+
+public:
+  Profile();
+
+  /** clears the profile and makes room for every line of program */
+  void reset(const Program* program);
+
+  void record(int line, double inst_cost, double wait_cost) {
+    if ((size_t)line >= lines.size())
+      lines.resize(line + 1, LineProfile{0, 0.0, 0.0});
+    LineProfile& p = lines[line];
+    p.count++;
+    p.inst_cost += inst_cost;
+    p.wait_cost += wait_cost;
+  }
+
+  const LineProfile& get_line(int line) const;
+
+  /** hot basic blocks and then hot lines, each sorted by total cost */
+  void write_report(Output& out, const Program* program) const;
+};
+
+#endif //SWPP_ASM_INTERPRETER_PROFILE_H
@@ -1,9 +1,23 @@
+#include <algorithm>
+#include <vector>
+
 #include "program.h"
 
 
-Program::Program(): function_map() {}
+Program::Program(): names(), function_map(), filename() {}
+
+Program::~Program() {
+  for (auto& it: function_map)
+    delete it.second;
+}
+
+const string& Program::get_filename() const { return filename; }
+
+void Program::set_filename(const string& _filename) { filename = _filename; }
 
-Function * Program::get_function(const string &fname) {
+const string& Program::intern(string_view name) { return names.intern(name); }
+
+Function * Program::get_function(string_view fname) const {
   auto it = function_map.find(fname);
   if (it == function_map.end())
     return nullptr;
@@ -14,6 +28,20 @@ bool Program::set_function(const string &fname, Function * function) {
   auto it = function_map.find(fname);
   if (it != function_map.end())
     return false;
-  function_map.insert(pair<string, Function*>(fname, function));
+  function_map.insert(pair<string_view, Function*>(fname, function));
   return true;
 }
+
+const map<string_view, Function*>& Program::get_function_map() const { return function_map; }
+
+void Program::link() {
+  // function_map is in name order
+  vector<Function*> functions;
+  for (auto& it: function_map)
+    functions.push_back(it.second);
+  sort(functions.begin(), functions.end(), [](const Function* a, const Function* b) {
+    return a->get_line() < b->get_line();
+  });
+  for (Function* function: functions)
+    function->link(this);
+}
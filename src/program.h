@@ -2,21 +2,37 @@
 #define SWPP_ASM_INTERPRETER_PROGRAM_H
 
 #include <map>
+#include <string>
+#include <string_view>
 
 #include "function.h"
+#include "namepool.h"
 
 using namespace std;
 
 
+/** owns its functions; once linked, it is only read, so executions may share it */
 class Program {
 private:
-  map<string, Function*> function_map;
+  NamePool names;
+  map<string_view, Function*> function_map;
+  // the source file, for error messages
+  string filename;
 
 public:
   Program();
-
-  Function* get_function(const string& fname);
+  ~Program();
+  Program(const Program&) = delete;
+  Program& operator=(const Program&) = delete;
+
+  const string& get_filename() const;
+  void set_filename(const string& _filename);
+  const string& intern(string_view name);
+  Function* get_function(string_view fname) const;
   bool set_function(const string& fname, Function* function);
+  const map<string_view, Function*>& get_function_map() const;
+  /** links its functions in source order, so that an error is reported at its earliest line */
+  void link();
 };
 
 #endif //SWPP_ASM_INTERPRETER_PROGRAM_H
@@ -7,12 +7,23 @@
 using namespace std;
 
 
-RegFile::RegFile(): nargs(0) {
+static_assert(NREGS <= 64, "pending has a bit per register");
+
+RegFile::RegFile(): nargs(0), saved(), frames(), dirty(0), pending(0) {
+  reset();
+}
+
+void RegFile::reset() {
   for (uint64_t& i: regfile)
     i = 0;
   for (double& c: async)
     c = -1.0;
   regfile[RegSp] = STACK_MAX;
+  nargs = 0;
+  saved.clear();
+  frames.clear();
+  dirty = 0;
+  pending = 0;
 }
 
 void RegFile::set_nargs(int _nargs) { nargs = _nargs; }
@@ -20,23 +31,37 @@ void RegFile::set_nargs(int _nargs) { nargs = _nargs; }
 void RegFile::set_value(Reg reg, uint64_t val) {
   if (reg == RegNone)
     return;
+  save(reg);
   regfile[reg] = val;
 }
 
 double RegFile::resolve_async(Reg reg) {
-  if (!is_writable(reg))
+  // only writable registers are ever pending
+  if (!((pending >> reg) & 1))
     return -1.0;
   double wait_until = async[reg];
+  save(reg);
   async[reg] = -1.0;
+  pending &= ~((uint64_t)1 << reg);
   return wait_until;
 }
 
-pair<uint64_t, double> RegFile::read_reg(Reg reg) {
+void RegFile::invalid_read(Reg reg) const {
+  if (reg == RegNone)
+    invoke_runtime_error("reading an unknown register");
+  invoke_runtime_error("reading out-of-range argument");
+}
+
+pair<uint64_t, double> RegFile::peek_reg(Reg reg) const {
   if (reg == RegNone)
     invoke_runtime_error("reading an unknown register");
   if ((int)A1 + nargs <= reg && reg <= A16)
     invoke_runtime_error("reading out-of-range argument");
-  return make_pair(regfile[reg], this->resolve_async(reg));
+  return make_pair(regfile[reg], is_writable(reg) ? async[reg] : -1.0);
+}
+
+void RegFile::drop_async(Reg reg) {
+  resolve_async(reg);
 }
 
 void RegFile::write_reg(Reg reg, uint64_t val) {
@@ -45,6 +70,7 @@ void RegFile::write_reg(Reg reg, uint64_t val) {
   if (A1 <= reg && reg <= A16)
     invoke_runtime_error("writing to a read-only register");
   resolve_async(reg);
+  save(reg);
   regfile[reg] = val;
 }
 
@@ -55,7 +81,9 @@ void RegFile::set_async(Reg reg, double cost) {
     invoke_runtime_error("writing to a read-only register");
   if (is_writable(reg) && async[reg] >= 0)
     invoke_runtime_error("writing to a register that is waiting for async load to be resolved");
+  save(reg);
   async[reg] = cost;
+  pending |= (uint64_t)1 << reg;
 }
 
 string RegFile::to_string() const {
@@ -68,3 +96,26 @@ string RegFile::to_string() const {
 
   return ss.str();
 }
+
+void RegFile::push_frame(int _nargs) {
+  frames.push_back(Frame{saved.size(), dirty, nargs});
+  dirty = 0;
+  nargs = _nargs;
+}
+
+void RegFile::pop_frame() {
+  Frame& frame = frames.back();
+  while (saved.size() > frame.saved_base) {
+    SavedReg& reg = saved.back();
+    regfile[reg.reg] = reg.val;
+    async[reg.reg] = reg.async;
+    if (reg.async != -1.0)
+      pending |= (uint64_t)1 << reg.reg;
+    else
+      pending &= ~((uint64_t)1 << reg.reg);
+    saved.pop_back();
+  }
+  dirty = frame.dirty;
+  nargs = frame.nargs;
+  frames.pop_back();
+}
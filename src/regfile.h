@@ -4,6 +4,7 @@
 #include <cinttypes>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "reg.h"
 
@@ -12,14 +13,43 @@ using namespace std;
 
 class RegFile {
 private:
+  struct SavedReg {
+    Reg reg;
+    uint64_t val;
+    double async;
+  };
+
+  struct Frame {
+    size_t saved_base;
+    uint64_t dirty;
+    int nargs;
+  };
+
   uint64_t regfile[NREGS];
   double async[NREGS];
   int nargs;
 
+  // registers of the callers, saved on the first write in each call frame
+  vector<SavedReg> saved;
+  vector<Frame> frames;
+  uint64_t dirty;
+  // one bit per register whose async[] is set, so that reads skip the wait otherwise
+  uint64_t pending;
+
+  void save(Reg reg) {
+    if ((dirty >> reg) & 1)
+      return;
+    dirty |= (uint64_t)1 << reg;
+    saved.push_back(SavedReg{reg, regfile[reg], async[reg]});
+  }
+
   double resolve_async(Reg reg);
+  [[noreturn]] void invalid_read(Reg reg) const;
 
 public:
   RegFile();
+  /** the state of a new RegFile, keeping the capacity of the frame stack */
+  void reset();
 
   static bool is_writable(Reg reg) {
     return (R1 <= reg && reg <= R32) || (reg == RegSp);
@@ -27,10 +57,39 @@ public:
 
   void set_nargs(int _nargs);
   void set_value(Reg reg, uint64_t val);
-  pair<uint64_t, double> read_reg(Reg reg);
+  pair<uint64_t, double> read_reg(Reg reg) {
+    if (reg == RegNone || ((int)A1 + nargs <= reg && reg <= A16))
+      invalid_read(reg);
+    return read_valid_reg(reg);
+  }
+  /** read_reg without its checks, for a register known to be readable in the current function */
+  pair<uint64_t, double> read_valid_reg(Reg reg) {
+    if (!((pending >> reg) & 1))
+      return make_pair(regfile[reg], -1.0);
+    return make_pair(regfile[reg], resolve_async(reg));
+  }
+  pair<uint64_t, double> peek_reg(Reg reg) const;
+  /** whether some register waits for an aload */
+  bool has_pending() const { return pending != 0; }
+  /** for native code, which reads the values in place and writes them while their register is dirty */
+  uint64_t* get_values() { return regfile; }
+  const uint64_t* get_dirty() const { return &dirty; }
+  void drop_async(Reg reg);
   void write_reg(Reg reg, uint64_t val);
+  /** write_reg without the check for argument registers, for a reg known not to be one */
+  void write_valid_reg(Reg reg, uint64_t val) {
+    if (reg == RegNone)
+      return;
+    if ((pending >> reg) & 1)
+      resolve_async(reg);
+    save(reg);
+    regfile[reg] = val;
+  }
   void set_async(Reg reg, double cost);
   string to_string() const;
+
+  void push_frame(int _nargs);
+  void pop_frame();
 };
 
 #endif //SWPP_ASM_INTERPRETER_REGFILE_H
@@ -0,0 +1,264 @@
+#include <cmath>
+#include <cstring>
+
+#include "bytereader.h"
+#include "sampler.h"
+#include "mappedfile.h"
+
+
+const static char SAMPLES_MAGIC[4] = {'S', 'F', 'S', 'P'};
+const static uint32_t SAMPLES_BOM = 0x01020304;
+
+template<typename T>
+static void put(Output& out, T val) {
+  out.write_str(string_view((const char*)&val, sizeof(T)));
+}
+
+static void put_str(Output& out, const string& str) {
+  put<uint32_t>(out, str.length());
+  out.write_str(str);
+}
+
+Sampler::Sampler(): period(0), next(0), filename(), function_of(), names(), name_ids(), stack_ids(), stacks(),
+counts(), chain() {}
+
+void Sampler::reset(const Program* program, double _period) {
+  period = _period;
+  next = _period;
+  filename = program->get_filename();
+  function_of.clear();
+  for (auto& f: program->get_function_map()) {
+    for (auto& bb: f.second->get_bb_map()) {
+      for (const Stmt* stmt = bb.second; stmt != nullptr; stmt = stmt->get_next()) {
+        if ((size_t)stmt->get_line() >= function_of.size())
+          function_of.resize(stmt->get_line() + 1, nullptr);
+        function_of[stmt->get_line()] = &f.second->get_fname();
+      }
+    }
+  }
+  names.clear();
+  name_ids.clear();
+  stack_ids.clear();
+  stacks.clear();
+  counts.clear();
+}
+
+uint32_t Sampler::name_id(const string& name) {
+  auto it = name_ids.find(&name);
+  if (it != name_ids.end())
+    return it->second;
+  names.push_back(name);
+  name_ids.emplace(&name, names.size() - 1);
+  return names.size() - 1;
+}
+
+void Sampler::record(const string& fname, int line, double total_cost) {
+  if (total_cost < next)
+    return;
+  // a basic block may pass several periods at once
+  uint64_t n = (uint64_t)((total_cost - next) / period) + 1;
+  next += n * period;
+
+  // after a return, fname is the caller and line the return of the callee
+  const string* fname_of_line = (size_t)line < function_of.size() ? function_of[line] : nullptr;
+  if (fname_of_line == nullptr || *fname_of_line == fname)
+    push_frame(fname, line);
+  else {
+    push_frame(fname, 0);
+    push_frame(*fname_of_line, line);
+  }
+
+  auto it = stack_ids.find(chain);
+  if (it == stack_ids.end()) {
+    it = stack_ids.emplace(chain, stacks.size()).first;
+    stacks.push_back(&it->first);
+    counts.push_back(0);
+  }
+  counts[it->second] += n;
+}
+
+void Sampler::write(Output& out) const {
+  out.write_str(string_view(SAMPLES_MAGIC, sizeof(SAMPLES_MAGIC)));
+  put<uint32_t>(out, SAMPLES_VERSION);
+  put<uint32_t>(out, SAMPLES_BOM);
+  put<double>(out, period);
+  put_str(out, filename);
+
+  put<uint32_t>(out, names.size());
+  for (auto& name: names)
+    put_str(out, name);
+
+  put<uint32_t>(out, stacks.size());
+  for (size_t i = 0; i < stacks.size(); i++) {
+    put<uint32_t>(out, stacks[i]->size());
+    for (auto& frame: *stacks[i]) {
+      put<uint32_t>(out, frame.name);
+      put<int32_t>(out, frame.line);
+    }
+    put<uint64_t>(out, counts[i]);
+  }
+}
+
+bool Sampler::read(const string& samples_file) {
+  MappedFile input(samples_file);
+  if (!input.is_open())
+    return false;
+
+  ByteReader r(input.contents());
+  char magic[sizeof(SAMPLES_MAGIC)];
+  for (char& c: magic)
+    c = r.get<char>();
+  if (memcmp(magic, SAMPLES_MAGIC, sizeof(SAMPLES_MAGIC)) != 0 || r.get<uint32_t>() != SAMPLES_VERSION ||
+      r.get<uint32_t>() != SAMPLES_BOM || !r.is_ok())
+    return false;
+  period = r.get<double>();
+  next = 0;
+  filename = r.get_str();
+  function_of.clear();
+  name_ids.clear();
+
+  names.clear();
+  uint32_t nnames = r.get_count(4);
+  for (uint32_t i = 0; i < nnames; i++)
+    names.push_back(r.get_str());
+
+  stack_ids.clear();
+  stacks.clear();
+  counts.clear();
+  uint32_t nstacks = r.get_count(12);
+  for (uint32_t i = 0; i < nstacks && r.is_ok(); i++) {
+    vector<SampleFrame> frames(r.get_count(8));
+    for (auto& frame: frames) {
+      frame.name = r.get<uint32_t>();
+      frame.line = r.get<int32_t>();
+      if (frame.name >= names.size())
+        return false;
+    }
+    uint64_t count = r.get<uint64_t>();
+    auto it = stack_ids.emplace(move(frames), stacks.size());
+    if (!it.second)
+      return false;
+    stacks.push_back(&it.first->first);
+    counts.push_back(count);
+  }
+  return r.is_ok() && r.at_end();
+}
+
+void Sampler::write_collapsed(Output& out, bool lines) const {
+  // chains that differ only in their lines are merged
+  map<string, uint64_t> collapsed;
+  for (size_t i = 0; i < stacks.size(); i++) {
+    string key;
+    for (auto& frame: *stacks[i]) {
+      if (!key.empty())
+        key += ';';
+      key += names[frame.name];
+      if (lines && frame.line != 0)
+        key += ":" + to_string(frame.line);
+    }
+    collapsed[key] += counts[i];
+  }
+  for (auto& it: collapsed) {
+    out.write_str(it.first);
+    out.write_str(" ");
+    out.write_u64(it.second);
+    out.write_str("\n");
+  }
+}
+
+/** protobuf wire format, as much of it as profile.proto needs */
+class ProtoWriter {
+private:
+  string bytes;
+
+public:
+  ProtoWriter(): bytes() {}
+
+  const string& get_bytes() const { return bytes; }
+
+  void put_varint(uint64_t val) {
+    while (val >= 0x80) {
+      bytes += (char)(val | 0x80);
+      val >>= 7;
+    }
+    bytes += (char)val;
+  }
+
+  void put_varint(int field, uint64_t val) {
+    put_varint((uint64_t)field << 3);
+    put_varint(val);
+  }
+
+  void put_bytes(int field, const string& val) {
+    put_varint((uint64_t)field << 3 | 2);
+    put_varint(val.length());
+    bytes += val;
+  }
+
+  void put_message(int field, const ProtoWriter& message) { put_bytes(field, message.bytes); }
+
+  void put_packed(int field, const vector<uint64_t>& vals) {
+    ProtoWriter packed;
+    for (uint64_t val: vals)
+      packed.put_varint(val);
+    put_bytes(field, packed.bytes);
+  }
+};
+
+static ProtoWriter value_type(uint64_t type, uint64_t unit) {
+  ProtoWriter vt;
+  vt.put_varint(1, type);
+  vt.put_varint(2, unit);
+  return vt;
+}
+
+void Sampler::write_pprof(Output& out) const {
+  // the string table begins with "", the fixed strings, and then the function names
+  vector<string> strings = {"", "samples", "count", "cost", "units", filename};
+  const uint64_t SAMPLES = 1, COUNT = 2, COST = 3, UNITS = 4, FILENAME = 5;
+  uint64_t first_name = strings.size();
+  strings.insert(strings.end(), names.begin(), names.end());
+
+  ProtoWriter profile;
+  profile.put_message(1, value_type(SAMPLES, COUNT));
+  profile.put_message(1, value_type(COST, UNITS));
+
+  // a location per function and line, numbered from 1
+  map<SampleFrame, uint64_t> locations;
+  for (size_t i = 0; i < stacks.size(); i++) {
+    vector<uint64_t> location_ids;
+    // leaf first
+    for (auto it = stacks[i]->rbegin(); it != stacks[i]->rend(); it++)
+      location_ids.push_back(locations.emplace(*it, locations.size() + 1).first->second);
+    ProtoWriter sample;
+    sample.put_packed(1, location_ids);
+    sample.put_packed(2, {counts[i], (uint64_t)llround(counts[i] * period)});
+    profile.put_message(2, sample);
+  }
+
+  for (auto& it: locations) {
+    ProtoWriter line;
+    line.put_varint(1, it.first.name + 1);
+    line.put_varint(2, it.first.line);
+    ProtoWriter location;
+    location.put_varint(1, it.second);
+    location.put_message(4, line);
+    profile.put_message(4, location);
+  }
+
+  for (uint32_t i = 0; i < names.size(); i++) {
+    ProtoWriter function;
+    function.put_varint(1, i + 1);
+    function.put_varint(2, first_name + i);
+    function.put_varint(3, first_name + i);
+    function.put_varint(4, FILENAME);
+    profile.put_message(5, function);
+  }
+
+  for (auto& str: strings)
+    profile.put_bytes(6, str);
+  profile.put_message(11, value_type(COST, UNITS));
+  profile.put_varint(12, (uint64_t)llround(period));
+
+  out.write_str(profile.get_bytes());
+}
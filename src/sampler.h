@@ -0,0 +1,78 @@
+#ifndef SWPP_ASM_INTERPRETER_SAMPLER_H
+#define SWPP_ASM_INTERPRETER_SAMPLER_H
+
+#include <cinttypes>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "program.h"
+#include "io.h"
+
+using namespace std;
+
+
+#define SAMPLES_VERSION 1
+
+/** a function of the call chain and the line it is at, its call for the callers */
+struct SampleFrame {
+  uint32_t name;
+  int line;
+
+  bool operator<(const SampleFrame& other) const {
+    return name != other.name ? name < other.name : line < other.line;
+  }
+};
+
+/**
+ * samples of the call chain every period units of simulated cost, taken at the
+ * budget checks of the engines and counted by chain; stored in the binary
+ * sf-interpreter-samples.bin, which read() loads again for converting
+ */
+class Sampler {
+private:
+  double period;
+  double next;
+  string filename;
+  // the function of each line of the program
+  vector<const string*> function_of;
+  vector<string> names;
+  unordered_map<const string*, uint32_t> name_ids;
+  // the chains, root first, and how often each was sampled
+  map<vector<SampleFrame>, uint32_t> stack_ids;
+  vector<const vector<SampleFrame>*> stacks;
+  vector<uint64_t> counts;
+  vector<SampleFrame> chain;
+
+  uint32_t name_id(const string& name);
+
+public:
+  Sampler();
+
+  /** clears the samples and takes the first one once period has been spent in program */
+  void reset(const Program* program, double _period);
+  /** the cost of the next sample */
+  double get_next() const { return next; }
+
+  /** starts the chain of the next sample, root first */
+  void begin_chain() { chain.clear(); }
+  void push_frame(const string& fname, int line) { chain.push_back(SampleFrame{name_id(fname), line}); }
+  /**
+   * the chain ends in fname at line, the last transfer; samples the periods
+   * that total_cost has passed
+   */
+  void record(const string& fname, int line, double total_cost);
+
+  /** sf-interpreter-samples.bin */
+  void write(Output& out) const;
+  /** loads what write() wrote; false if the file is missing or corrupted */
+  bool read(const string& samples_file);
+  /** collapsed stacks with their sample counts, by function or by function and line */
+  void write_collapsed(Output& out, bool lines) const;
+  /** an uncompressed pprof profile.proto */
+  void write_pprof(Output& out) const;
+};
+
+#endif //SWPP_ASM_INTERPRETER_SAMPLER_H
@@ -0,0 +1,47 @@
+#include "sfprogram.h"
+#include "error.h"
+#include "parser.h"
+
+
+SfProgram::SfProgram(Program* _program): program(_program), bytecode(new Bytecode(_program)) {}
+
+shared_ptr<const SfProgram> SfProgram::parse(string_view source, const string& filename) {
+  return make_shared<const SfProgram>(parse_source(source, filename));
+}
+
+const Program& SfProgram::get_program() const { return *program; }
+
+SfResult SfProgram::exec(State& state, const ExecOptions& options, function<size_t(char* buf, size_t size)> read,
+                         function<void(const char* data, size_t size)> write) const {
+  SfResult result{false, false, 0, "", 0, 0, 0, 0, 0, {}, {}};
+  CallbackInput in(move(read));
+  CallbackOutput out(move(write));
+
+  state.reset();
+  state.set_program(program.get());
+  state.set_options(options);
+  state.set_io(in, out);
+
+  try {
+    result.ret = state.exec_bytecode(*bytecode);
+    result.ok = true;
+  } catch (BudgetExceeded& e) {
+    result.budget_exceeded = true;
+    result.error = e.what();
+  } catch (ExecutionError& e) {
+    result.error = e.what();
+  }
+  out.flush();
+
+  // the bytecode engine makes the root of the cost tree before anything can fail
+  result.cost = state.get_cost_value();
+  result.wait_cost = state.get_total_wait_cost();
+  result.max_heap = state.get_max_alloced_size();
+  result.total_cost = result.cost + result.max_heap * 16.0;
+  result.inst_count = state.get_inst_count();
+  for (int i = 0; i < Opcode::LEN_OPCODE; i++) {
+    result.inst_counts[i] = state.get_inst_count((Opcode)i);
+    result.inst_costs[i] = state.get_inst_cost((Opcode)i);
+  }
+  return result;
+}
@@ -0,0 +1,69 @@
+#ifndef SWPP_ASM_INTERPRETER_SFPROGRAM_H
+#define SWPP_ASM_INTERPRETER_SFPROGRAM_H
+
+#include <cinttypes>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "opcode.h"
+#include "program.h"
+#include "bytecode.h"
+#include "state.h"
+#include "error.h"
+
+using namespace std;
+
+
+/** outcome of SfProgram::exec, with the numbers of sf-interpreter.log and -inst.log */
+struct SfResult {
+  // false after a runtime error, a failed assertion or an exceeded budget
+  bool ok;
+  bool budget_exceeded;
+  uint64_t ret;
+  // the report the interpreter prints, empty if ok
+  string error;
+  // the costs so far if the execution stopped early
+  double cost;
+  double wait_cost;
+  uint64_t max_heap;
+  // cost + max_heap * 16, as the grader scores it
+  double total_cost;
+  uint64_t inst_count;
+  // by Opcode
+  uint64_t inst_counts[Opcode::LEN_OPCODE];
+  double inst_costs[Opcode::LEN_OPCODE];
+};
+
+/**
+ * entry point of libsfinterp: a parsed program and its bytecode, never modified
+ * once built, so one instance may run on any number of threads at once, each
+ * with its own State
+ */
+class SfProgram {
+private:
+  unique_ptr<const Program> program;
+  unique_ptr<const Bytecode> bytecode;
+
+public:
+  /** takes ownership of a linked program */
+  explicit SfProgram(Program* _program);
+  SfProgram(const SfProgram&) = delete;
+  SfProgram& operator=(const SfProgram&) = delete;
+
+  /** parses source, named filename in error messages; throws SyntaxError */
+  static shared_ptr<const SfProgram> parse(string_view source, const string& filename);
+
+  const Program& get_program() const;
+
+  /**
+   * runs the program on the bytecode engine with a reset state and options;
+   * read fills up to size bytes of buf and returns how many, 0 at the end of
+   * the input, and write receives the output, all of it by the time exec returns
+   */
+  SfResult exec(State& state, const ExecOptions& options, function<size_t(char* buf, size_t size)> read,
+                function<void(const char* data, size_t size)> write) const;
+};
+
+#endif //SWPP_ASM_INTERPRETER_SFPROGRAM_H
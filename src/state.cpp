@@ -1,40 +1,215 @@
 #include <sstream>
 #include <iomanip>
+#include <new>
 
 #include "state.h"
 #include "error.h"
 
 
-CostStack::CostStack(const string &_fname): fname(_fname), cost(0), callees() {}
+CostStack::CostStack(const string &_fname): fname(_fname), cost(0), calls(0), callees() {}
+
+const string& CostStack::get_fname() const { return fname; }
 
 double CostStack::get_cost() const { return cost; }
 
+uint64_t CostStack::get_calls() const { return calls; }
+
+void CostStack::add_call(double _cost) {
+  cost += _cost;
+  calls++;
+}
+
 void CostStack::add_cost(double _cost) { cost += _cost; }
 
 void CostStack::set_callee(CostStack *callee) {
   callees.push_back(callee);
 }
 
-string CostStack::to_string(const string& indent) const {
-  stringstream ss;
-  ss << fixed << setprecision(4);
-  ss << indent << fname << ": " << cost << endl;
-  for (auto it: callees)
-    ss << it->to_string(indent + "| ");
-  return ss.str();
+CostStack* CostStack::find_callee(const string& _fname) const {
+  // names are interned, so equal names are the same string
+  for (auto callee: callees)
+    if (&callee->fname == &_fname)
+      return callee;
+  return nullptr;
+}
+
+void CostStack::write_text(Output& out, bool show_calls) const {
+  // walk the tree without recursion, as calls can be nested arbitrarily deep
+  vector<pair<const CostStack*, size_t>> stack;
+  stack.emplace_back(this, 0);
+  while (!stack.empty()) {
+    const CostStack* node = stack.back().first;
+    size_t depth = stack.back().second;
+    stack.pop_back();
+
+    for (size_t i = 0; i < depth; i++)
+      out.write_str("| ");
+    out.write_str(node->fname);
+    out.write_str(": ");
+    out.write_fixed(node->cost);
+    if (show_calls) {
+      out.write_str(" (calls: ");
+      out.write_u64(node->calls);
+      out.write_str(")");
+    }
+    out.write_str("\n");
+
+    for (auto it = node->callees.rbegin(); it != node->callees.rend(); it++)
+      stack.emplace_back(*it, depth + 1);
+  }
 }
 
+void CostStack::write_json_lines(Output& out) const {
+  struct Entry {
+    const CostStack* node;
+    uint64_t depth;
+    int64_t parent;
+  };
+
+  // function names only contain [A-Za-z0-9._-], so they need no escaping
+  vector<Entry> stack;
+  stack.push_back(Entry{this, 0, -1});
+  int64_t id = 0;
+  while (!stack.empty()) {
+    Entry entry = stack.back();
+    stack.pop_back();
+
+    out.write_str("{\"id\":");
+    out.write_u64(id);
+    out.write_str(",\"parent\":");
+    if (entry.parent < 0)
+      out.write_str("null");
+    else
+      out.write_u64(entry.parent);
+    out.write_str(",\"depth\":");
+    out.write_u64(entry.depth);
+    out.write_str(",\"function\":\"");
+    out.write_str(entry.node->fname);
+    out.write_str("\",\"cost\":");
+    out.write_fixed(entry.node->cost);
+    out.write_str(",\"calls\":");
+    out.write_u64(entry.node->calls);
+    out.write_str("}\n");
+
+    for (auto it = entry.node->callees.rbegin(); it != entry.node->callees.rend(); it++)
+      stack.push_back(Entry{*it, entry.depth + 1, id});
+    id++;
+  }
+}
+
+void CostStack::write_collapsed(Output& out) const {
+  // one entry per node with the path leading to it, e.g. "main;fib;fib"
+  vector<pair<const CostStack*, size_t>> stack;
+  string path;
+  stack.emplace_back(this, 0);
+  while (!stack.empty()) {
+    const CostStack* node = stack.back().first;
+    size_t length = stack.back().second;
+    stack.pop_back();
+
+    path.resize(length);
+    if (length > 0)
+      path += ';';
+    path += node->fname;
+
+    double self_cost = node->cost;
+    for (auto callee: node->callees)
+      self_cost -= callee->cost;
+    out.write_str(path);
+    out.write_str(" ");
+    out.write_fixed(max(self_cost, 0.0));
+    out.write_str("\n");
+
+    for (auto it = node->callees.rbegin(); it != node->callees.rend(); it++)
+      stack.emplace_back(*it, path.length());
+  }
+}
+
+
+#define COST_ARENA_BLOCK 4096
 
-State::State(): regfile(), memory(), main_cost(nullptr), total_wait_cost(0), program(nullptr) {
+CostArena::CostArena(): blocks(), used(COST_ARENA_BLOCK) {}
+
+CostArena::~CostArena() {
+  for (size_t i = 0; i < blocks.size(); i++) {
+    size_t n = i + 1 == blocks.size() ? used : COST_ARENA_BLOCK;
+    for (size_t j = 0; j < n; j++)
+      blocks[i][j].~CostStack();
+    ::operator delete(blocks[i]);
+  }
+}
+
+void CostArena::reset() {
+  for (size_t i = 0; i < blocks.size(); i++) {
+    size_t n = i + 1 == blocks.size() ? used : COST_ARENA_BLOCK;
+    for (size_t j = 0; j < n; j++)
+      blocks[i][j].~CostStack();
+    if (i > 0)
+      ::operator delete(blocks[i]);
+  }
+  if (blocks.empty())
+    return;
+  blocks.resize(1);
+  used = 0;
+}
+
+CostStack* CostArena::alloc(const string& fname) {
+  if (used == COST_ARENA_BLOCK) {
+    blocks.push_back(static_cast<CostStack*>(::operator new(sizeof(CostStack) * COST_ARENA_BLOCK)));
+    used = 0;
+  }
+  return new (&blocks.back()[used++]) CostStack(fname);
+}
+
+
+State::State(): regfile(), memory(), cost_arena(), main_cost(nullptr), executed(0),
+inst_limit(numeric_limits<uint64_t>::max()), cost_limit(numeric_limits<double>::infinity()),
+check_cost(numeric_limits<double>::infinity()), total_wait_cost(0), program(nullptr), options(),
+input(&std_input()), output(&std_output()), profile(), abort_reason(), first_read_hook() {
   for (double& c: cost_per_inst)
     c = 0.0;
-  for (int& c: inst_count)
+  for (uint64_t& c: inst_count)
     c = 0;
 }
 
-void State::set_program(Program* _program) {
-  if (program == nullptr)
-    program = _program;
+State::~State() {}
+
+void State::reset() {
+  regfile.reset();
+  memory.reset();
+  cost_arena.reset();
+  main_cost = nullptr;
+  for (double& c: cost_per_inst)
+    c = 0.0;
+  for (uint64_t& c: inst_count)
+    c = 0;
+  executed = 0;
+  total_wait_cost = 0;
+  abort_reason.clear();
+}
+
+void State::set_program(const Program* _program) {
+  program = _program;
+}
+
+void State::set_options(const ExecOptions& _options) {
+  options = _options;
+  inst_limit = options.max_insts != 0 ? options.max_insts : numeric_limits<uint64_t>::max();
+  cost_limit = options.max_cost != 0 ? options.max_cost : numeric_limits<double>::infinity();
+  check_cost = cost_limit;
+}
+
+void State::set_io(Input& _input, Output& _output) {
+  input = &_input;
+  output = &_output;
+}
+
+void State::set_first_read_hook(function<void()> hook) { first_read_hook = move(hook); }
+
+void State::run_first_read_hook() {
+  function<void()> hook = move(first_read_hook);
+  first_read_hook = nullptr;
+  hook();
 }
 
 double State::get_cost_value() const { return main_cost->get_cost(); }
@@ -45,18 +220,74 @@ uint64_t State::get_max_alloced_size() const {
   return memory.get_max_alloced_size();
 }
 
+CostStack* State::enter_callee(CostStack* caller, const string& fname) {
+  if (options.cost_tree_mode == CostTreeContext) {
+    CostStack* callee = caller->find_callee(fname);
+    if (callee != nullptr)
+      return callee;
+  }
+
+  CostStack* callee = cost_arena.alloc(fname);
+  caller->set_callee(callee);
+  return callee;
+}
+
+template <typename Frame>
+void State::abort_on_budget(CostStack* cost, double frame_cost, const vector<Frame>& frames) {
+  // each caller has spent its cost before the call and what its callee has spent so far
+  cost->add_cost(frame_cost);
+  for (auto it = frames.rbegin(); it != frames.rend(); it++) {
+    frame_cost = it->cost_acc + frame_cost;
+    it->cost->add_cost(frame_cost);
+  }
+
+  if (executed > inst_limit)
+    abort_reason = "exceeding the instruction limit";
+  else
+    abort_reason = "exceeding the cost limit";
+  invoke_budget_exceeded(abort_reason);
+}
+
+template <typename Frame>
+void State::on_budget(CostStack* cost, double frame_cost, double base_cost, const vector<Frame>& frames) {
+  double total_cost = base_cost + frame_cost;
+  if (executed > inst_limit || total_cost > cost_limit)
+    abort_on_budget(cost, frame_cost, frames);
+
+  // the callers with their calls, then the transfer the check is at
+  sampler.begin_chain();
+  for (auto& frame: frames)
+    sampler.push_frame(frame.cost->get_fname(), call_line(frame));
+  sampler.record(cost->get_fname(), error_line_num, total_cost);
+  check_cost = min(cost_limit, sampler.get_next());
+}
+
+// once per basic block; base_cost is what the callers on the stack had spent before their calls
+#define CHECK_BUDGET() \
+  if (over_budget(base_cost + frame_cost)) \
+    on_budget(cost, frame_cost, base_cost, frames)
+
+template <bool PROFILE>
 void State::update_cost_log(Opcode opcode, double inst_cost, double wait_cost) {
   cost_per_inst[opcode] += inst_cost;
   inst_count[opcode]++;
+  executed++;
   total_wait_cost += wait_cost;
+  // every engine sets error_line_num to the executing statement first
+  if (PROFILE && options.profile)
+    profile.record(error_line_num, inst_cost, wait_cost);
+  if (PROFILE && options.aload_report)
+    aload_advisor.record(error_line_num, opcode, inst_cost, wait_cost, regfile);
 }
 
-uint64_t State::exec_function(CostStack* parent, Function* function) {
-  auto cost = new CostStack(function->get_fname());
-  if (parent == nullptr)
-    main_cost = cost;
-  else
-    parent->set_callee(cost);
+template <bool PROFILE>
+uint64_t State::exec_function(Function* function) {
+  vector<CallFrame> frames;
+  auto cost = cost_arena.alloc(function->get_fname());
+  main_cost = cost;
+  // the cost of the current call so far, which is also its clock for async loads
+  double frame_cost = 0;
+  double base_cost = 0;
 
   Stmt* curr = function->get_first_bb();
   if (curr == nullptr)
@@ -68,97 +299,673 @@ uint64_t State::exec_function(CostStack* parent, Function* function) {
     switch (curr->get_opcode()) {
       case Ret: {
         auto stmt = dynamic_cast<StmtRet*>(curr);
-        auto ret = stmt->get_val(cost->get_cost(), regfile);
-        cost->add_cost(Cost::RET + ret.second);
-        update_cost_log(Ret, Cost::RET, ret.second);
-        if (parent != nullptr)
-          parent->add_cost(cost->get_cost());
-        return ret.first;
+        auto ret = stmt->get_val(frame_cost, regfile);
+        frame_cost += Cost::RET + ret.second;
+        update_cost_log<PROFILE>(Ret, Cost::RET, ret.second);
+        cost->add_call(frame_cost);
+        if (frames.empty())
+          return ret.first;
+
+        CallFrame& frame = frames.back();
+        base_cost -= frame.cost_acc;
+        frame_cost = frame.cost_acc + frame_cost;
+        frame.call->release_args(regfile);
+        regfile.write_reg(frame.lhs, ret.first);
+        cost = frame.cost;
+        curr = frame.ret;
+        frames.pop_back();
+        CHECK_BUDGET();
+        break;
       }
       case BrUncond: {
         auto stmt = dynamic_cast<StmtBrUncond*>(curr);
-        string bb = stmt->get_bb();
-        curr = function->get_bb(bb);
-        if (curr == nullptr) {
-          invoke_runtime_error("branching to an undefined basic block");
-          return 0;
-        }
-        cost->add_cost(Cost::BRUNCOND);
-        update_cost_log(BrUncond, Cost::BRUNCOND, 0);
+        curr = stmt->get_bb();
+        frame_cost += Cost::BRUNCOND;
+        update_cost_log<PROFILE>(BrUncond, Cost::BRUNCOND, 0);
+        CHECK_BUDGET();
         break;
       }
       case BrCond: {
         auto stmt = dynamic_cast<StmtBrCond*>(curr);
-        auto bb = stmt->get_bb(cost->get_cost(), regfile);
-        curr = function->get_bb(bb.first);
-        if (curr == nullptr) {
-          invoke_runtime_error("branching to an undefined basic block");
-          return 0;
-        }
-        double inst_cost = stmt->get_eval() ? Cost::BRCOND_TRUE : Cost::BRCOND_FALSE;
-        cost->add_cost(inst_cost + bb.second);
-        update_cost_log(BrCond, inst_cost, bb.second);
+        bool eval;
+        auto bb = stmt->get_bb(frame_cost, regfile, eval);
+        curr = bb.first;
+        double inst_cost = eval ? Cost::BRCOND_TRUE : Cost::BRCOND_FALSE;
+        frame_cost += inst_cost + bb.second;
+        update_cost_log<PROFILE>(BrCond, inst_cost, bb.second);
+        CHECK_BUDGET();
         break;
       }
       case Switch: {
         auto stmt = dynamic_cast<StmtSwitch*>(curr);
-        auto bb = stmt->get_bb(cost->get_cost(), regfile);
-        curr = function->get_bb(bb.first);
-        if (curr == nullptr) {
-          invoke_runtime_error("branching to an undefined basic block");
-          return 0;
-        }
-        cost->add_cost(Cost::SWITCH + bb.second);
-        update_cost_log(Switch, Cost::SWITCH, bb.second);
+        auto bb = stmt->get_bb(frame_cost, regfile);
+        curr = bb.first;
+        frame_cost += Cost::SWITCH + bb.second;
+        update_cost_log<PROFILE>(Switch, Cost::SWITCH, bb.second);
+        CHECK_BUDGET();
         break;
       }
       case Call: {
         auto stmt = dynamic_cast<StmtCall*>(curr);
-        string fname = stmt->get_fname();
-        Function* callee = program->get_function(fname);
-        if (callee == nullptr) {
-          invoke_runtime_error("calling an undefined function");
-          return 0;
-        }
+        Function* callee = stmt->get_callee();
 
         int nargs = callee->get_nargs();
         if (nargs != stmt->get_nargs()) {
           invoke_runtime_error("calling with incorrect number of arguments");
           return 0;
         }
+        if (options.max_call_depth != 0 && frames.size() >= options.max_call_depth) {
+          invoke_runtime_error("exceeding the maximum call depth");
+          return 0;
+        }
 
-        RegFile old = regfile;
-
-        regfile.set_nargs(nargs);
-        double wait_cost = stmt->setup_args(cost->get_cost(), old, regfile);
+        double wait_cost = stmt->setup_args(frame_cost, regfile, nargs);
         double inst_cost = Cost::CALL + nargs * Cost::PER_ARG;
-        cost->add_cost(inst_cost + wait_cost);
-        update_cost_log(Call, inst_cost, wait_cost);
-        uint64_t ret = exec_function(cost, callee);
-        regfile = old;
-        regfile.write_reg(curr->get_lhs(), ret);
-
-        curr = stmt->get_next();
+        frame_cost += inst_cost + wait_cost;
+        update_cost_log<PROFILE>(Call, inst_cost, wait_cost);
+        CHECK_BUDGET();
+        frames.push_back(CallFrame{stmt->get_next(), stmt->get_lhs(), stmt, cost, frame_cost});
+        base_cost += frame_cost;
+        cost = enter_callee(cost, callee->get_fname());
+        frame_cost = 0;
+        curr = callee->get_first_bb();
+        if (curr == nullptr)
+          invoke_runtime_error("missing first basic block");
+        break;
+      }
+      case Read: {
+        if (first_read_hook)
+          run_first_read_hook();
+        auto costs = dynamic_cast<StmtRead*>(curr)->read(regfile, *input);
+        frame_cost += costs.first + costs.second;
+        update_cost_log<PROFILE>(Read, costs.first, costs.second);
+        curr = curr->get_next();
+        break;
+      }
+      case Write: {
+        auto costs = dynamic_cast<StmtWrite*>(curr)->write(frame_cost, regfile, *output);
+        frame_cost += costs.first + costs.second;
+        update_cost_log<PROFILE>(Write, costs.first, costs.second);
+        curr = curr->get_next();
         break;
       }
       default: {
-        auto costs = curr->exec(cost->get_cost(), regfile, memory);
-        cost->add_cost(costs.first + costs.second);
-        update_cost_log(curr->get_opcode(), costs.first, costs.second);
+        auto costs = curr->exec(frame_cost, regfile, memory);
+        frame_cost += costs.first + costs.second;
+        update_cost_log<PROFILE>(curr->get_opcode(), costs.first, costs.second);
         curr = curr->get_next();
       }
     }
   }
 }
 
+void State::start_profiles() {
+  if (options.profile)
+    profile.reset(program);
+  if (options.heap_profile) {
+    heap_profile.reset(program);
+    memory.set_heap_profile(&heap_profile);
+  }
+  if (options.aload_report)
+    aload_advisor.reset(program);
+  check_cost = cost_limit;
+  if (options.sample_period > 0) {
+    sampler.reset(program, options.sample_period);
+    check_cost = min(cost_limit, sampler.get_next());
+  }
+}
+
 uint64_t State::exec_program() {
+  error_filename = program->get_filename();
   Function* main = program->get_function("main");
   if (main == nullptr)
     invoke_runtime_error("missing main function");
-  uint64_t res = exec_function(nullptr, main);
+  start_profiles();
+  // calls grow the frame stack and the cost tree, not the host stack, so deep recursion ends here
+  try {
+    if (options.profile || options.aload_report)
+      return exec_function<true>(main);
+    return exec_function<false>(main);
+  } catch (bad_alloc&) {
+    invoke_runtime_error("out-of-memory");
+  }
+}
+
+#if defined(__GNUC__)
+#define THREADED_DISPATCH
+#endif
+
+#ifdef THREADED_DISPATCH
+#define DISPATCH() goto *dispatch_table[pc->opcode]
+#else
+#define DISPATCH() goto dispatch
+#endif
+
+template <bool PROFILE>
+inline void State::bc_charge(Opcode opcode, double inst_cost, double wait_cost, double& frame_cost) {
+  // the same additions in the same order as exec_function, so that the costs match to the last bit
+  frame_cost += inst_cost + wait_cost;
+  if (PROFILE) {
+    update_cost_log<PROFILE>(opcode, inst_cost, wait_cost);
+    return;
+  }
+  cost_per_inst[opcode] += inst_cost;
+  total_wait_cost += wait_cost;
+}
+
+template <bool PROFILE>
+inline void State::bc_enter(const Bytecode& bytecode, const Insn* insn) {
+  if (PROFILE)
+    return;
+  const BcSegment& segment = bytecode.get_segments()[insn->segment];
+  executed += segment.ninsts;
+  const BcOpCount* counts = bytecode.get_op_counts() + segment.first_count;
+  for (uint32_t i = 0; i < segment.ncounts; i++)
+    inst_count[counts[i].opcode] += counts[i].count;
+}
+
+template <bool PROFILE>
+inline uint64_t State::bc_bop(const Insn* insn, double& frame_cost) {
+  error_line_num = insn->line;
+  double cost_acc = frame_cost;
+  auto op1 = read_valid_operand(insn->op1, regfile);
+  auto op2 = read_valid_operand(insn->op2, regfile);
+  uint64_t res = insn->bop_fn(op1.first, op2.first);
+  regfile.write_valid_reg(insn->lhs, res);
+  double wait_cost = max(get_wait_cost(cost_acc, op1.second), get_wait_cost(cost_acc, op2.second));
+  double inst_cost = cost_of(insn->bop_kind);
+  bc_charge<PROFILE>(Bop, inst_cost, wait_cost, frame_cost);
   return res;
 }
 
+template <bool PROFILE>
+inline void State::bc_uop(const Insn* insn, double& frame_cost) {
+  error_line_num = insn->line;
+  double cost_acc = frame_cost;
+  auto op = read_valid_operand(insn->op1, regfile);
+  uint64_t res = insn->uop_fn(op.first);
+  regfile.write_valid_reg(insn->lhs, res);
+  double wait_cost = get_wait_cost(cost_acc, op.second);
+  bc_charge<PROFILE>(Uop, Cost::UOP, wait_cost, frame_cost);
+}
+
+template <bool PROFILE>
+inline void State::bc_load(const Insn* insn, double& frame_cost) {
+  error_line_num = insn->line;
+  double cost_acc = frame_cost;
+  auto res = read_valid_operand(insn->op1, regfile);
+  uint64_t addr = res.first + insn->ofs;
+  uint64_t result;
+  double inst_cost = memory.exec_load(insn->is_async, insn->msize, addr, result);
+  double wait_cost = get_wait_cost(cost_acc, res.second);
+  regfile.write_valid_reg(insn->lhs, result);
+
+  if (insn->is_async) {
+    if (is_stack(insn->msize, addr))
+      regfile.set_async(insn->lhs, cost_acc + wait_cost + Cost::ALOAD + Cost::WAIT_STACK);
+    else if (is_heap(insn->msize, addr))
+      regfile.set_async(insn->lhs, cost_acc + wait_cost + Cost::ALOAD + Cost::WAIT_HEAP);
+    else
+      invoke_runtime_error("accessing address between 10248 and 20480");
+  }
+
+  bc_charge<PROFILE>(Load, inst_cost, wait_cost, frame_cost);
+}
+
+template <bool PROFILE>
+inline void State::bc_store(const Insn* insn, double& frame_cost) {
+  error_line_num = insn->line;
+  double cost_acc = frame_cost;
+  auto res = read_valid_operand(insn->op1, regfile);
+  uint64_t addr = res.first + insn->ofs;
+  auto v = read_valid_operand(insn->op2, regfile);
+  double wait_cost = max(get_wait_cost(cost_acc, res.second), get_wait_cost(cost_acc, v.second));
+  double inst_cost = memory.exec_store(insn->msize, addr, v.first);
+  bc_charge<PROFILE>(Store, inst_cost, wait_cost, frame_cost);
+}
+
+template <bool PROFILE>
+inline void State::bc_malloc(const Insn* insn, double& frame_cost) {
+  error_line_num = insn->line;
+  double cost_acc = frame_cost;
+  auto size = read_valid_operand(insn->op1, regfile);
+  uint64_t addr;
+  double inst_cost = memory.exec_malloc(size.first, addr);
+  regfile.write_valid_reg(insn->lhs, addr);
+  double wait_cost = get_wait_cost(cost_acc, size.second);
+  bc_charge<PROFILE>(Malloc, inst_cost, wait_cost, frame_cost);
+}
+
+template <bool PROFILE>
+inline void State::bc_free(const Insn* insn, double& frame_cost) {
+  error_line_num = insn->line;
+  double cost_acc = frame_cost;
+  auto addr = read_valid_operand(insn->op1, regfile);
+  double inst_cost = memory.exec_free(addr.first);
+  double wait_cost = get_wait_cost(cost_acc, addr.second);
+  bc_charge<PROFILE>(Free, inst_cost, wait_cost, frame_cost);
+}
+
+template <bool PROFILE>
+inline uint32_t State::bc_br_cond(const Insn* insn, uint64_t cond, double wait_cost, double& frame_cost) {
+  double inst_cost = cond != 0 ? Cost::BRCOND_TRUE : Cost::BRCOND_FALSE;
+  bc_charge<PROFILE>(BrCond, inst_cost, wait_cost, frame_cost);
+  return cond != 0 ? insn->target1 : insn->target2;
+}
+
+// continues in native code if the function has some for pc and no register waits for an aload,
+// whose waits native code leaves out; hot counts a call or a back-edge towards compiling it
+#define JIT_ENTER(hot) \
+  if (JIT) { \
+    const void* native = jit->enter(pc - code, hot); \
+    if (native != nullptr && !regfile.has_pending()) { \
+      uint64_t exit = jit->run(native, frame_cost, base_cost); \
+      pc = code + (uint32_t)exit; \
+      if ((exit >> 32) == JitExitBudget) { \
+        error_line_num = jit->get_exit_line(); \
+        CHECK_BUDGET(); \
+        bc_enter<PROFILE>(bytecode, pc); \
+      } \
+      else if ((exit >> 32) == JitExitError) \
+        rethrow_exception(jit->take_error()); \
+    } \
+  }
+
+template <bool PROFILE, bool JIT>
+uint64_t State::exec_bytecode_function(const Bytecode& bytecode, uint32_t fidx, Jit* jit) {
+  vector<BcCallFrame> frames;
+  const BcFunction& function = bytecode.get_function(fidx);
+  auto cost = cost_arena.alloc(*function.fname);
+  main_cost = cost;
+  double frame_cost = 0;
+  double base_cost = 0;
+
+  const Insn* code = bytecode.get_code();
+  const Operand* operands = bytecode.get_operands();
+  const Insn* pc = code + function.entry;
+
+#ifdef THREADED_DISPATCH
+  // must follow the order of Opcode and FusedOpcode
+  static void* dispatch_table[LEN_BC_OPCODE] = {
+    &&op_ret, &&op_br_uncond, &&op_br_cond, &&op_switch,
+    &&op_malloc, &&op_free, &&op_load, &&op_store,
+    &&op_bop, &&op_sum, &&op_uop, &&op_select,
+    &&op_call, &&op_assert, &&op_read, &&op_write,
+    &&op_bop_br_cond, &&op_uop_bop_br_cond, &&op_bop_bop_br_cond, &&op_load_bop,
+    &&op_checked
+  };
+#endif
+
+  bc_enter<PROFILE>(bytecode, pc);
+  DISPATCH();
+
+#ifndef THREADED_DISPATCH
+  dispatch:
+  switch (pc->opcode) {
+    case Ret: goto op_ret;
+    case BrUncond: goto op_br_uncond;
+    case BrCond: goto op_br_cond;
+    case Switch: goto op_switch;
+    case Malloc: goto op_malloc;
+    case Free: goto op_free;
+    case Load: goto op_load;
+    case Store: goto op_store;
+    case Bop: goto op_bop;
+    case Sum: goto op_sum;
+    case Uop: goto op_uop;
+    case Select: goto op_select;
+    case Call: goto op_call;
+    case Assert: goto op_assert;
+    case Read: goto op_read;
+    case Write: goto op_write;
+    case BopBrCond: goto op_bop_br_cond;
+    case UopBopBrCond: goto op_uop_bop_br_cond;
+    case BopBopBrCond: goto op_bop_bop_br_cond;
+    case LoadBop: goto op_load_bop;
+    case Checked: goto op_checked;
+    default:
+      invoke_runtime_error("unknown instruction");
+      return 0;
+  }
+#endif
+
+  op_ret: {
+    error_line_num = pc->line;
+    auto ret = read_operand(pc->op1, regfile);
+    double wait_cost = get_wait_cost(frame_cost, ret.second);
+    bc_charge<PROFILE>(Ret, Cost::RET, wait_cost, frame_cost);
+    cost->add_call(frame_cost);
+    if (frames.empty())
+      return ret.first;
+
+    // see StmtCall::release_args
+    BcCallFrame& frame = frames.back();
+    base_cost -= frame.cost_acc;
+    frame_cost = frame.cost_acc + frame_cost;
+    regfile.pop_frame();
+    const Operand* args = operands + frame.call->target2;
+    for (uint32_t i = 0; i < frame.call->nops; i++) {
+      if (args[i].is_reg)
+        regfile.drop_async(args[i].reg);
+    }
+    regfile.write_reg(frame.lhs, ret.first);
+    cost = frame.cost;
+    pc = frame.ret;
+    frames.pop_back();
+    CHECK_BUDGET();
+    bc_enter<PROFILE>(bytecode, pc);
+    JIT_ENTER(false);
+    DISPATCH();
+  }
+  op_br_uncond: {
+    error_line_num = pc->line;
+    const Insn* from = pc;
+    pc = code + pc->target1;
+    bc_charge<PROFILE>(BrUncond, Cost::BRUNCOND, 0, frame_cost);
+    CHECK_BUDGET();
+    bc_enter<PROFILE>(bytecode, pc);
+    JIT_ENTER(pc <= from);
+    DISPATCH();
+  }
+  op_br_cond: {
+    error_line_num = pc->line;
+    auto c = read_operand(pc->op1, regfile);
+    double wait_cost = get_wait_cost(frame_cost, c.second);
+    const Insn* from = pc;
+    pc = code + bc_br_cond<PROFILE>(pc, c.first, wait_cost, frame_cost);
+    CHECK_BUDGET();
+    bc_enter<PROFILE>(bytecode, pc);
+    JIT_ENTER(pc <= from);
+    DISPATCH();
+  }
+  op_switch: {
+    error_line_num = pc->line;
+    auto c = read_operand(pc->op1, regfile);
+    double wait_cost = get_wait_cost(frame_cost, c.second);
+    const Insn* from = pc;
+    pc = code + bytecode.get_switch(pc->target1).lookup(c.first);
+    bc_charge<PROFILE>(Switch, Cost::SWITCH, wait_cost, frame_cost);
+    CHECK_BUDGET();
+    bc_enter<PROFILE>(bytecode, pc);
+    JIT_ENTER(pc <= from);
+    DISPATCH();
+  }
+  op_malloc: {
+    bc_malloc<PROFILE>(pc, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_free: {
+    bc_free<PROFILE>(pc, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_load: {
+    bc_load<PROFILE>(pc, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_store: {
+    bc_store<PROFILE>(pc, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_bop: {
+    bc_bop<PROFILE>(pc, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_sum: {
+    error_line_num = pc->line;
+    double cost_acc = frame_cost;
+    uint64_t res = 0;
+    double wait_until = -1.0;
+    for (uint32_t i = 0; i < pc->nops; i++) {
+      auto v = read_valid_operand(operands[pc->target1 + i], regfile);
+      res += v.first;
+      if (v.second > wait_until)
+        wait_until = v.second;
+    }
+    regfile.write_valid_reg(pc->lhs, res);
+    double wait_cost = get_wait_cost(cost_acc, wait_until);
+    bc_charge<PROFILE>(Sum, Cost::SUM, wait_cost, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_uop: {
+    bc_uop<PROFILE>(pc, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_select: {
+    error_line_num = pc->line;
+    double cost_acc = frame_cost;
+    auto v_cond = read_valid_operand(pc->op1, regfile);
+    auto v_true = read_valid_operand(pc->op2, regfile);
+    auto v_false = read_valid_operand(pc->op3, regfile);
+
+    double wait_until = v_cond.second;
+    if (v_cond.first != 0) {
+      if (v_true.second > wait_until)
+        wait_until = v_true.second;
+      regfile.write_valid_reg(pc->lhs, v_true.first);
+    }
+    else {
+      if (v_false.second > wait_until)
+        wait_until = v_false.second;
+      regfile.write_valid_reg(pc->lhs, v_false.first);
+    }
+
+    double wait_cost = get_wait_cost(cost_acc, wait_until);
+    bc_charge<PROFILE>(Select, Cost::TERNARY, wait_cost, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_call: {
+    error_line_num = pc->line;
+    const BcFunction& callee = bytecode.get_function(pc->target1);
+    int nargs = callee.nargs;
+    if (nargs != (int)pc->nops) {
+      invoke_runtime_error("calling with incorrect number of arguments");
+      return 0;
+    }
+    if (options.max_call_depth != 0 && frames.size() >= options.max_call_depth) {
+      invoke_runtime_error("exceeding the maximum call depth");
+      return 0;
+    }
+
+    // see StmtCall::setup_args
+    const Operand* args = operands + pc->target2;
+    double cost_acc = frame_cost;
+    uint64_t vals[NARGREGS];
+    double wait_until = -1.0;
+    for (int i = 0; i < nargs; i++) {
+      auto val = peek_operand(args[i], regfile);
+      vals[i] = val.first;
+      if (val.second > wait_until)
+        wait_until = val.second;
+    }
+
+    regfile.push_frame(nargs);
+    for (int i = 0; i < nargs; i++)
+      regfile.set_value((Reg)((int)A1 + i), vals[i]);
+
+    double wait_cost = get_wait_cost(cost_acc, get_wait_cost(cost_acc, wait_until));
+    double inst_cost = Cost::CALL + nargs * Cost::PER_ARG;
+    bc_charge<PROFILE>(Call, inst_cost, wait_cost, frame_cost);
+    CHECK_BUDGET();
+    frames.push_back(BcCallFrame{pc + 1, pc->lhs, pc, cost, frame_cost});
+    base_cost += frame_cost;
+    cost = enter_callee(cost, *callee.fname);
+    frame_cost = 0;
+    pc = code + callee.entry;
+    bc_enter<PROFILE>(bytecode, pc);
+    JIT_ENTER(true);
+    DISPATCH();
+  }
+  op_assert: {
+    error_line_num = pc->line;
+    double cost_acc = frame_cost;
+    auto val1 = read_valid_operand(pc->op1, regfile);
+    auto val2 = read_valid_operand(pc->op2, regfile);
+    double wait_until = max(val1.second, val2.second);
+    if (val1.first != val2.first)
+      invoke_assertion_failed(regfile);
+    double wait_cost = get_wait_cost(cost_acc, wait_until);
+    bc_charge<PROFILE>(Assert, Cost::ASSERT, wait_cost, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_read: {
+    error_line_num = pc->line;
+    if (first_read_hook)
+      run_first_read_hook();
+    uint64_t result;
+    if (!input->read_u64(result))
+      invoke_runtime_error("invalid input");
+    regfile.write_valid_reg(pc->lhs, result);
+    bc_charge<PROFILE>(Read, Cost::CALL, 0, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+  op_write: {
+    error_line_num = pc->line;
+    double cost_acc = frame_cost;
+    auto result = read_valid_operand(pc->op1, regfile);
+    output->write_line(result.first);
+    regfile.write_valid_reg(pc->lhs, 0);
+    double inst_cost = Cost::CALL + Cost::PER_ARG;
+    double wait_cost = get_wait_cost(cost_acc, result.second);
+    bc_charge<PROFILE>(Write, inst_cost, wait_cost, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+
+  // the branch reads the register just written, so it never waits
+  op_bop_br_cond: {
+    uint64_t res = bc_bop<PROFILE>(pc, frame_cost);
+    error_line_num = pc[1].line;
+    const Insn* from = pc;
+    pc = code + bc_br_cond<PROFILE>(pc + 1, res, 0, frame_cost);
+    CHECK_BUDGET();
+    bc_enter<PROFILE>(bytecode, pc);
+    JIT_ENTER(pc <= from);
+    DISPATCH();
+  }
+  op_uop_bop_br_cond: {
+    bc_uop<PROFILE>(pc, frame_cost);
+    uint64_t res = bc_bop<PROFILE>(pc + 1, frame_cost);
+    error_line_num = pc[2].line;
+    const Insn* from = pc;
+    pc = code + bc_br_cond<PROFILE>(pc + 2, res, 0, frame_cost);
+    CHECK_BUDGET();
+    bc_enter<PROFILE>(bytecode, pc);
+    JIT_ENTER(pc <= from);
+    DISPATCH();
+  }
+  op_bop_bop_br_cond: {
+    bc_bop<PROFILE>(pc, frame_cost);
+    uint64_t res = bc_bop<PROFILE>(pc + 1, frame_cost);
+    error_line_num = pc[2].line;
+    const Insn* from = pc;
+    pc = code + bc_br_cond<PROFILE>(pc + 2, res, 0, frame_cost);
+    CHECK_BUDGET();
+    bc_enter<PROFILE>(bytecode, pc);
+    JIT_ENTER(pc <= from);
+    DISPATCH();
+  }
+  op_load_bop: {
+    bc_load<PROFILE>(pc, frame_cost);
+    bc_bop<PROFILE>(pc + 1, frame_cost);
+    pc += 2;
+    DISPATCH();
+  }
+
+  // an instruction whose registers may be invalid, given the same checks as in exec_function
+  op_checked: {
+    error_line_num = pc->line;
+    const Stmt* stmt = pc->stmt;
+    double cost_acc = frame_cost;
+    pair<double, double> costs;
+    if (stmt->get_opcode() == Read) {
+      if (first_read_hook)
+        run_first_read_hook();
+      costs = dynamic_cast<const StmtRead*>(stmt)->read(regfile, *input);
+    }
+    else if (stmt->get_opcode() == Write)
+      costs = dynamic_cast<const StmtWrite*>(stmt)->write(cost_acc, regfile, *output);
+    else
+      costs = stmt->exec(cost_acc, regfile, memory);
+    bc_charge<PROFILE>(stmt->get_opcode(), costs.first, costs.second, frame_cost);
+    pc++;
+    DISPATCH();
+  }
+}
+
+/** f of native code, which cannot unwind; keeps what f throws for the interpreter to rethrow */
+template <typename F>
+static int jit_catch(JitFrame* frame, F f) {
+  try {
+    f(frame->frame_cost);
+    return 0;
+  }
+  catch (...) {
+    *frame->error = current_exception();
+    return 1;
+  }
+}
+
+int State::jit_load(JitFrame* frame, const Insn* insn) {
+  State* state = (State*)frame->state;
+  return jit_catch(frame, [&](double& frame_cost) { state->bc_load<false>(insn, frame_cost); });
+}
+
+int State::jit_store(JitFrame* frame, const Insn* insn) {
+  State* state = (State*)frame->state;
+  return jit_catch(frame, [&](double& frame_cost) { state->bc_store<false>(insn, frame_cost); });
+}
+
+int State::jit_malloc(JitFrame* frame, const Insn* insn) {
+  State* state = (State*)frame->state;
+  return jit_catch(frame, [&](double& frame_cost) { state->bc_malloc<false>(insn, frame_cost); });
+}
+
+int State::jit_free(JitFrame* frame, const Insn* insn) {
+  State* state = (State*)frame->state;
+  return jit_catch(frame, [&](double& frame_cost) { state->bc_free<false>(insn, frame_cost); });
+}
+
+int State::jit_bop(JitFrame* frame, const Insn* insn) {
+  State* state = (State*)frame->state;
+  return jit_catch(frame, [&](double& frame_cost) { state->bc_bop<false>(insn, frame_cost); });
+}
+
+void State::jit_write(JitFrame* frame, uint64_t reg, uint64_t val) {
+  ((State*)frame->state)->regfile.write_valid_reg((Reg)reg, val);
+}
+
+JitRuntime State::jit_runtime() {
+  return JitRuntime{this, regfile.get_values(), regfile.get_dirty(), &executed, &inst_limit, &check_cost,
+                    inst_count, cost_per_inst, jit_load, jit_store, jit_malloc, jit_free, jit_bop, jit_write,
+                    options.jit_threshold};
+}
+
+uint64_t State::exec_bytecode(const Bytecode& bytecode) {
+  error_filename = program->get_filename();
+  start_profiles();
+  try {
+    if (options.profile || options.aload_report)
+      return exec_bytecode_function<true, false>(bytecode, bytecode.get_main_function(), nullptr);
+    if (options.jit && Jit::is_supported()) {
+      Jit jit(bytecode, jit_runtime());
+      return exec_bytecode_function<false, true>(bytecode, bytecode.get_main_function(), &jit);
+    }
+    return exec_bytecode_function<false, false>(bytecode, bytecode.get_main_function(), nullptr);
+  } catch (bad_alloc&) {
+    invoke_runtime_error("out-of-memory");
+  }
+}
+
 string State::inst_log_line(Opcode opcode, const string &inst) const {
   stringstream ss;
   ss << fixed << setprecision(4);
@@ -188,6 +995,96 @@ string State::inst_log_to_string() const {
   return ss.str();
 }
 
+uint64_t State::get_inst_count() const { return executed; }
+
+uint64_t State::get_inst_count(Opcode opcode) const { return inst_count[opcode]; }
+
+double State::get_inst_cost(Opcode opcode) const { return cost_per_inst[opcode]; }
+
 double State::get_total_wait_cost() const {
   return total_wait_cost;
 }
+
+/** keeps the first error of the logs */
+static void check_log(string& error, FdOutput& log, const string& filename) {
+  string log_error = log.check(filename);
+  if (error.empty())
+    error = log_error;
+}
+
+string State::write_logs(uint64_t ret, const string& prefix) const {
+  string error;
+  string log_name = prefix + "sf-interpreter.log";
+  FdOutput log(log_name);
+  double exec_cost = get_cost_value();
+  double max_heap_size = get_max_alloced_size();
+  if (abort_reason.empty()) {
+    log.write_str("Returned: ");
+    log.write_line(ret);
+  }
+  else {
+    log.write_str("Aborted: " + abort_reason + "\n");
+  }
+  log.write_str("Execution cost: ");
+  log.write_fixed(exec_cost);
+  log.write_str("\nMax heap usage (bytes): ");
+  log.write_fixed(max_heap_size);
+  log.write_str("\nTotal cost: ");
+  log.write_fixed(exec_cost + max_heap_size * 16.0);
+  log.write_str("\n");
+  check_log(error, log, log_name);
+
+  if (options.cost_log_format == CostLogJsonLines) {
+    string cost_log_name = prefix + "sf-interpreter-cost.jsonl";
+    FdOutput cost_log(cost_log_name);
+    cost_log.write_str("{\"total_waiting_cost\":");
+    cost_log.write_fixed(get_total_wait_cost());
+    cost_log.write_str("}\n");
+    get_cost()->write_json_lines(cost_log);
+    check_log(error, cost_log, cost_log_name);
+  }
+  else {
+    string cost_log_name = prefix + "sf-interpreter-cost.log";
+    FdOutput cost_log(cost_log_name);
+    cost_log.write_str("Total waiting cost: ");
+    cost_log.write_fixed(get_total_wait_cost());
+    cost_log.write_str("\n");
+    get_cost()->write_text(cost_log, options.cost_tree_mode == CostTreeContext);
+    check_log(error, cost_log, cost_log_name);
+  }
+
+  string inst_log_name = prefix + "sf-interpreter-inst.log";
+  FdOutput inst_log(inst_log_name);
+  inst_log.write_str(inst_log_to_string());
+  check_log(error, inst_log, inst_log_name);
+
+  if (options.profile) {
+    string profile_log_name = prefix + "sf-interpreter-profile.log";
+    FdOutput profile_log(profile_log_name);
+    profile.write_report(profile_log, program);
+    check_log(error, profile_log, profile_log_name);
+    string stacks_name = prefix + "sf-interpreter-stacks.txt";
+    FdOutput stacks(stacks_name);
+    get_cost()->write_collapsed(stacks);
+    check_log(error, stacks, stacks_name);
+  }
+  if (options.heap_profile) {
+    string heap_log_name = prefix + "sf-interpreter-heap.log";
+    FdOutput heap_log(heap_log_name);
+    heap_profile.write_report(heap_log, program);
+    check_log(error, heap_log, heap_log_name);
+  }
+  if (options.aload_report) {
+    string aload_log_name = prefix + "sf-interpreter-aload.log";
+    FdOutput aload_log(aload_log_name);
+    aload_advisor.write_report(aload_log, program);
+    check_log(error, aload_log, aload_log_name);
+  }
+  if (options.sample_period > 0) {
+    string samples_name = prefix + "sf-interpreter-samples.bin";
+    FdOutput samples(samples_name);
+    sampler.write(samples);
+    check_log(error, samples, samples_name);
+  }
+  return error;
+}
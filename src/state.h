@@ -1,54 +1,249 @@
 #ifndef SWPP_ASM_INTERPRETER_STATE_H
 #define SWPP_ASM_INTERPRETER_STATE_H
 
+#include <functional>
+#include <limits>
 #include <vector>
 
 #include "regfile.h"
 #include "memory.h"
 #include "program.h"
+#include "bytecode.h"
+#include "io.h"
+#include "profile.h"
+#include "heapprofile.h"
+#include "aloadadvisor.h"
+#include "sampler.h"
+#include "jit.h"
 
 using namespace std;
 
 
+/** how calls are recorded in the cost tree */
+enum CostTreeMode {
+  // one node per call path, merging repeated calls
+  CostTreeContext = 0,
+  // one node per call
+  CostTreeCalls
+};
+
+enum CostLogFormat {
+  // sf-interpreter-cost.log, an indented tree
+  CostLogText = 0,
+  // sf-interpreter-cost.jsonl, one JSON object per node
+  CostLogJsonLines
+};
+
+/** settings of an execution */
+struct ExecOptions {
+  // 0 for unlimited
+  uint64_t max_call_depth = 0;
+  CostTreeMode cost_tree_mode = CostTreeContext;
+  CostLogFormat cost_log_format = CostLogText;
+  // records sf-interpreter-profile.log and sf-interpreter-stacks.txt
+  bool profile = false;
+  // records sf-interpreter-heap.log
+  bool heap_profile = false;
+  // records sf-interpreter-aload.log
+  bool aload_report = false;
+  // compiles the hot functions of the bytecode engine to native code, unless profiling
+  bool jit = false;
+  uint64_t jit_threshold = JIT_THRESHOLD;
+  // limits on the executed instructions and the total cost, 0 for unlimited;
+  // checked at every branch, call and return, so a run can overshoot by a basic block
+  uint64_t max_insts = 0;
+  double max_cost = 0;
+  // samples the call chain into sf-interpreter-samples.bin every this many units of cost, 0 for never
+  double sample_period = 0;
+};
+
 class CostStack {
 private:
-  string fname;
+  const string& fname;
   double cost;
+  uint64_t calls;
   vector<CostStack*> callees;
 
 public:
+  /** fname is an interned name of the executed Program */
   explicit CostStack(const string& _fname);
+  const string& get_fname() const;
   double get_cost() const;
+  uint64_t get_calls() const;
+  /** records a finished call that cost _cost in total */
+  void add_call(double _cost);
+  /** records the cost of an unfinished call */
   void add_cost(double _cost);
   void set_callee(CostStack* callee);
-  string to_string(const string& indent) const;
+  /** the callee node of fname, nullptr if there is none yet */
+  CostStack* find_callee(const string& _fname) const;
+  /** streams the tree rooted here as indented text, one line per node */
+  void write_text(Output& out, bool show_calls) const;
+  /** streams the tree rooted here as JSON lines, one object per node in preorder */
+  void write_json_lines(Output& out) const;
+  /** streams the tree rooted here as collapsed stacks, one line per path with its self cost */
+  void write_collapsed(Output& out) const;
+};
+
+/** owns CostStack nodes, allocated in blocks and freed together */
+class CostArena {
+private:
+  vector<CostStack*> blocks;
+  size_t used;
+
+public:
+  CostArena();
+  ~CostArena();
+  CostArena(const CostArena&) = delete;
+  CostArena& operator=(const CostArena&) = delete;
+
+  CostStack* alloc(const string& fname);
+  /** destroys every node, keeping the first block for reuse */
+  void reset();
 };
 
 
 class State {
 private:
+  /** a suspended caller in the statement engine */
+  struct CallFrame {
+    Stmt* ret;
+    Reg lhs;
+    const StmtCall* call;
+    CostStack* cost;
+    double cost_acc;
+  };
+
+  /** a suspended caller in the bytecode engine */
+  struct BcCallFrame {
+    const Insn* ret;
+    Reg lhs;
+    const Insn* call;
+    CostStack* cost;
+    double cost_acc;
+  };
+
   RegFile regfile;
   Memory memory;
+  CostArena cost_arena;
   CostStack* main_cost;
   double cost_per_inst[Opcode::LEN_OPCODE];
-  int inst_count[Opcode::LEN_OPCODE];
+  uint64_t inst_count[Opcode::LEN_OPCODE];
+  uint64_t executed;
+  // options.max_insts and max_cost, with the largest values for unlimited
+  uint64_t inst_limit;
+  double cost_limit;
+  // cost_limit or the cost of the next sample, whichever comes first
+  double check_cost;
   double total_wait_cost;
-  Program* program;
+  const Program* program;
+  ExecOptions options;
+  Input* input;
+  Output* output;
+  Profile profile;
+  HeapProfile heap_profile;
+  AloadAdvisor aload_advisor;
+  Sampler sampler;
+  // why the execution was stopped early, empty if it was not
+  string abort_reason;
+  // called once, before the first read
+  function<void()> first_read_hook;
 
-  uint64_t exec_function(CostStack* parent, Function* function);
+  // the engines are instantiated with and without profiling, so it costs nothing when disabled,
+  // and the bytecode engine also with the JIT, which jit is for
+  template <bool PROFILE>
+  uint64_t exec_function(Function* function);
+  template <bool PROFILE, bool JIT>
+  uint64_t exec_bytecode_function(const Bytecode& bytecode, uint32_t fidx, Jit* jit);
+  /** charges an instruction with its cost, but counts it only when profiling */
+  template <bool PROFILE>
+  void bc_charge(Opcode opcode, double inst_cost, double wait_cost, double& frame_cost);
+  /** counts the instructions of the segment starting at insn, unless profiling counts each by itself */
+  template <bool PROFILE>
+  void bc_enter(const Bytecode& bytecode, const Insn* insn);
+  // bytecode handlers shared by single and fused instructions
+  template <bool PROFILE>
+  uint64_t bc_bop(const Insn* insn, double& frame_cost);
+  template <bool PROFILE>
+  void bc_uop(const Insn* insn, double& frame_cost);
+  template <bool PROFILE>
+  void bc_load(const Insn* insn, double& frame_cost);
+  template <bool PROFILE>
+  void bc_store(const Insn* insn, double& frame_cost);
+  template <bool PROFILE>
+  void bc_malloc(const Insn* insn, double& frame_cost);
+  template <bool PROFILE>
+  void bc_free(const Insn* insn, double& frame_cost);
+  template <bool PROFILE>
+  uint32_t bc_br_cond(const Insn* insn, uint64_t cond, double wait_cost, double& frame_cost);
+  // runtime calls of native code, the handlers above without profiling
+  static int jit_load(JitFrame* frame, const Insn* insn);
+  static int jit_store(JitFrame* frame, const Insn* insn);
+  static int jit_malloc(JitFrame* frame, const Insn* insn);
+  static int jit_free(JitFrame* frame, const Insn* insn);
+  static int jit_bop(JitFrame* frame, const Insn* insn);
+  static void jit_write(JitFrame* frame, uint64_t reg, uint64_t val);
+  JitRuntime jit_runtime();
+  CostStack* enter_callee(CostStack* caller, const string& fname);
+  /** whether to stop for the budget or a sample, which on_budget tells apart */
+  bool over_budget(double total_cost) const {
+    return executed > inst_limit || total_cost > check_cost;
+  }
+  /** adds the costs of the unfinished calls to the cost tree and throws BudgetExceeded */
+  template <typename Frame>
+  [[noreturn]] void abort_on_budget(CostStack* cost, double frame_cost, const vector<Frame>& frames);
+  /** aborts if the budget is exceeded, and samples the call chain otherwise */
+  template <typename Frame>
+  void on_budget(CostStack* cost, double frame_cost, double base_cost, const vector<Frame>& frames);
+  static int call_line(const CallFrame& frame) { return frame.call->get_line(); }
+  static int call_line(const BcCallFrame& frame) { return frame.call->line; }
+  void run_first_read_hook();
+  /** clears the profiles that options ask for, before an execution */
+  void start_profiles();
+  template <bool PROFILE>
   void update_cost_log(Opcode opcode, double inst_cost, double wait_cost);
   string inst_log_line(Opcode opcode, const string& inst) const;
 
 public:
   State();
+  ~State();
+  State(const State&) = delete;
+  State& operator=(const State&) = delete;
+
+  /**
+   * the state of a new State with the same program, options and I/O, for another
+   * run; costs time in the memory touched by the last run rather than its capacity
+   */
+  void reset();
 
-  void set_program(Program* _program);
+  /** the program of the next executions, which only read it */
+  void set_program(const Program* _program);
+  void set_options(const ExecOptions& _options);
+  /** sources and sinks of the read and write functions, fd 0 and fd 1 by default */
+  void set_io(Input& _input, Output& _output);
+  /**
+   * hook runs when the program is about to read for the first time, and may
+   * e.g. fork and set_io to continue from there with different inputs
+   */
+  void set_first_read_hook(function<void()> hook);
   double get_cost_value() const;
   CostStack* get_cost() const;
   uint64_t get_max_alloced_size() const;
   uint64_t exec_program();
+  uint64_t exec_bytecode(const Bytecode& bytecode);
   string inst_log_to_string() const;
+  /** number of executed instructions */
+  uint64_t get_inst_count() const;
+  /** executed instructions of opcode and their cost, as in sf-interpreter-inst.log */
+  uint64_t get_inst_count(Opcode opcode) const;
+  double get_inst_cost(Opcode opcode) const;
   double get_total_wait_cost() const;
+  /**
+   * writes sf-interpreter.log, the cost log and -inst.log, each prefixed with prefix,
+   * and the profiles that were enabled; also after BudgetExceeded, with the costs so far;
+   * returns "cannot write <file>: <reason>" for the first log that failed, empty if none did
+   */
+  string write_logs(uint64_t ret, const string& prefix) const;
 };
 
 #endif //SWPP_ASM_INTERPRETER_STATE_H
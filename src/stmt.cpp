@@ -1,11 +1,14 @@
 #include <iostream>
 
 #include "stmt.h"
+#include "program.h"
 #include "error.h"
 
 
 Stmt::Stmt(int _line, Reg _lhs, Opcode _opcode): line(_line), lhs(_lhs), opcode(_opcode), next(nullptr) {}
 
+Stmt::~Stmt() {}
+
 int Stmt::get_line() const { return line; }
 
 Reg Stmt::get_lhs() const { return lhs; }
@@ -16,6 +19,15 @@ Stmt *Stmt::get_next() const { return next; }
 
 void Stmt::set_next(Stmt *stmt) { next = stmt; }
 
+void Stmt::link(const Function* function, Program* program) {}
+
+Stmt* link_bb(const Function* function, const string& bbname) {
+  Stmt* stmt = function->get_bb(bbname);
+  if (stmt == nullptr)
+    invoke_syntax_error("branching to an undefined basic block");
+  return stmt;
+}
+
 double get_wait_cost(double cost_acc, double wait_until) {
   return cost_acc >= wait_until ? 0 : wait_until - cost_acc;
 }
@@ -25,6 +37,8 @@ double get_wait_cost(double cost_acc, double wait_until) {
 
 StmtRet::StmtRet(int _line, Value _val): Stmt(_line, RegNone, Ret), val(_val) {}
 
+const Value& StmtRet::get_val() const { return val; }
+
 pair<uint64_t, double> StmtRet::get_val(double cost_acc, RegFile &regfile) const {
   auto ret = val.get_value(regfile);
   return make_pair(ret.first, get_wait_cost(cost_acc, ret.second));
@@ -34,29 +48,42 @@ pair<double, double> StmtRet::exec(double cost_acc, RegFile &regfile, Memory &me
   return make_pair(0, 0);
 }
 
-StmtBrUncond::StmtBrUncond(int _line, string _bb): Stmt(_line, RegNone, BrUncond), bb(move(_bb)) {}
+StmtBrUncond::StmtBrUncond(int _line, const string& _bb): Stmt(_line, RegNone, BrUncond), bb(_bb) {}
+
+Stmt* StmtBrUncond::get_bb() const { return target; }
 
-string StmtBrUncond::get_bb() const { return bb; }
+void StmtBrUncond::link(const Function* function, Program* program) {
+  target = link_bb(function, bb);
+}
 
 pair<double, double> StmtBrUncond::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   return make_pair(0, 0);
 }
 
-StmtBrCond::StmtBrCond(int _line, Value _cond, string _true_bb, string _false_bb):
-Stmt(_line, RegNone, BrCond), cond(_cond), true_bb(move(_true_bb)), false_bb(move(_false_bb)) {}
+StmtBrCond::StmtBrCond(int _line, Value _cond, const string& _true_bb, const string& _false_bb):
+Stmt(_line, RegNone, BrCond), cond(_cond), true_bb(_true_bb), false_bb(_false_bb) {}
+
+const Value& StmtBrCond::get_cond() const { return cond; }
 
-pair<string, double> StmtBrCond::get_bb(double cost_acc, RegFile& regfile) {
+Stmt* StmtBrCond::get_true_bb() const { return true_target; }
+
+Stmt* StmtBrCond::get_false_bb() const { return false_target; }
+
+pair<Stmt*, double> StmtBrCond::get_bb(double cost_acc, RegFile& regfile, bool& eval) const {
   auto c = cond.get_value(regfile);
   if (c.first != 0) {
     eval = true;
-    return make_pair(true_bb, get_wait_cost(cost_acc, c.second));
+    return make_pair(true_target, get_wait_cost(cost_acc, c.second));
   } else {
     eval = false;
-    return make_pair(false_bb, get_wait_cost(cost_acc, c.second));
+    return make_pair(false_target, get_wait_cost(cost_acc, c.second));
   }
 }
 
-bool StmtBrCond::get_eval() const { return eval; }
+void StmtBrCond::link(const Function* function, Program* program) {
+  true_target = link_bb(function, true_bb);
+  false_target = link_bb(function, false_bb);
+}
 
 pair<double, double> StmtBrCond::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   return make_pair(0, 0);
@@ -64,29 +91,40 @@ pair<double, double> StmtBrCond::exec(double cost_acc, RegFile &regfile, Memory
 
 StmtSwitch::StmtSwitch(int _line, Value _cond): Stmt(_line, RegNone, Switch), cond(_cond) {}
 
-bool StmtSwitch::set_bb(uint64_t val, string bb) {
+bool StmtSwitch::set_bb(uint64_t val, const string& bb) {
   auto it = bb_map.find(val);
   if (it != bb_map.end())
     return false;
-  bb_map.insert(pair<uint64_t, string>(val, move(bb)));
+  bb_map.insert(pair<uint64_t, const string*>(val, &bb));
   return true;
 }
 
-pair<string, double> StmtSwitch::get_bb(double cost_acc, RegFile& regfile) const {
+pair<Stmt*, double> StmtSwitch::get_bb(double cost_acc, RegFile& regfile) const {
   auto c = cond.get_value(regfile);
-  auto it = bb_map.find(c.first);
-  if (it == bb_map.end())
-    return make_pair(default_bb, get_wait_cost(cost_acc, c.second));
-  return make_pair(it->second, get_wait_cost(cost_acc, c.second));
+  return make_pair(table.lookup(c.first), get_wait_cost(cost_acc, c.second));
 }
 
-void StmtSwitch::set_default(string bb) { default_bb = move(bb); }
+void StmtSwitch::set_default(const string& bb) { default_bb = &bb; }
 
 bool StmtSwitch::case_exists(uint64_t val) const {
   auto it = bb_map.find(val);
   return it != bb_map.end();
 }
 
+const Value& StmtSwitch::get_cond() const { return cond; }
+
+const map<uint64_t, Stmt*>& StmtSwitch::get_targets() const { return target_map; }
+
+Stmt* StmtSwitch::get_default() const { return default_target; }
+
+void StmtSwitch::link(const Function* function, Program* program) {
+  target_map.clear();
+  for (auto& it: bb_map)
+    target_map.insert(pair<uint64_t, Stmt*>(it.first, link_bb(function, *it.second)));
+  default_target = link_bb(function, *default_bb);
+  table = JumpTable<Stmt*>(target_map, default_target);
+}
+
 pair<double, double> StmtSwitch::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   return make_pair(0, 0);
 }
@@ -96,6 +134,8 @@ pair<double, double> StmtSwitch::exec(double cost_acc, RegFile &regfile, Memory
 
 StmtMalloc::StmtMalloc(int _line, Reg _lhs, Value _val): Stmt(_line, _lhs, Malloc), val(_val) {}
 
+const Value& StmtMalloc::get_val() const { return val; }
+
 pair<double, double> StmtMalloc::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   auto size = val.get_value(regfile);
   uint64_t addr;
@@ -106,6 +146,8 @@ pair<double, double> StmtMalloc::exec(double cost_acc, RegFile &regfile, Memory
 
 StmtFree::StmtFree(int _line, Value _ptr): Stmt(_line, RegNone, Free), ptr(_ptr) {}
 
+const Value& StmtFree::get_ptr() const { return ptr; }
+
 pair<double, double> StmtFree::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   auto addr = ptr.get_value(regfile);
   return make_pair(memory.exec_free(addr.first), get_wait_cost(cost_acc, addr.second));
@@ -114,6 +156,14 @@ pair<double, double> StmtFree::exec(double cost_acc, RegFile &regfile, Memory &m
 StmtLoad::StmtLoad(int _line, Reg _lhs, bool _is_async, MSize _size, Value _ptr, uint64_t _ofs):
 Stmt(_line, _lhs, Load), is_async(_is_async), size(_size), ptr(_ptr), ofs(_ofs) {}
 
+bool StmtLoad::get_is_async() const { return is_async; }
+
+MSize StmtLoad::get_size() const { return size; }
+
+const Value& StmtLoad::get_ptr() const { return ptr; }
+
+uint64_t StmtLoad::get_ofs() const { return ofs; }
+
 pair<double, double> StmtLoad::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   auto res = ptr.get_value(regfile);
   uint64_t addr = res.first + ofs;
@@ -139,6 +189,14 @@ pair<double, double> StmtLoad::exec(double cost_acc, RegFile &regfile, Memory &m
 StmtStore::StmtStore(int _line, MSize _size, Value _val, Value _ptr, uint64_t _ofs):
 Stmt(_line, RegNone, Store), size(_size), val(_val), ptr(_ptr), ofs(_ofs) {}
 
+MSize StmtStore::get_size() const { return size; }
+
+const Value& StmtStore::get_val() const { return val; }
+
+const Value& StmtStore::get_ptr() const { return ptr; }
+
+uint64_t StmtStore::get_ofs() const { return ofs; }
+
 pair<double, double> StmtStore::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   auto res = ptr.get_value(regfile);
   uint64_t addr = res.first + ofs;
@@ -151,233 +209,21 @@ pair<double, double> StmtStore::exec(double cost_acc, RegFile &regfile, Memory &
 /** binary operations */
 
 StmtBop::StmtBop(int _line, Reg _lhs, BopKind _bop_kind, Value _val1, Value _val2, Size _size):
-Stmt(_line, _lhs, Bop), bop_kind(_bop_kind), val1(_val1), val2(_val2), size(_size) {}
+Stmt(_line, _lhs, Bop), bop_kind(_bop_kind), val1(_val1), val2(_val2), size(_size),
+bop_fn(select_bop(_bop_kind, _size)) {}
 
-bool is_signed_op(BopKind bop_kind) {
-  switch(bop_kind) {
-    case Udiv:
-    case Urem:
-    case Mul:
-    case Shl:
-    case Lshr:
-    case And:
-    case Or:
-    case Xor:
-    case Add:
-    case Sub:
-    case Eq:
-    case Ne:
-    case Ugt:
-    case Uge:
-    case Ult:
-    case Ule:
-      return false;
-    case Ashr:
-    case Sdiv:
-    case Srem:
-    case Sgt:
-    case Sge:
-    case Slt:
-    case Sle:
-      return true;
-  }
-}
+BopKind StmtBop::get_bop_kind() const { return bop_kind; }
 
-bool is_shift_op(BopKind bop_kind) {
-  switch(bop_kind) {
-    case Shl:
-    case Lshr:
-    case Ashr:
-      return true;
-    default:
-      return false;
-  }
-}
+const Value& StmtBop::get_val1() const { return val1; }
 
-uint64_t get_op1(BopKind bop_kind, Size size, uint64_t val) {
-  if (is_signed_op(bop_kind)) {
-    switch (size) {
-      case Size1:
-        if (val % 2 == 1)
-          return -1;
-        else
-          return 0;
-      case Size8:
-        return (int8_t)val;
-      case Size16:
-        return (int16_t)val;
-      case Size32:
-        return (int32_t)val;
-      case Size64:
-        return val;
-    }
-  }
-  else {
-    switch (size) {
-      case Size1:
-        if (val % 2 == 1)
-          return 1;
-        else
-          return 0;
-      case Size8:
-        return (uint8_t)val;
-      case Size16:
-        return (uint16_t)val;
-      case Size32:
-        return (uint32_t)val;
-      case Size64:
-        return val;
-    }
-  }
-}
+const Value& StmtBop::get_val2() const { return val2; }
 
-uint64_t get_op2(BopKind bop_kind, Size size, uint64_t val) {
-  if (is_shift_op(bop_kind)) {
-    return val % bw_of(size);
-  }
+Size StmtBop::get_size() const { return size; }
 
-  return get_op1(bop_kind, size, val);
-}
-
-uint64_t get_result(Size size, uint64_t val) {
-  switch (size) {
-    case Size1:
-      return val % 2;
-    case Size8:
-      return (uint8_t)val;
-    case Size16:
-      return (uint16_t)val;
-    case Size32:
-      return (uint32_t)val;
-    case Size64:
-      return val;
-  }
-}
+BopFn StmtBop::get_bop_fn() const { return bop_fn; }
 
 uint64_t StmtBop::compute(uint64_t op1, uint64_t op2) const {
-  op1 = get_op1(bop_kind, size, op1);
-  op2 = get_op2(bop_kind, size, op2);
-  uint64_t result = 0;
-
-  switch (bop_kind) {
-    case Udiv:
-      if (op2 == 0) {
-        invoke_runtime_error("division by zero");
-        return 0;
-      }
-      result = op1 / op2;
-      break;
-    case Sdiv:
-      if (op2 == 0) {
-        invoke_runtime_error("division by zero");
-        return 0;
-      }
-      result = (int64_t) op1 / (int64_t) op2;
-      break;
-    case Urem:
-      if (op2 == 0) {
-        invoke_runtime_error("division by zero");
-        return 0;
-      }
-      result = op1 % op2;
-      break;
-    case Srem:
-      if (op2 == 0) {
-        invoke_runtime_error("division by zero");
-        return 0;
-      }
-      result = (int64_t) op1 % (int64_t) op2;
-      break;
-    case Mul:
-      result = op1 * op2;
-      break;
-    case Shl:
-      result = op1 << op2;
-      break;
-    case Lshr:
-      result = op1 >> op2;
-      break;
-    case Ashr:
-      result = (int64_t) op1 >> op2;
-      break;
-    case And:
-      result = op1 & op2;
-      break;
-    case Or:
-      result = op1 | op2;
-      break;
-    case Xor:
-      result = op1 ^ op2;
-      break;
-    case Add:
-      result = op1 + op2;
-      break;
-    case Sub:
-      result = op1 - op2;
-      break;
-    case Eq:
-      if (op1 == op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Ne:
-      if (op1 != op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Ugt:
-      if (op1 > op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Uge:
-      if (op1 >= op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Ult:
-      if (op1 < op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Ule:
-      if (op1 <= op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Sgt:
-      if ((int64_t) op1 > (int64_t) op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Sge:
-      if ((int64_t) op1 >= (int64_t) op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Slt:
-      if ((int64_t) op1 < (int64_t) op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-    case Sle:
-      if ((int64_t) op1 <= (int64_t) op2)
-        result = 1;
-      else
-        result = 0;
-      break;
-  }
-
-  return get_result(size, result);
+  return bop_fn(op1, op2);
 }
 
 double cost_of(BopKind bop_kind) {
@@ -432,6 +278,10 @@ Stmt(_line, _lhs, Sum), size(_size) {
   }
 }
 
+const vector<Value>& StmtSum::get_values() const { return values; }
+
+Size StmtSum::get_size() const { return size; }
+
 pair<double, double> StmtSum::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   uint64_t res = 0;
   double wait_until = -1.0;
@@ -449,16 +299,19 @@ pair<double, double> StmtSum::exec(double cost_acc, RegFile &regfile, Memory &me
 /** unary operations */
 
 StmtUop::StmtUop(int _line, Reg _lhs, UopKind _uop_kind, Value _val, Size _size):
-Stmt(_line, _lhs, Uop), uop_kind(_uop_kind), val(_val), size(_size) {}
+Stmt(_line, _lhs, Uop), uop_kind(_uop_kind), val(_val), size(_size), uop_fn(select_uop(_uop_kind, _size)) {}
+
+UopKind StmtUop::get_uop_kind() const { return uop_kind; }
+
+const Value& StmtUop::get_val() const { return val; }
+
+Size StmtUop::get_size() const { return size; }
+
+UopFn StmtUop::get_uop_fn() const { return uop_fn; }
 
 pair<double, double> StmtUop::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   auto op = val.get_value(regfile);
-  uint64_t res = op.first;
-  if (uop_kind == UopKind::Incr)
-    res++;
-  else
-    res--;
-  res = get_result(size, res);
+  uint64_t res = uop_fn(op.first);
   regfile.write_reg(get_lhs(), res);
   return make_pair(Cost::UOP, get_wait_cost(cost_acc, op.second));
 }
@@ -469,6 +322,12 @@ pair<double, double> StmtUop::exec(double cost_acc, RegFile &regfile, Memory &me
 StmtSelect::StmtSelect(int _line, Reg _lhs, Value _cond, Value _val_true, Value _val_false):
 Stmt(_line, _lhs, Select), cond(_cond), val_true(_val_true), val_false(_val_false) {}
 
+const Value& StmtSelect::get_cond() const { return cond; }
+
+const Value& StmtSelect::get_val_true() const { return val_true; }
+
+const Value& StmtSelect::get_val_false() const { return val_false; }
+
 pair<double, double> StmtSelect::exec(double cost_acc, RegFile& regfile, Memory& memory) const {
   auto v_cond = cond.get_value(regfile);
   auto v_true = val_true.get_value(regfile);
@@ -493,28 +352,52 @@ pair<double, double> StmtSelect::exec(double cost_acc, RegFile& regfile, Memory&
 
 /** function call */
 
-StmtCall::StmtCall(int _line, Reg _lhs, string _fname): Stmt(_line, _lhs, Call), fname(move(_fname)) {}
+StmtCall::StmtCall(int _line, Reg _lhs, const string& _fname): Stmt(_line, _lhs, Call), fname(_fname) {}
 
-string StmtCall::get_fname() const { return fname; }
+const string& StmtCall::get_fname() const { return fname; }
+
+Function* StmtCall::get_callee() const { return callee; }
+
+void StmtCall::link(const Function* function, Program* program) {
+  callee = program->get_function(fname);
+  if (callee == nullptr)
+    invoke_syntax_error("calling an undefined function");
+}
 
 void StmtCall::push_arg(const Value arg) { args.push_back(arg); }
 
 int StmtCall::get_nargs() { return args.size(); }
 
-double StmtCall::setup_args(double cost_acc, RegFile &old, RegFile &regfile) {
+const vector<Value>& StmtCall::get_args() const { return args; }
+
+double StmtCall::setup_args(double cost_acc, RegFile &regfile, int nargs) {
+  // the callee starts from the registers of the caller as they were before
+  // reading the arguments, so only peek here and resolve in release_args
+  uint64_t vals[NARGREGS];
   double wait_until = - 1.0;
-  int r = (int)A1;
-  for (auto it: args) {
-    auto val = it.get_value(old);
-    regfile.set_value((Reg)r, val.first);
+  int i = 0;
+  for (auto& it: args) {
+    auto val = it.peek_value(regfile);
+    vals[i++] = val.first;
     if (val.second > wait_until)
       wait_until = val.second;
-    r++;
   }
 
+  regfile.push_frame(nargs);
+  for (i = 0; i < nargs; i++)
+    regfile.set_value((Reg)((int)A1 + i), vals[i]);
+
   return get_wait_cost(cost_acc, get_wait_cost(cost_acc, wait_until));
 }
 
+void StmtCall::release_args(RegFile &regfile) const {
+  regfile.pop_frame();
+  for (auto& it: args) {
+    if (it.is_reg())
+      regfile.drop_async(it.get_reg());
+  }
+}
+
 pair<double, double> StmtCall::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   return make_pair(0, 0);
 }
@@ -525,6 +408,10 @@ pair<double, double> StmtCall::exec(double cost_acc, RegFile &regfile, Memory &m
 StmtAssert::StmtAssert(int _line, Value _op1, Value _op2):
 Stmt(_line, RegNone, Assert), op1(_op1), op2(_op2){}
 
+const Value& StmtAssert::get_op1() const { return op1; }
+
+const Value& StmtAssert::get_op2() const { return op2; }
+
 pair<double, double> StmtAssert::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
   auto val1 = op1.get_value(regfile);
   auto val2 = op2.get_value(regfile);
@@ -542,25 +429,29 @@ pair<double, double> StmtAssert::exec(double cost_acc, RegFile &regfile, Memory
 
 StmtRead::StmtRead(int _line, Reg _lhs): Stmt(_line, _lhs, Read) {}
 
-pair<double, double> StmtRead::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
-  string input;
-  cin >> input;
-
-  try {
-    uint64_t result = stoull(input);
-    regfile.write_reg(get_lhs(), result);
-    return make_pair(Cost::CALL, 0);
-  } catch (exception& e) {
+pair<double, double> StmtRead::read(RegFile &regfile, Input &input) const {
+  uint64_t result;
+  if (!input.read_u64(result))
     invoke_runtime_error("invalid input");
-    return make_pair(0, 0);
-  }
+  regfile.write_reg(get_lhs(), result);
+  return make_pair(Cost::CALL, 0);
+}
+
+pair<double, double> StmtRead::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
+  return read(regfile, std_input());
 }
 
 StmtWrite::StmtWrite(int _line, Reg _lhs, Value _val): Stmt(_line, _lhs, Write), val(_val) {}
 
-pair<double, double> StmtWrite::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
+const Value& StmtWrite::get_val() const { return val; }
+
+pair<double, double> StmtWrite::write(double cost_acc, RegFile &regfile, Output &output) const {
   auto result = val.get_value(regfile);
-  cout << result.first << endl;
+  output.write_line(result.first);
   regfile.write_reg(get_lhs(), 0);
   return make_pair(Cost::CALL + Cost::PER_ARG, get_wait_cost(cost_acc, result.second));
 }
+
+pair<double, double> StmtWrite::exec(double cost_acc, RegFile &regfile, Memory &memory) const {
+  return write(cost_acc, regfile, std_output());
+}
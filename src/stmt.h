@@ -9,10 +9,19 @@
 #include "value.h"
 #include "size.h"
 #include "memory.h"
+#include "io.h"
+#include "arith.h"
+#include "jumptable.h"
 
 using namespace std;
 
 
+class Function;
+class Program;
+
+double get_wait_cost(double cost_acc, double wait_until);
+double cost_of(BopKind bop_kind);
+
 class Stmt {
 private:
   const int line;
@@ -22,6 +31,7 @@ private:
 
 public:
   Stmt(int _line, Reg _lhs, Opcode _opcode);
+  virtual ~Stmt();
 
   int get_line() const;
   Reg get_lhs() const;
@@ -29,6 +39,7 @@ public:
   Stmt* get_next() const;
   void set_next(Stmt* stmt);
 
+  virtual void link(const Function* function, Program* program);
   virtual pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const = 0;
 };
 
@@ -42,49 +53,64 @@ private:
 public:
   explicit StmtRet(int _line, Value _val);
 
+  const Value& get_val() const;
   pair<uint64_t, double> get_val(double cost_acc, RegFile &regfile) const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
 class StmtBrUncond: public Stmt {
 private:
-  const string bb;
+  const string& bb;
+  Stmt* target = nullptr;
 
 public:
-  explicit StmtBrUncond(int _line, string _bb);
+  explicit StmtBrUncond(int _line, const string& _bb);
 
-  string get_bb() const;
+  Stmt* get_bb() const;
+  void link(const Function* function, Program* program) override;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
 class StmtBrCond: public Stmt {
 private:
   const Value cond;
-  const string true_bb;
-  const string false_bb;
-  bool eval = true;
+  const string& true_bb;
+  const string& false_bb;
+  Stmt* true_target = nullptr;
+  Stmt* false_target = nullptr;
 
 public:
-  StmtBrCond(int _line, Value _cond, string _true_bb, string _false_bb);
-
-  pair<string, double> get_bb(double cost_acc, RegFile& regfile);
-  bool get_eval() const;
+  StmtBrCond(int _line, Value _cond, const string& _true_bb, const string& _false_bb);
+
+  const Value& get_cond() const;
+  Stmt* get_true_bb() const;
+  Stmt* get_false_bb() const;
+  /** eval is set to whether the true branch is taken */
+  pair<Stmt*, double> get_bb(double cost_acc, RegFile& regfile, bool& eval) const;
+  void link(const Function* function, Program* program) override;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
 class StmtSwitch: public Stmt {
 private:
   const Value cond;
-  map<uint64_t, string> bb_map;
-  string default_bb;
+  map<uint64_t, const string*> bb_map;
+  const string* default_bb = nullptr;
+  map<uint64_t, Stmt*> target_map;
+  Stmt* default_target = nullptr;
+  JumpTable<Stmt*> table;
 
 public:
   explicit StmtSwitch(int _line, Value _cond);
 
-  bool set_bb(uint64_t val, string bb);
-  void set_default(string bb);
+  bool set_bb(uint64_t val, const string& bb);
+  void set_default(const string& bb);
   bool case_exists(uint64_t val) const;
-  pair<string, double> get_bb(double cost_acc, RegFile& regfile) const;
+  const Value& get_cond() const;
+  const map<uint64_t, Stmt*>& get_targets() const;
+  Stmt* get_default() const;
+  pair<Stmt*, double> get_bb(double cost_acc, RegFile& regfile) const;
+  void link(const Function* function, Program* program) override;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -98,6 +124,7 @@ private:
 public:
   StmtMalloc(int _line, Reg _lhs, Value _val);
 
+  const Value& get_val() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -108,6 +135,7 @@ private:
 public:
   explicit StmtFree(int _line, Value _ptr);
 
+  const Value& get_ptr() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -121,6 +149,10 @@ private:
 public:
   StmtLoad(int _line, Reg _lhs, bool _is_async, MSize _size, Value _ptr, uint64_t _ofs);
 
+  bool get_is_async() const;
+  MSize get_size() const;
+  const Value& get_ptr() const;
+  uint64_t get_ofs() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -134,6 +166,10 @@ private:
 public:
   StmtStore(int _line, MSize _size, Value _val, Value _ptr, uint64_t _ofs);
 
+  MSize get_size() const;
+  const Value& get_val() const;
+  const Value& get_ptr() const;
+  uint64_t get_ofs() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -146,12 +182,18 @@ private:
   const Value val1;
   const Value val2;
   const Size size;
+  const BopFn bop_fn;
 
   uint64_t compute(uint64_t op1, uint64_t op2) const;
 
 public:
   StmtBop(int _line, Reg _lhs, BopKind _bop_kind, Value _val1, Value _val2, Size size);
 
+  BopKind get_bop_kind() const;
+  const Value& get_val1() const;
+  const Value& get_val2() const;
+  Size get_size() const;
+  BopFn get_bop_fn() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -168,6 +210,8 @@ private:
 public:
   StmtSum(int _line, Reg _lhs, const vector<Value>& _values, Size _size);
 
+  const vector<Value>& get_values() const;
+  Size get_size() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -179,10 +223,15 @@ private:
   const UopKind uop_kind;
   const Value val;
   const Size size;
+  const UopFn uop_fn;
 
 public:
   StmtUop(int _line, Reg _lhs, UopKind _uop_kind, Value _val, Size _size);
 
+  UopKind get_uop_kind() const;
+  const Value& get_val() const;
+  Size get_size() const;
+  UopFn get_uop_fn() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -198,6 +247,9 @@ private:
 public:
   StmtSelect(int _line, Reg _lhs, Value _cond, Value _val_true, Value _val_false);
 
+  const Value& get_cond() const;
+  const Value& get_val_true() const;
+  const Value& get_val_false() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -206,16 +258,21 @@ public:
 
 class StmtCall: public Stmt {
 private:
-  const string fname;
+  const string& fname;
   vector<Value> args;
+  Function* callee = nullptr;
 
 public:
-  StmtCall(int _line, Reg _lhs, string _fname);
+  StmtCall(int _line, Reg _lhs, const string& _fname);
 
-  string get_fname() const;
+  const string& get_fname() const;
+  Function* get_callee() const;
+  void link(const Function* function, Program* program) override;
   void push_arg(Value arg);
   int get_nargs();
-  double setup_args(double cost_acc, RegFile& old, RegFile& regfile);
+  const vector<Value>& get_args() const;
+  double setup_args(double cost_acc, RegFile& regfile, int nargs);
+  void release_args(RegFile& regfile) const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -230,6 +287,8 @@ private:
 public:
   StmtAssert(int _line, Value _op1, Value _op2);
 
+  const Value& get_op1() const;
+  const Value& get_op2() const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -240,6 +299,7 @@ class StmtRead: public Stmt {
 public:
   StmtRead(int _line, Reg _lhs);
 
+  pair<double, double> read(RegFile& regfile, Input& input) const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
@@ -250,6 +310,8 @@ private:
 public:
   StmtWrite(int _line, Reg _lhs, Value _val);
 
+  const Value& get_val() const;
+  pair<double, double> write(double cost_acc, RegFile& regfile, Output& output) const;
   pair<double, double> exec(double cost_acc, RegFile& regfile, Memory& memory) const override;
 };
 
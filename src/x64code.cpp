@@ -0,0 +1,308 @@
+#include <cstring>
+
+#include "x64code.h"
+#include "error.h"
+
+
+X64Code::X64Code(): bytes(), labels(), fixups() {}
+
+void X64Code::emit32(uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    emit8((v >> (8 * i)) & 0xff);
+}
+
+void X64Code::emit64(uint64_t v) {
+  emit32((uint32_t)v);
+  emit32((uint32_t)(v >> 32));
+}
+
+void X64Code::rex(bool w, int reg, int base, bool force) {
+  uint8_t b = 0x40 | (w ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((base >> 3) & 1);
+  if (b != 0x40 || force)
+    emit8(b);
+}
+
+void X64Code::modrm_reg(int reg, int rm) {
+  emit8(0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void X64Code::modrm_mem(int reg, X64Reg base, int32_t disp) {
+  emit8(0x80 | (reg & 7) << 3 | (base & 7));
+  // rsp and r12 need a SIB byte
+  if ((base & 7) == RSP)
+    emit8(0x24);
+  emit32((uint32_t)disp);
+}
+
+void X64Code::rel32(uint32_t label) {
+  fixups.emplace_back(bytes.size(), label);
+  emit32(0);
+}
+
+uint32_t X64Code::new_label() {
+  labels.push_back(SIZE_MAX);
+  return labels.size() - 1;
+}
+
+void X64Code::bind(uint32_t label) { labels[label] = bytes.size(); }
+
+size_t X64Code::label_offset(uint32_t label) const { return labels[label]; }
+
+size_t X64Code::size() const { return bytes.size(); }
+
+const vector<uint8_t>& X64Code::finish() {
+  for (auto& fixup: fixups) {
+    size_t target = labels[fixup.second];
+    if (target == SIZE_MAX)
+      invoke_runtime_error("unbound label in native code");
+    uint32_t rel = (uint32_t)(int32_t)((int64_t)target - (int64_t)(fixup.first + 4));
+    memcpy(bytes.data() + fixup.first, &rel, 4);
+  }
+  fixups.clear();
+  return bytes;
+}
+
+void X64Code::mov_imm(X64Reg dst, uint64_t imm) {
+  // mov r32, imm32 clears the upper half
+  if (imm <= UINT32_MAX) {
+    rex(false, 0, dst);
+    emit8(0xb8 + (dst & 7));
+    emit32((uint32_t)imm);
+    return;
+  }
+  rex(true, 0, dst);
+  emit8(0xb8 + (dst & 7));
+  emit64(imm);
+}
+
+void X64Code::mov_load(X64Reg dst, X64Reg base, int32_t disp) {
+  rex(true, dst, base);
+  emit8(0x8b);
+  modrm_mem(dst, base, disp);
+}
+
+void X64Code::mov_store(X64Reg base, int32_t disp, X64Reg src) {
+  rex(true, src, base);
+  emit8(0x89);
+  modrm_mem(src, base, disp);
+}
+
+void X64Code::mov_reg(X64Reg dst, X64Reg src) {
+  rex(true, src, dst);
+  emit8(0x89);
+  modrm_reg(src, dst);
+}
+
+void X64Code::alu(X64Alu op, X64Reg dst, X64Reg src) {
+  rex(true, src, dst);
+  emit8(op << 3 | 1);
+  modrm_reg(src, dst);
+}
+
+void X64Code::alu_imm(X64Alu op, X64Reg dst, int32_t imm) {
+  rex(true, 0, dst);
+  if (-128 <= imm && imm <= 127) {
+    emit8(0x83);
+    modrm_reg(op, dst);
+    emit8((uint8_t)imm);
+    return;
+  }
+  emit8(0x81);
+  modrm_reg(op, dst);
+  emit32((uint32_t)imm);
+}
+
+void X64Code::alu_mem_imm(X64Alu op, X64Reg base, int32_t disp, int32_t imm) {
+  rex(true, 0, base);
+  emit8(0x81);
+  modrm_mem(op, base, disp);
+  emit32((uint32_t)imm);
+}
+
+void X64Code::imul(X64Reg dst, X64Reg src) {
+  rex(true, dst, src);
+  emit8(0x0f);
+  emit8(0xaf);
+  modrm_reg(dst, src);
+}
+
+void X64Code::shift_cl(X64Shift op, X64Reg dst) {
+  rex(true, 0, dst);
+  emit8(0xd3);
+  modrm_reg(op, dst);
+}
+
+void X64Code::shift_imm(X64Shift op, X64Reg dst, uint8_t count) {
+  rex(true, 0, dst);
+  emit8(0xc1);
+  modrm_reg(op, dst);
+  emit8(count);
+}
+
+void X64Code::zero_extend(X64Reg r, int bits) {
+  switch (bits) {
+    case 1:
+      alu_imm(AluAnd, r, 1);
+      break;
+    case 8:
+    case 16:
+      rex(true, r, r);
+      emit8(0x0f);
+      emit8(bits == 8 ? 0xb6 : 0xb7);
+      modrm_reg(r, r);
+      break;
+    case 32:
+      // mov r32, r32
+      rex(false, r, r);
+      emit8(0x8b);
+      modrm_reg(r, r);
+      break;
+    default:
+      break;
+  }
+}
+
+void X64Code::sign_extend(X64Reg r, int bits) {
+  switch (bits) {
+    case 1:
+      shift_imm(ShiftShl, r, 63);
+      shift_imm(ShiftSar, r, 63);
+      break;
+    case 8:
+    case 16:
+      rex(true, r, r);
+      emit8(0x0f);
+      emit8(bits == 8 ? 0xbe : 0xbf);
+      modrm_reg(r, r);
+      break;
+    case 32:
+      // movsxd
+      rex(true, r, r);
+      emit8(0x63);
+      modrm_reg(r, r);
+      break;
+    default:
+      break;
+  }
+}
+
+void X64Code::test(X64Reg a, X64Reg b) {
+  rex(true, b, a);
+  emit8(0x85);
+  modrm_reg(b, a);
+}
+
+void X64Code::test32(X64Reg a, X64Reg b) {
+  rex(false, b, a);
+  emit8(0x85);
+  modrm_reg(b, a);
+}
+
+void X64Code::set_cond(X64Cond cond, X64Reg r) {
+  // without a REX prefix, 4 to 7 would be ah, ch, dh and bh
+  rex(false, 0, r, r >= RSP);
+  emit8(0x0f);
+  emit8(0x90 + cond);
+  modrm_reg(0, r);
+  zero_extend(r, 8);
+}
+
+void X64Code::cmov(X64Cond cond, X64Reg dst, X64Reg src) {
+  rex(true, dst, src);
+  emit8(0x0f);
+  emit8(0x40 + cond);
+  modrm_reg(dst, src);
+}
+
+void X64Code::bt_mem(X64Reg base, int32_t disp, uint8_t bit) {
+  rex(true, 0, base);
+  emit8(0x0f);
+  emit8(0xba);
+  modrm_mem(4, base, disp);
+  emit8(bit);
+}
+
+void X64Code::movq_to_xmm(X64Xmm dst, X64Reg src) {
+  emit8(0x66);
+  rex(true, dst, src);
+  emit8(0x0f);
+  emit8(0x6e);
+  modrm_reg(dst, src);
+}
+
+void X64Code::movsd_load(X64Xmm dst, X64Reg base, int32_t disp) {
+  emit8(0xf2);
+  rex(false, dst, base);
+  emit8(0x0f);
+  emit8(0x10);
+  modrm_mem(dst, base, disp);
+}
+
+void X64Code::movsd_store(X64Reg base, int32_t disp, X64Xmm src) {
+  emit8(0xf2);
+  rex(false, src, base);
+  emit8(0x0f);
+  emit8(0x11);
+  modrm_mem(src, base, disp);
+}
+
+void X64Code::addsd(X64Xmm dst, X64Xmm src) {
+  emit8(0xf2);
+  rex(false, dst, src);
+  emit8(0x0f);
+  emit8(0x58);
+  modrm_reg(dst, src);
+}
+
+void X64Code::ucomisd(X64Xmm a, X64Xmm b) {
+  emit8(0x66);
+  rex(false, a, b);
+  emit8(0x0f);
+  emit8(0x2e);
+  modrm_reg(a, b);
+}
+
+void X64Code::jmp(uint32_t label) {
+  emit8(0xe9);
+  rel32(label);
+}
+
+void X64Code::jcc(X64Cond cond, uint32_t label) {
+  emit8(0x0f);
+  emit8(0x80 + cond);
+  rel32(label);
+}
+
+void X64Code::jmp_reg(X64Reg target) {
+  rex(false, 0, target);
+  emit8(0xff);
+  modrm_reg(4, target);
+}
+
+void X64Code::jmp_table(X64Reg base, X64Reg index) {
+  // mod 00 with a SIB byte; base must not be rbp or r13, which would mean no base
+  uint8_t b = 0x40 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1);
+  if (b != 0x40)
+    emit8(b);
+  emit8(0xff);
+  emit8(0x24);
+  emit8(0xc0 | (index & 7) << 3 | (base & 7));
+}
+
+void X64Code::call_reg(X64Reg target) {
+  rex(false, 0, target);
+  emit8(0xff);
+  modrm_reg(2, target);
+}
+
+void X64Code::push(X64Reg r) {
+  rex(false, 0, r);
+  emit8(0x50 + (r & 7));
+}
+
+void X64Code::pop(X64Reg r) {
+  rex(false, 0, r);
+  emit8(0x58 + (r & 7));
+}
+
+void X64Code::ret() { emit8(0xc3); }
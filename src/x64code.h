@@ -0,0 +1,105 @@
+#ifndef SWPP_ASM_INTERPRETER_X64CODE_H
+#define SWPP_ASM_INTERPRETER_X64CODE_H
+
+#include <cinttypes>
+#include <vector>
+
+using namespace std;
+
+
+enum X64Reg {
+  RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+/** xmm registers, numbered as the general ones */
+enum X64Xmm {
+  XMM0 = 0, XMM1
+};
+
+/** condition codes, as in the low nibble of jcc, setcc and cmovcc */
+enum X64Cond {
+  CondB = 0x2, CondAE = 0x3, CondE = 0x4, CondNE = 0x5, CondBE = 0x6, CondA = 0x7,
+  CondL = 0xc, CondGE = 0xd, CondLE = 0xe, CondG = 0xf
+};
+
+/** two-operand integer instructions, as in the reg/opcode field of their 0x81 form */
+enum X64Alu {
+  AluAdd = 0, AluOr = 1, AluAnd = 4, AluSub = 5, AluXor = 6, AluCmp = 7
+};
+
+enum X64Shift {
+  ShiftShl = 4, ShiftShr = 5, ShiftSar = 7
+};
+
+/**
+ * x86-64 machine code under construction, with the few instructions that the
+ * JIT emits; memory operands are [base + disp32] and jumps to labels are rel32,
+ * so the code can be copied anywhere once its labels are bound
+ */
+class X64Code {
+private:
+  vector<uint8_t> bytes;
+  // the offset of each label, SIZE_MAX while unbound
+  vector<size_t> labels;
+  // rel32 fields and the labels they jump to
+  vector<pair<size_t, uint32_t>> fixups;
+
+  void emit8(uint8_t b) { bytes.push_back(b); }
+  void emit32(uint32_t v);
+  void emit64(uint64_t v);
+  void rex(bool w, int reg, int base, bool force = false);
+  void modrm_reg(int reg, int rm);
+  void modrm_mem(int reg, X64Reg base, int32_t disp);
+  void rel32(uint32_t label);
+
+public:
+  X64Code();
+
+  uint32_t new_label();
+  void bind(uint32_t label);
+  size_t label_offset(uint32_t label) const;
+  size_t size() const;
+  /** the bytes with every jump resolved; all its labels must be bound */
+  const vector<uint8_t>& finish();
+
+  void mov_imm(X64Reg dst, uint64_t imm);
+  void mov_load(X64Reg dst, X64Reg base, int32_t disp);
+  void mov_store(X64Reg base, int32_t disp, X64Reg src);
+  void mov_reg(X64Reg dst, X64Reg src);
+  void alu(X64Alu op, X64Reg dst, X64Reg src);
+  void alu_imm(X64Alu op, X64Reg dst, int32_t imm);
+  /** op qword [base + disp], imm */
+  void alu_mem_imm(X64Alu op, X64Reg base, int32_t disp, int32_t imm);
+  void imul(X64Reg dst, X64Reg src);
+  void shift_cl(X64Shift op, X64Reg dst);
+  void shift_imm(X64Shift op, X64Reg dst, uint8_t count);
+  /** keeps the low bits of r, 1, 8, 16, 32 or 64 of them */
+  void zero_extend(X64Reg r, int bits);
+  void sign_extend(X64Reg r, int bits);
+  void test(X64Reg a, X64Reg b);
+  void test32(X64Reg a, X64Reg b);
+  /** r = cond ? 1 : 0 */
+  void set_cond(X64Cond cond, X64Reg r);
+  void cmov(X64Cond cond, X64Reg dst, X64Reg src);
+  /** CF = bit of qword [base + disp] */
+  void bt_mem(X64Reg base, int32_t disp, uint8_t bit);
+
+  void movq_to_xmm(X64Xmm dst, X64Reg src);
+  void movsd_load(X64Xmm dst, X64Reg base, int32_t disp);
+  void movsd_store(X64Reg base, int32_t disp, X64Xmm src);
+  void addsd(X64Xmm dst, X64Xmm src);
+  void ucomisd(X64Xmm a, X64Xmm b);
+
+  void jmp(uint32_t label);
+  void jcc(X64Cond cond, uint32_t label);
+  void jmp_reg(X64Reg target);
+  /** jmp qword [base + index * 8] */
+  void jmp_table(X64Reg base, X64Reg index);
+  void call_reg(X64Reg target);
+  void push(X64Reg r);
+  void pop(X64Reg r);
+  void ret();
+};
+
+#endif //SWPP_ASM_INTERPRETER_X64CODE_H
@@ -0,0 +1,265 @@
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+#include "bytecode.h"
+#include "state.h"
+#include "mappedfile.h"
+#include "io.h"
+#include "error.h"
+
+using namespace std;
+
+
+#ifndef SF_BENCH_DIR
+#define SF_BENCH_DIR "bench"
+#endif
+
+/**
+ * runs programs with --aload-report and checks the report against the cost log:
+ * the waiting costs of the aloads add up to the total waiting cost where no read
+ * waits for two aloads at once, and the gap of a load to its first read counts a
+ * call in between once
+ */
+
+// the logs are written here and removed again
+#define LOG_PREFIX "sf-aload-test."
+
+static const char* LOG_NAMES[] = {"sf-interpreter.log", "sf-interpreter-cost.log", "sf-interpreter-inst.log",
+                                  "sf-interpreter-aload.log"};
+
+struct Report {
+  double wait_cost;
+  // the sum and the largest of the waiting costs of the aloads
+  double aload_wait_cost;
+  double max_aload_wait_cost;
+  // the average gap of every load by line, -1 if its value was never read
+  vector<pair<int, double>> gaps;
+};
+
+/** the columns of a tab-separated line of the report */
+static vector<string> split(const string& line) {
+  vector<string> cols;
+  stringstream ss(line);
+  string col;
+  while (getline(ss, col, '\t'))
+    cols.push_back(col);
+  return cols;
+}
+
+/** runs program on the statement engine or the bytecode engine and reads back its aload report */
+static bool run(const Program* program, bool use_bytecode, const string& input_data, Report& report) {
+  MemoryInput input(input_data);
+  StringOutput output;
+  ExecOptions options;
+  options.aload_report = true;
+
+  State state;
+  state.set_program(program);
+  state.set_options(options);
+  state.set_io(input, output);
+  uint64_t ret;
+  try {
+    if (use_bytecode) {
+      Bytecode bytecode(program);
+      ret = state.exec_bytecode(bytecode);
+    }
+    else
+      ret = state.exec_program();
+  } catch (ExecutionError& e) {
+    cerr << e.what() << endl;
+    return false;
+  }
+  string error = state.write_logs(ret, LOG_PREFIX);
+  if (!error.empty()) {
+    cerr << error << endl;
+    return false;
+  }
+
+  report = Report{state.get_total_wait_cost(), 0, 0, {}};
+  string contents;
+  {
+    MappedFile log(LOG_PREFIX "sf-interpreter-aload.log");
+    contents = string(log.contents());
+  }
+  for (auto name: LOG_NAMES)
+    remove((string(LOG_PREFIX) + name).c_str());
+
+  stringstream ss(contents);
+  string line, section;
+  while (getline(ss, line)) {
+    vector<string> cols = split(line);
+    if (cols.size() == 1) {
+      section = cols[0];
+      continue;
+    }
+    if (cols.empty() || cols[0] == "Function")
+      continue;
+    if (section == "Loads" && cols.size() == 6)
+      report.gaps.emplace_back(stoi(cols[1]), cols[4] == "-" ? -1 : stod(cols[4]));
+    else if (section == "Aloads" && cols.size() == 7) {
+      report.aload_wait_cost += stod(cols[5]);
+      report.max_aload_wait_cost = max(report.max_aload_wait_cost, stod(cols[5]));
+    }
+  }
+  return true;
+}
+
+/**
+ * runs source on both engines; false and a report on stderr if the report disagrees with the cost log;
+ * where reads wait for several aloads at once, each aload counts the whole wait, so that only the
+ * largest is bounded by the total waiting cost and their sum bounds it
+ */
+static bool check(const string& name, const string& source, const string& input,
+                  const vector<pair<int, double>>& expected_gaps, bool overlapping = false) {
+  unique_ptr<Program> program;
+  try {
+    program.reset(parse_source(source, name));
+  } catch (SyntaxError& e) {
+    cerr << name << ": " << e.what() << endl;
+    return false;
+  }
+
+  bool ok = true;
+  for (bool use_bytecode: {false, true}) {
+    const char* engine = use_bytecode ? "bytecode" : "tree";
+    Report report;
+    if (!run(program.get(), use_bytecode, input, report)) {
+      cerr << name << " on " << engine << ": cannot run" << endl;
+      ok = false;
+      continue;
+    }
+    // the report has 4 decimals
+    double eps = 1e-3 * (1 + report.wait_cost);
+    if (overlapping ? report.max_aload_wait_cost > report.wait_cost + eps ||
+                      report.aload_wait_cost < report.wait_cost - eps
+                    : fabs(report.aload_wait_cost - report.wait_cost) > eps) {
+      cerr << name << " on " << engine << ": waiting cost of the aloads " << report.aload_wait_cost
+           << " != total waiting cost " << report.wait_cost << endl;
+      ok = false;
+    }
+    for (auto& expected: expected_gaps) {
+      bool found = false;
+      for (auto& gap: report.gaps) {
+        if (gap.first != expected.first)
+          continue;
+        found = true;
+        if (fabs(gap.second - expected.second) > 1e-3) {
+          cerr << name << " on " << engine << ": average gap of the load on line " << gap.first << " "
+               << gap.second << " != " << expected.second << endl;
+          ok = false;
+        }
+      }
+      if (!found) {
+        cerr << name << " on " << engine << ": no load on line " << expected.first << endl;
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+// 12 muls before the call, so a callee on its caller's clock would not wait
+static const char* ALOAD_IN_CALLEE =
+  "start f 0:\n"
+  ".entry:\n"
+  "  r2 = malloc 8\n"
+  "  r3 = aload 8 r2\n"
+  "  r4 = add r3 1 64\n"
+  "  ret r4\n"
+  "end f\n"
+  "\n"
+  "start main 0:\n"
+  ".entry:\n"
+  "  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n"
+  "  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n"
+  "  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n"
+  "  r5 = call f\n"
+  "  ret r5\n"
+  "end main\n";
+
+static const char* ALOAD_AFTER_CALL =
+  "start g 0:\n"
+  ".entry:\n"
+  "  r1 = mul 1 1 64\n"
+  "  r1 = mul 1 1 64\n"
+  "  ret r1\n"
+  "end g\n"
+  "\n"
+  "start main 0:\n"
+  ".entry:\n"
+  "  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n"
+  "  r5 = call g\n"
+  "  r2 = malloc 8\n"
+  "  r3 = aload 8 r2\n"
+  "  r4 = add r3 1 64\n"
+  "  ret r4\n"
+  "end main\n";
+
+// the load on line 20 is read after a call of g costing 2 + 3; the aload of h waits only at the bottom of the recursion
+static const char* LOAD_ACROSS_CALL =
+  "start g 0:\n"
+  ".entry:\n"
+  "  r1 = mul 1 1 64\n"
+  "  r1 = mul 1 1 64\n"
+  "  ret r1\n"
+  "end g\n"
+  "\n"
+  "start main 0:\n"
+  ".entry:\n"
+  "  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n"
+  "  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n"
+  "  r2 = malloc 8\n"
+  "  r6 = call h 3\n"
+  "  r3 = load 8 r2\n"
+  "  r5 = call g\n"
+  "  r4 = add r3 r6 64\n"
+  "  ret r4\n"
+  "end main\n"
+  "\n"
+  "start h 1:\n"
+  ".entry:\n"
+  "  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n  r1 = mul 1 1 64\n"
+  "  r2 = malloc 8\n"
+  "  r3 = aload 8 r2\n"
+  "  r4 = icmp eq arg1 0 64\n"
+  "  br r4 .exit .rec\n"
+  ".rec:\n"
+  "  r5 = sub arg1 1 64\n"
+  "  r6 = call h r5\n"
+  "  r7 = add r3 r6 64\n"
+  "  ret r7\n"
+  ".exit:\n"
+  "  ret r3\n"
+  "end h\n";
+
+int main() {
+  int failures = 0;
+  int checks = 0;
+
+  checks++;
+  failures += !check("callee.s", ALOAD_IN_CALLEE, "", {});
+  checks++;
+  failures += !check("after_call.s", ALOAD_AFTER_CALL, "", {});
+  checks++;
+  failures += !check("across_call.s", LOAD_ACROSS_CALL, "", {{20, 5.0}});
+
+  string filename = string(SF_BENCH_DIR) + "/aload.s";
+  MappedFile file(filename);
+  if (!file.is_open()) {
+    cerr << "cannot read " << filename << endl;
+    return 1;
+  }
+  // its sum waits for four aloads at once
+  checks++;
+  failures += !check("aload.s", string(file.contents()), "20\n", {}, true);
+
+  cout << checks - failures << " of " << checks << " aload reports agree with the cost log" << endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,346 @@
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+#include "bytecode.h"
+#include "state.h"
+#include "mappedfile.h"
+#include "io.h"
+#include "error.h"
+
+using namespace std;
+
+
+#ifndef SF_BENCH_DIR
+#define SF_BENCH_DIR "bench"
+#endif
+
+/**
+ * runs programs on every engine and checks that each gives the results of the
+ * statement engine bit for bit: the output, the error, the cost tree, the
+ * waiting cost and the count and cost of every opcode
+ */
+
+enum Engine {
+  EngineTree = 0,
+  EngineBytecode,
+  EngineBytecodeProfile,
+  // compiling every function on its first call or back-edge, where native code is supported
+  EngineJit,
+  LEN_ENGINE
+};
+
+static const char* ENGINE_NAMES[LEN_ENGINE] = {"tree", "bytecode", "bytecode --profile", "bytecode --jit"};
+
+struct RunResult {
+  string outcome;
+  string output;
+  string cost_tree;
+  double cost;
+  double wait_cost;
+  uint64_t max_heap;
+  uint64_t inst_counts[Opcode::LEN_OPCODE];
+  double inst_costs[Opcode::LEN_OPCODE];
+};
+
+static RunResult run(State& state, const Program* program, const Bytecode& bytecode, Engine engine,
+                     ExecOptions options, const string& input_data) {
+  RunResult result{"", "", "", 0, 0, 0, {}, {}};
+  MemoryInput input(input_data);
+  StringOutput output;
+  options.profile = engine == EngineBytecodeProfile;
+  options.jit = engine == EngineJit;
+  options.jit_threshold = 1;
+
+  state.reset();
+  state.set_program(program);
+  state.set_options(options);
+  state.set_io(input, output);
+  try {
+    uint64_t ret = engine == EngineTree ? state.exec_program() : state.exec_bytecode(bytecode);
+    result.outcome = "returned " + to_string(ret);
+  } catch (ExecutionError& e) {
+    result.outcome = e.what();
+  }
+  output.flush();
+  result.output = output.get_str();
+
+  StringOutput cost_tree;
+  if (state.get_cost() != nullptr) {
+    state.get_cost()->write_text(cost_tree, options.cost_tree_mode == CostTreeContext);
+    cost_tree.flush();
+    result.cost = state.get_cost_value();
+  }
+  result.cost_tree = cost_tree.get_str();
+  result.wait_cost = state.get_total_wait_cost();
+  result.max_heap = state.get_max_alloced_size();
+  for (int i = 0; i < Opcode::LEN_OPCODE; i++) {
+    result.inst_counts[i] = state.get_inst_count((Opcode)i);
+    result.inst_costs[i] = state.get_inst_cost((Opcode)i);
+  }
+  return result;
+}
+
+/** what differs between expected and actual, empty if nothing; doubles must be equal to the last bit */
+static string compare(const RunResult& expected, const RunResult& actual) {
+  stringstream ss;
+  ss.precision(17);
+  if (expected.outcome != actual.outcome)
+    ss << "outcome \"" << expected.outcome << "\" != \"" << actual.outcome << "\"; ";
+  if (expected.output != actual.output)
+    ss << "output differs; ";
+  if (expected.cost_tree != actual.cost_tree)
+    ss << "cost tree differs; ";
+  if (memcmp(&expected.cost, &actual.cost, sizeof(double)) != 0)
+    ss << "cost " << expected.cost << " != " << actual.cost << "; ";
+  if (memcmp(&expected.wait_cost, &actual.wait_cost, sizeof(double)) != 0)
+    ss << "waiting cost " << expected.wait_cost << " != " << actual.wait_cost << "; ";
+  if (expected.max_heap != actual.max_heap)
+    ss << "max heap " << expected.max_heap << " != " << actual.max_heap << "; ";
+  for (int i = 0; i < Opcode::LEN_OPCODE; i++) {
+    if (expected.inst_counts[i] != actual.inst_counts[i])
+      ss << "count of opcode " << i << " " << expected.inst_counts[i] << " != " << actual.inst_counts[i] << "; ";
+    if (memcmp(&expected.inst_costs[i], &actual.inst_costs[i], sizeof(double)) != 0)
+      ss << "cost of opcode " << i << " " << expected.inst_costs[i] << " != " << actual.inst_costs[i] << "; ";
+  }
+  return ss.str();
+}
+
+/** runs source on every engine with options; false and a report on stderr if any differs */
+static bool check(State& state, const string& name, const string& source, const string& input,
+                  const ExecOptions& options) {
+  unique_ptr<Program> program;
+  try {
+    program.reset(parse_source(source, name));
+  } catch (SyntaxError& e) {
+    cerr << name << ": " << e.what() << endl;
+    return false;
+  }
+  Bytecode bytecode(program.get());
+
+  RunResult expected = run(state, program.get(), bytecode, EngineTree, options, input);
+  bool ok = true;
+  for (int engine = EngineTree + 1; engine < LEN_ENGINE; engine++) {
+    if (engine == EngineJit && !Jit::is_supported())
+      continue;
+    string diff = compare(expected, run(state, program.get(), bytecode, (Engine)engine, options, input));
+    if (!diff.empty()) {
+      cerr << name << " on " << ENGINE_NAMES[engine] << ": " << diff << endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+
+/** the programs of bench/ with small problem sizes */
+struct Workload {
+  const char* file;
+  uint64_t size;
+};
+
+static const Workload WORKLOADS[] = {
+  {"fib.s", 15}, {"linked_list.s", 100}, {"stack_array.s", 20}, {"heap_array.s", 20},
+  {"malloc_free.s", 2000}, {"switch.s", 20000}, {"aload.s", 50}, {"io.s", 2000}, {"bop.s", 5000}
+};
+
+static string make_input(const Workload& workload) {
+  stringstream ss;
+  ss << workload.size << "\n";
+  // io.s reads the numbers to sum after the count
+  if (string(workload.file) == "io.s") {
+    for (uint64_t i = 0; i < workload.size; i++)
+      ss << i * 7919 % 100003 << "\n";
+  }
+  return ss.str();
+}
+
+// fractional fixed costs in a long loop, where the order of the additions shows in the printed cost
+static const char* FRACTIONAL_COSTS =
+  "start main 0:\n"
+  ".entry:\n"
+  "  r1 = call read\n"
+  "  r2 = mul 0 0 64\n"
+  "  r3 = mul 0 0 64\n"
+  "  br .loop\n"
+  ".loop:\n"
+  "  r4 = select r2 r3 r1\n"
+  "  r5 = sum r2 r3 r4 r1 r2 r3 r4 r1 64\n"
+  "  r6 = urem r2 3 64\n"
+  "  switch r6 0 .a 1 .b .c\n"
+  ".a:\n"
+  "  r3 = add r3 1 64\n"
+  "  br .latch\n"
+  ".b:\n"
+  "  r3 = add r3 2 64\n"
+  "  br .latch\n"
+  ".c:\n"
+  "  br .latch\n"
+  ".latch:\n"
+  "  r2 = add r2 1 64\n"
+  "  r7 = icmp ult r2 r1 64\n"
+  "  br r7 .loop .exit\n"
+  ".exit:\n"
+  "  ret r3\n"
+  "end main\n";
+
+
+/** random programs of loops over arithmetic, memory accesses, aloads, calls and switches */
+class ProgramGenerator {
+private:
+  mt19937_64 rng;
+  stringstream ss;
+
+  uint64_t below(uint64_t n) { return rng() % n; }
+  bool chance(double p) { return uniform_real_distribution<double>(0, 1)(rng) < p; }
+
+  string reg() { return "r" + to_string(below(8) + 1); }
+  string constant() {
+    static const char* CONSTS[] = {"0", "1", "2", "3", "7", "255", "256", "65535", "4294967295",
+                                   "4294967296", "9223372036854775808", "18446744073709551615", "63", "64"};
+    return CONSTS[below(sizeof(CONSTS) / sizeof(CONSTS[0]))];
+  }
+  string operand(bool args) {
+    if (chance(0.6))
+      return reg();
+    if (args && chance(0.3))
+      return chance(0.5) ? "arg1" : "arg2";
+    return constant();
+  }
+  string size() {
+    static const char* SIZES[] = {"1", "8", "16", "32", "64"};
+    return SIZES[below(5)];
+  }
+  string msize() {
+    static const char* MSIZES[] = {"1", "2", "4", "8"};
+    return MSIZES[below(4)];
+  }
+  /** r25 = an 8-aligned address in the heap block at r20 */
+  void address() {
+    ss << "  r23 = and " << reg() << " 31 64\n  r24 = mul r23 8 64\n  r25 = add r20 r24 64\n";
+  }
+
+  void instruction(bool args, bool in_loop) {
+    static const char* BOPS[] = {"udiv", "urem", "mul", "shl", "lshr", "ashr", "and", "or", "xor", "add", "sub"};
+    static const char* CMPS[] = {"eq", "ne", "ugt", "uge", "ult", "ule", "sgt", "sge", "slt", "sle"};
+    string lhs = reg();
+    uint64_t k = below(100);
+    if (k < 30) {
+      string op = BOPS[below(11)];
+      // divisors that are never 0
+      string op2 = op == "udiv" || op == "urem" ? "7" : operand(args);
+      ss << "  " << lhs << " = " << op << " " << operand(args) << " " << op2 << " " << size() << "\n";
+    }
+    else if (k < 42)
+      ss << "  " << lhs << " = icmp " << CMPS[below(10)] << " " << operand(args) << " " << operand(args) << " "
+         << size() << "\n";
+    else if (k < 48)
+      ss << "  " << lhs << " = " << (chance(0.5) ? "incr " : "decr ") << operand(args) << " " << size() << "\n";
+    else if (k < 54)
+      ss << "  " << lhs << " = select " << operand(args) << " " << operand(args) << " " << operand(args) << "\n";
+    else if (k < 60) {
+      ss << "  " << lhs << " = sum";
+      for (int i = 0; i < 8; i++)
+        ss << " " << operand(args);
+      ss << " 64\n";
+    }
+    else if (k < 72 && in_loop) {
+      address();
+      ss << "  " << lhs << " = " << (chance(0.3) ? "aload " : "load ") << msize() << " r25\n";
+    }
+    else if (k < 80 && in_loop) {
+      address();
+      ss << "  store " << msize() << " " << operand(args) << " r25\n";
+    }
+    else if (k < 83 && in_loop)
+      ss << "  r26 = malloc " << (chance(0.5) ? "16" : "64") << "\n  free r26\n";
+    else if (k < 86 && in_loop)
+      ss << "  call write " << reg() << "\n";
+    else if (k < 90 && in_loop)
+      ss << "  sp = sub sp 8 64\n  store 8 " << reg() << " sp\n  " << lhs << " = load 8 sp\n  sp = add sp 8 64\n";
+    else
+      ss << "  " << lhs << " = add " << operand(args) << " " << operand(args) << " 64\n";
+  }
+
+  void instructions(uint64_t min, uint64_t max, bool args, bool in_loop) {
+    for (uint64_t n = min + below(max - min + 1); n > 0; n--)
+      instruction(args, in_loop);
+  }
+
+public:
+  explicit ProgramGenerator(uint64_t seed): rng(seed), ss() {}
+
+  string generate() {
+    ss.str("");
+    ss << "start f 2:\n.entry:\n";
+    instructions(1, 6, true, false);
+    ss << "  ret " << reg() << "\nend f\n\nstart main 0:\n.entry:\n  r20 = malloc 256\n";
+    for (int i = 1; i <= 8; i++)
+      ss << "  r" << i << " = add " << constant() << " 0 64\n";
+    ss << "  r21 = mul 0 0 64\n  br .loop\n.loop:\n";
+    instructions(2, 12, false, true);
+    if (chance(0.4))
+      ss << "  " << reg() << " = call f " << reg() << " " << reg() << "\n";
+    if (chance(0.4)) {
+      ss << "  r27 = urem r21 4 64\n  switch r27 0 .sa 1 .sb " << (chance(0.5) ? ".sa" : ".latch") << "\n.sa:\n";
+      instructions(0, 3, false, true);
+      ss << "  br .latch\n.sb:\n";
+      instructions(0, 3, false, true);
+      ss << "  br .latch\n";
+    }
+    else {
+      ss << "  br " << reg() << " .alt .latch\n.alt:\n";
+      instructions(0, 4, false, true);
+      ss << "  br .latch\n";
+    }
+    ss << ".latch:\n  r21 = add r21 1 64\n  r22 = icmp ult r21 " << 1 + below(60) << " 64\n  br r22 .loop .exit\n"
+       << ".exit:\n";
+    for (int i = 1; i <= 8; i++)
+      ss << "  call write r" << i << "\n";
+    ss << "  ret r1\nend main\n";
+    return ss.str();
+  }
+};
+
+int main() {
+  State state;
+  int failures = 0;
+  int checks = 0;
+
+  for (auto& workload: WORKLOADS) {
+    string filename = string(SF_BENCH_DIR) + "/" + workload.file;
+    MappedFile file(filename);
+    if (!file.is_open()) {
+      cerr << "cannot read " << filename << endl;
+      return 1;
+    }
+    checks++;
+    failures += !check(state, workload.file, string(file.contents()), make_input(workload), ExecOptions());
+  }
+
+  checks++;
+  failures += !check(state, "fractional.s", FRACTIONAL_COSTS, "300000\n", ExecOptions());
+
+  // also stopped by the budgets, at every branch, call and return
+  ProgramGenerator generator(2024);
+  mt19937_64 rng(7);
+  for (int i = 0; i < 300; i++) {
+    ExecOptions options;
+    switch (i % 4) {
+      case 1: options.max_insts = 1 + rng() % 3000; break;
+      case 2: options.max_cost = 1 + rng() % 20000; break;
+      case 3: options.cost_tree_mode = CostTreeCalls; break;
+      default: break;
+    }
+    checks++;
+    failures += !check(state, "random" + to_string(i) + ".s", generator.generate(), "", options);
+  }
+
+  cout << checks - failures << " of " << checks << " programs agree on every engine" << endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+#include <iostream>
+#include <string>
+
+#include "sampler.h"
+#include "io.h"
+
+using namespace std;
+
+
+void print_usage() {
+  cout << "USAGE: sf-samples [options] <samples file>" << endl;
+  cout << "Converts the sf-interpreter-samples.bin of sf-interpreter --sample=N, writing to stdout." << endl;
+  cout << "Options:" << endl;
+  cout << "  --format=collapsed  one line per call chain with its samples, for flamegraph.pl (default)" << endl;
+  cout << "  --format=pprof      an uncompressed profile.proto, for pprof" << endl;
+  cout << "  --lines             with --format=collapsed, tell the lines of each function apart" << endl;
+}
+
+int main(int argc, char** argv) {
+  string filename;
+  bool pprof = false;
+  bool lines = false;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--format=collapsed")
+      pprof = false;
+    else if (arg == "--format=pprof")
+      pprof = true;
+    else if (arg == "--lines")
+      lines = true;
+    else if (arg.rfind("--", 0) != 0 && filename.empty())
+      filename = arg;
+    else {
+      print_usage();
+      return 1;
+    }
+  }
+  if (filename.empty()) {
+    print_usage();
+    return 1;
+  }
+
+  Sampler sampler;
+  if (!sampler.read(filename)) {
+    cerr << "Cannot read samples from " << filename << endl;
+    return 1;
+  }
+  if (pprof)
+    sampler.write_pprof(std_output());
+  else
+    sampler.write_collapsed(std_output(), lines);
+  std_output().flush();
+  return 0;
+}